@@ -68,6 +68,11 @@ void split(FIterator1 begin1, FIterator1 end1, FIterator2 begin2, FIterator2 end
         last = next.first + 1;
         next = ::pp::find_first_of(last, end1, begin2, end2);
     }
+    if(last != end1) {
+        Container c;
+        std::copy(last, end1, std::back_inserter(c));
+        *out++ = std::move(c);
+    }
 }
 
 }
@@ -1,7 +1,11 @@
 #ifndef ASSEMBLER_H_
 #define ASSEMBLER_H_
 
+#include "dead_code.h"
 #include "instruction_factory.h"
+#include "layout.h"
+#include "peephole.h"
+#include "scheduler.h"
 #include <iostream>
 #include <stdexcept>
 #include <bitset>
@@ -20,15 +24,69 @@ private:
 	std::string message_;
 };
 
+// Passes run between parsing and encoding, in this order.
+struct AssemblerOptions {
+    std::string profile;     // LayoutOptimizer, by the counts in this file when not empty
+    bool optimize = false;   // DeadCodeEliminator, then PeepholeOptimizer
+    bool schedule = false;   // Scheduler
+    PipelineModel pipeline;
+    bool relocatable = false; // Leaves undefined symbols to the linker; not combined with the passes.
+};
+
 class Assembler {
 public:
-    explicit Assembler(std::string const &file_path);
+    explicit Assembler(std::string const &file_path, AssemblerOptions const &options = AssemblerOptions());
 
     void WriteToFile(std::string const &file_path);
 
+    // Writes the data segment in the GuestMemory::LoadImage format, where
+    // --load-data reads it; see DataSegment.
+    void WriteDataToFile(std::string const &file_path) const;
+
+    // Writes an object file for the linker; see ObjectFile.
+    void WriteObjectFile(std::string const &file_path) const;
+
+    // Writes the listing of the encoded program; see SourceMap::WriteListing.
+    void WriteListing(std::string const &file_path) const;
+
+    // Writes the address to line and label index of the encoded program; see SourceMap.
+    void WriteSourceMap(std::string const &file_path) const;
+
+    // Labels of the encoded program as (instruction index, name), sorted. After
+    // a pass moved code a label names the first instruction assembled from the
+    // line it named, and is dropped if that line has none left.
+    std::vector<std::pair<uint32_t, std::string>> Labels() const;
+
+    std::vector<uint32_t> GetCode() const;
+
+    std::string const &file_path() const { return file_path_; }
+    Parser const &parser() const { return *parser_; }
+
+    // The encoded program, after the enabled passes.
+    std::vector<Parser::InstructionData> const &instructions() const { return program_; }
+    std::unordered_map<std::string, uint32_t> const &functions() const { return functions_; }
+    // The data segment, with the code labels it holds moved along with the code.
+    DataSegment const &data() const { return data_; }
+    // The comment annotations of every file assembled, by Parser::files() index.
+    std::vector<SourceAnnotation> const &annotations() const { return annotations_; }
+
+    // Null unless the pass is enabled.
+    LayoutOptimizer const *layout() const { return layout_.get(); }
+    DeadCodeEliminator const *eliminator() const { return eliminator_.get(); }
+    PeepholeOptimizer const *optimizer() const { return optimizer_.get(); }
+    Scheduler const *scheduler() const { return scheduler_.get(); }
+
 private:
 	std::string file_path_;
 	std::unique_ptr<Parser> parser_;
+	std::unique_ptr<LayoutOptimizer> layout_;
+	std::unique_ptr<DeadCodeEliminator> eliminator_;
+	std::unique_ptr<PeepholeOptimizer> optimizer_;
+	std::unique_ptr<Scheduler> scheduler_;
+	std::vector<Parser::InstructionData> program_;
+	std::unordered_map<std::string, uint32_t> functions_;
+	DataSegment data_;
+	std::vector<SourceAnnotation> annotations_;
 	std::vector<std::unique_ptr<Instruction>> instructions_;
 };
 
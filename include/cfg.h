@@ -0,0 +1,68 @@
+#ifndef CFG_H_
+#define CFG_H_
+
+#include "parser.h"
+#include <cstddef>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace mips {
+
+// Control-flow graph of a parsed program (branch offsets and jump addresses
+// already resolved to numbers, as the Parser leaves them).
+//
+// Blocks start at the first instruction, branch and jump targets, function
+// entries and after every beq, bne, j, jal, jr and syscall. Successors are
+// intra-procedural: a jal block continues at its return point and records a
+// call edge to the callee instead, and jr blocks have none. Functions are
+// the entries the Parser found through .end plus any other jal target; a
+// block belongs to the first function whose entry reaches it.
+class ControlFlowGraph {
+public:
+    static constexpr std::size_t NONE = static_cast<std::size_t>(-1);
+
+    struct BasicBlock {
+        std::size_t begin;                    // Instruction range [begin, end).
+        std::size_t end;
+        std::vector<std::size_t> successors;
+        std::vector<std::size_t> predecessors;
+        std::size_t function = NONE;
+        std::size_t callee = NONE;            // Function called by a jal ending the block.
+    };
+
+    struct Function {
+        std::string name;
+        std::size_t entry;                    // Block index.
+        std::vector<std::size_t> blocks;
+        std::vector<std::size_t> callers;     // Blocks ending in a jal to this function.
+    };
+
+    // instructions must outlive the graph.
+    ControlFlowGraph(std::vector<Parser::InstructionData> const &instructions,
+                     std::unordered_map<std::string, uint32_t> const &functions);
+
+    std::vector<BasicBlock> const &blocks() const { return blocks_; }
+    std::vector<Function> const &functions() const { return functions_; }
+    std::size_t block_of(std::size_t instruction) const { return block_of_[instruction]; }
+
+    // Target of the branch or jump at instruction as an instruction index; may lie outside the program.
+    int64_t TargetOf(std::size_t instruction) const;
+
+    // Blocks reachable from the first instruction, main and roots, following successors and call edges.
+    std::vector<bool> ReachableBlocks(std::vector<std::size_t> const &roots = {}) const;
+
+    // Graphviz digraph with one cluster per function, dashed call edges and unreachable blocks grayed out.
+    void WriteDot(std::ostream &out) const;
+
+private:
+    std::vector<Parser::InstructionData> const &instructions_;
+    std::vector<BasicBlock> blocks_;
+    std::vector<Function> functions_;
+    std::vector<std::size_t> block_of_;
+};
+
+} // namespace mips
+
+#endif // CFG_H_
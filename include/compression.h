@@ -0,0 +1,38 @@
+#ifndef COMPRESSION_H_
+#define COMPRESSION_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace mips {
+
+class CorruptDataException : public std::exception {
+public:
+    explicit CorruptDataException(std::string const &info);
+
+    const char *what() const noexcept {
+        return message_.c_str();
+    }
+
+private:
+    std::string message_;
+};
+
+// Byte-oriented LZ77 codec in the style of the LZ4 block format: every
+// sequence is a token (literal length and match length nibbles), the
+// literals, a 16-bit little-endian match offset and length extension bytes.
+// The last sequence carries literals only. Fast rather than dense, which
+// suits data that is produced and consumed at simulation speed.
+
+// Appends the compressed form of data to out.
+void LZCompress(uint8_t const *data, std::size_t size, std::vector<uint8_t> &out);
+
+// Decompresses exactly raw_size bytes into out. Throws CorruptDataException on malformed input.
+void LZDecompress(uint8_t const *data, std::size_t size, uint8_t *out, std::size_t raw_size);
+
+} // namespace mips
+
+#endif // COMPRESSION_H_
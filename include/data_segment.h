@@ -0,0 +1,66 @@
+#ifndef DATA_SEGMENT_H_
+#define DATA_SEGMENT_H_
+
+#include "guest_memory.h"
+#include "instructions.h"
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace mips {
+
+// The initial contents of the data segment, starting at DATA_SEGMENT_OFFSET.
+// Bytes are packed into words least significant byte first, as the
+// syscalls read strings.
+//
+// Runs of one repeated value (.space, .word 0:1000) are kept as a value and
+// a count, so the segment costs memory in proportion to its directives and
+// not to its size; writing it out expands them as it goes.
+class DataSegment {
+public:
+    // Size in bytes.
+    uint64_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    uint32_t address() const { return static_cast<uint32_t>(DATA_SEGMENT_OFFSET + size_); }
+
+    void Clear();
+
+    // Pads with zeros up to a multiple of alignment, a power of two.
+    void Align(uint32_t alignment);
+
+    // count copies of the low unit (1, 2 or 4) bytes of value.
+    void Append(uint32_t unit, uint32_t value, uint64_t count = 1);
+    void AppendBytes(std::string const &bytes);
+
+    // Overwrites count words from the word aligned offset with value; the
+    // words must come from a single Append.
+    void Patch(uint64_t offset, uint32_t value, uint64_t count = 1);
+
+    // Writes the segment in the GuestMemory::LoadImage format: its word
+    // address, then one hexadecimal word per line.
+    void WriteImage(std::ostream &out) const;
+
+    // Stores the segment into memory, skipping zero words.
+    void Load(GuestMemory &memory) const;
+
+private:
+    struct Item {
+        uint32_t unit;
+        uint32_t value;
+        uint64_t count;
+        std::string bytes; // Used instead when unit is 0.
+    };
+
+    // Calls sink(word_address, word, count) for consecutive runs of words,
+    // covering the segment in address order.
+    template <typename Sink>
+    void ForEachRun(Sink &&sink) const;
+
+    std::vector<Item> items_;
+    uint64_t size_ = 0;
+};
+
+} // namespace mips
+
+#endif // DATA_SEGMENT_H_
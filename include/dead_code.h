@@ -0,0 +1,52 @@
+#ifndef DEAD_CODE_H_
+#define DEAD_CODE_H_
+
+#include "parser.h"
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace mips {
+
+// Drops the basic blocks that the ControlFlowGraph cannot reach from the
+// first instruction or main, which includes every function never called
+// from them. Branch offsets, jump addresses and the entries of the
+// remaining functions are moved to the compacted positions; removed
+// functions disappear from functions().
+//
+// Code addresses are only assumed to reach jr through jal and the functions
+// named in taken, whose address the data segment, la or a lw or sw offset
+// holds, so programs that compute other jump targets in registers must not
+// use this pass. The instructions holding such an address are passed as
+// references and come out at their new positions; the caller patches them.
+class DeadCodeEliminator {
+public:
+    DeadCodeEliminator(std::vector<Parser::InstructionData> const &instructions,
+                       std::unordered_map<std::string, uint32_t> const &functions,
+                       std::unordered_set<std::string> const &taken = {},
+                       std::vector<Parser::SymbolReference> const &references = {});
+
+    std::vector<Parser::InstructionData> const &instructions() const { return instructions_; }
+    std::unordered_map<std::string, uint32_t> const &functions() const { return functions_; }
+    // The references whose instructions were kept, at their new positions.
+    std::vector<Parser::SymbolReference> const &references() const { return references_; }
+    uint32_t removed_blocks() const { return removed_blocks_; }
+    uint32_t removed_instructions() const { return removed_instructions_; }
+    std::vector<std::string> const &removed_functions() const { return removed_functions_; }
+
+    void WriteReport(std::ostream &out) const;
+
+private:
+    std::vector<Parser::InstructionData> instructions_;
+    std::unordered_map<std::string, uint32_t> functions_;
+    std::vector<Parser::SymbolReference> references_;
+    uint32_t removed_blocks_ = 0;
+    uint32_t removed_instructions_ = 0;
+    std::vector<std::string> removed_functions_;
+};
+
+} // namespace mips
+
+#endif // DEAD_CODE_H_
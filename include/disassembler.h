@@ -0,0 +1,73 @@
+#ifndef DISASSEMBLER_H_
+#define DISASSEMBLER_H_
+
+#include <cstdint>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace mips {
+
+class InvalidImageException : public std::exception {
+public:
+    InvalidImageException(std::string const &file_path, std::string const &info);
+
+    const char *what() const noexcept {
+        return message_.c_str();
+    }
+
+private:
+    std::string message_;
+};
+
+// Turns an assembled program back into source that the Parser accepts and
+// that assembles to the same words.
+//
+// Words are decoded in batches: a first pass extracts a table index from
+// every word of the batch (the opcode, or 64 + funct for R-type words) in a
+// branch-free loop the compiler vectorizes, then operands are formatted from
+// the table entry. Branch and j targets inside the program get labels and
+// jal targets (plus the first instruction, named main) become functions
+// closed by .end; targets outside the program stay numeric.
+//
+// Formatting, not decoding, bounds the speed, so operands are written with
+// table lookups and fixed-size stores rather than through streams.
+class Disassembler {
+public:
+    // Throws InvalidInstructionException for words the assembler cannot produce.
+    explicit Disassembler(std::vector<uint32_t> code);
+
+    // Maps an image from disk. Images that start with printable text are read
+    // in the ParseImage format, with words before any "@" at the start of the
+    // code segment, and anything else as raw host-order words. Throws
+    // InvalidImageException unless the words fill the code segment from its
+    // start without gaps.
+    static std::vector<uint32_t> ReadImage(std::string const &file_path);
+
+    void Write(std::ostream &out) const;
+
+private:
+    static constexpr std::size_t BATCH_SIZE = 4096;
+    static constexpr uint32_t NO_TARGET = 0xffffffffu;
+
+    // Kinds of label at an instruction, kept as flags so no names are stored.
+    enum Label : uint8_t {
+        NO_LABEL = 0,
+        LABEL    = 1,
+        FUNCTION = 2
+    };
+
+    static void DecodeBatch(uint32_t const *words, std::size_t count, uint8_t *indices);
+    uint32_t TargetIndex(uint32_t index) const;
+    char *AppendName(char *out, uint32_t index) const;
+    char *AppendInstruction(char *out, uint32_t index) const;
+
+    std::vector<uint32_t> code_;
+    std::vector<uint8_t> indices_;
+    std::vector<uint8_t> labels_;
+};
+
+} // namespace mips
+
+#endif // DISASSEMBLER_H_
@@ -0,0 +1,98 @@
+#ifndef GUEST_MEMORY_H_
+#define GUEST_MEMORY_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+namespace mips {
+
+// Words of an image that follow one another from word_address.
+struct ImageSegment {
+    uint32_t word_address;
+    std::vector<uint32_t> words;
+};
+
+// Reads a $readmemh style image: hexadecimal words separated by whitespace,
+// "@<hex>" setting the word address (byte address / 4) of the next word and
+// "//" starting a comment. Words before the first "@" start at word_address.
+// Throws UnexpectedSymbolException for anything else.
+std::vector<ImageSegment> ParseImage(std::string_view text, uint32_t word_address = 0);
+
+// Sparse data memory covering the whole 32-bit address space. A two-level
+// page table (10 + 10 bits) maps 4 KiB pages that are allocated on the first
+// store from a pool of larger chunks; reads of untouched memory return zero
+// without allocating. The page used last is cached so consecutive accesses to
+// the same page skip the table walk.
+//
+// Addresses passed to Load and Store must be word aligned.
+class GuestMemory {
+public:
+    static constexpr uint32_t PAGE_BITS = 12;
+    static constexpr uint32_t PAGE_SIZE = 1u << PAGE_BITS;
+    static constexpr uint32_t PAGE_WORDS = PAGE_SIZE / 4;
+
+    GuestMemory();
+    GuestMemory(GuestMemory &&) noexcept;
+    GuestMemory &operator=(GuestMemory &&) noexcept;
+    ~GuestMemory();
+
+    uint32_t Load(uint32_t address) const {
+        if ((address >> PAGE_BITS) == cached_page_number_) {
+            return cached_page_[(address & (PAGE_SIZE - 1)) >> 2];
+        }
+        return LoadSlow(address);
+    }
+
+    void Store(uint32_t address, uint32_t value) {
+        if ((address >> PAGE_BITS) == cached_page_number_) {
+            cached_page_[(address & (PAGE_SIZE - 1)) >> 2] = value;
+            return;
+        }
+        StoreSlow(address, value);
+    }
+
+    // Allocated pages as (page number, contents), in address order.
+    std::vector<std::pair<uint32_t, uint32_t const *>> Pages() const;
+
+    // Takes ownership of a mapping of count consecutive pages and maps page i of it at page_numbers[i].
+    void AdoptMapping(void *mapping, std::size_t count, uint32_t const *page_numbers);
+
+    // Stores the words of an image in the ParseImage format.
+    void LoadImage(std::istream &in);
+
+    // Writes every allocated page that is not all zeros, in the LoadImage format.
+    void DumpImage(std::ostream &out) const;
+
+private:
+    static constexpr uint32_t TABLE_BITS = 10;
+    static constexpr uint32_t TABLE_SIZE = 1u << TABLE_BITS;
+    static constexpr uint32_t CHUNK_PAGES = 64;
+    static constexpr uint32_t NO_PAGE = 0xffffffffu;
+
+    struct Unmapper {
+        std::size_t size;
+        void operator()(void *mapping) const;
+    };
+
+    uint32_t LoadSlow(uint32_t address) const;
+    void StoreSlow(uint32_t address, uint32_t value);
+    uint32_t *FindPage(uint32_t page_number) const;
+    uint32_t *&PageEntry(uint32_t page_number);
+
+    std::array<std::unique_ptr<uint32_t *[]>, TABLE_SIZE> directory_;
+    std::vector<std::unique_ptr<uint32_t[]>> chunks_;
+    std::vector<std::unique_ptr<void, Unmapper>> mappings_;
+    uint32_t *next_free_page_ = nullptr;
+    uint32_t free_pages_ = 0;
+    mutable uint32_t cached_page_number_ = NO_PAGE;
+    mutable uint32_t *cached_page_ = nullptr;
+};
+
+} // namespace mips
+
+#endif // GUEST_MEMORY_H_
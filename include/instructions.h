@@ -4,6 +4,14 @@
 #include <cstdint>
 #include <string>
 
+#ifndef CODE_SEGMENT_OFFSET
+static constexpr uint32_t CODE_SEGMENT_OFFSET = 0x00400000;
+#endif
+
+#ifndef DATA_SEGMENT_OFFSET
+static constexpr uint32_t DATA_SEGMENT_OFFSET = 0x10010000;
+#endif
+
 namespace mips {
 
 class Instruction {
@@ -20,6 +28,17 @@ public:
         BNE   = 0x14000000, // 0001 01 00
         JAL   = 0x0c000000, // 0000 11 00
         J     = 0x08000000, // 0000 10 00
+        LUI   = 0x3c000000, // 0011 11 00
+    };
+
+    enum Funct {
+        FUNCT_JR  = 0x08,
+        FUNCT_SYSCALL = 0x0c,
+        FUNCT_ADD = 0x20,
+        FUNCT_SUB = 0x22,
+        FUNCT_AND = 0x24,
+        FUNCT_OR  = 0x25,
+        FUNCT_SLT = 0x2a,
     };
 
 	enum Register {
@@ -58,6 +77,19 @@ public:
 	};
 
     static Register RegisterNameToNumber(std::string const &name);
+    static char const *RegisterNumberToName(Register reg);
+
+    // Field extraction from an encoded instruction word.
+    static constexpr uint32_t OpcodeOf(uint32_t word) { return word & 0xfc000000u; }
+    static constexpr uint32_t RsOf(uint32_t word) { return (word >> 21u) & 0x1fu; }
+    static constexpr uint32_t RtOf(uint32_t word) { return (word >> 16u) & 0x1fu; }
+    static constexpr uint32_t RdOf(uint32_t word) { return (word >> 11u) & 0x1fu; }
+    static constexpr uint32_t FunctOf(uint32_t word) { return word & 0x3fu; }
+    static constexpr uint32_t Imm16Of(uint32_t word) { return word & 0xffffu; }
+    static constexpr uint32_t SignedImm16Of(uint32_t word) {
+        return static_cast<uint32_t>(static_cast<int32_t>(static_cast<int16_t>(word & 0xffffu)));
+    }
+    static constexpr uint32_t TargetOf(uint32_t word) { return word & 0x03ffffffu; }
 
 public:
     virtual uint32_t GetRepresentation() const = 0;
@@ -110,6 +142,11 @@ public:
     SLTIInstruction(Register rt, Register rs, uint16_t imm16);
 };
 
+class LUIInstruction : public ImmediateInstruction {
+public:
+    LUIInstruction(Register rt, uint16_t imm16);
+};
+
 class BEQInstruction : public ImmediateInstruction {
 public:
     BEQInstruction(Register rt, Register rs, uint16_t imm16);
@@ -201,6 +238,11 @@ public:
     JInstruction(uint32_t offset);
 };
 
+class SYSCALLInstruction : public RTYPEInstruction {
+public:
+    SYSCALLInstruction();
+};
+
 class JRInstruction : public RTYPEInstruction {
 public:
     JRInstruction(Register reg);
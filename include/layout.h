@@ -0,0 +1,86 @@
+#ifndef LAYOUT_H_
+#define LAYOUT_H_
+
+#include "parser.h"
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace mips {
+
+class InvalidProfileException : public std::exception {
+public:
+    InvalidProfileException(std::string const &line, uint32_t line_number);
+
+    const char *what() const noexcept {
+        return message_.c_str();
+    }
+
+private:
+    std::string message_;
+};
+
+// Reorders the basic blocks of the program by an execution count profile
+// so that hot paths fall through and hot code sits together.
+//
+// Edge counts are estimated from block counts: exact where a block has one
+// successor or a successor has one predecessor, the smaller of the two
+// counts otherwise. Within every function the hottest edges join blocks
+// into chains, Pettis-Hansen style; a jal stays followed by its return
+// point. Functions are then placed hottest first, the entry chain of each
+// first and its other executed chains by weight, followed by all blocks that
+// never ran. The block at the first instruction keeps its place, since
+// execution starts there.
+//
+// A beq or bne whose taken target ends up next is inverted to fall through
+// to it; a block whose fall-through successor moved away gets a j to it
+// (falling off the end of the program becomes a j past the new end), and a j
+// or unconditional beq to the block that now follows it is dropped. Branch
+// offsets, jump addresses and function entries are moved to the new
+// positions, and branches pushed out of range take the long form of the
+// Parser. Other code labels whose address is taken, by the data segment, la
+// or a lw or sw offset, are moved by passing them in functions, and the
+// instructions holding such an address are followed through references(),
+// so the Assembler can patch them once every pass has run.
+//
+// Code addresses are assumed to reach jr only through jal and functions.
+class LayoutOptimizer {
+public:
+    // Reads "address count" or "label count" lines, as Profiler::WriteCounts
+    // writes them, into counts per instruction of the parsed program; "#"
+    // starts a comment.
+    static std::vector<uint64_t> ReadProfile(std::istream &in, Parser const &parser);
+
+    // functions are those of the parser and any other labels whose address must follow the code;
+    // references are the la, lw and sw instructions holding such an address.
+    LayoutOptimizer(Parser const &parser, std::unordered_map<std::string, uint32_t> const &functions,
+                    std::vector<uint64_t> const &counts,
+                    std::vector<Parser::SymbolReference> const &references = {});
+
+    std::vector<Parser::InstructionData> const &instructions() const { return instructions_; }
+    std::unordered_map<std::string, uint32_t> const &functions() const { return functions_; }
+    // The references passed in, at the positions their instructions moved to.
+    std::vector<Parser::SymbolReference> const &references() const { return references_; }
+
+    // Estimated taken branches and jumps over the profiled run, before and after.
+    uint64_t taken_before() const { return taken_before_; }
+    uint64_t taken_after() const { return taken_after_; }
+
+    void WriteReport(std::ostream &out) const;
+
+private:
+    std::vector<Parser::InstructionData> instructions_;
+    std::unordered_map<std::string, uint32_t> functions_;
+    std::vector<Parser::SymbolReference> references_;
+    uint32_t blocks_ = 0;
+    uint32_t inverted_ = 0;
+    uint32_t jumps_added_ = 0;
+    uint32_t jumps_removed_ = 0;
+    uint64_t taken_before_ = 0;
+    uint64_t taken_after_ = 0;
+};
+
+} // namespace mips
+
+#endif // LAYOUT_H_
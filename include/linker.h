@@ -0,0 +1,60 @@
+#ifndef LINKER_H_
+#define LINKER_H_
+
+#include "instructions.h"
+#include "object_file.h"
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace mips {
+
+class LinkException : public std::exception {
+public:
+    explicit LinkException(std::string const &info);
+
+    const char *what() const noexcept {
+        return message_.c_str();
+    }
+
+private:
+    std::string message_;
+};
+
+// Combines relocatable object files into one program. Objects are placed
+// one after another in the order given, the first one at base, so the
+// first instruction of the first object is where execution starts.
+//
+// Objects are mapped and their functions entered into a shared open
+// addressing table in parallel, one object per task; words are then copied
+// and relocations applied in parallel, in chunks, since every relocation
+// patches a different word.
+class Linker {
+public:
+    // Throws LinkException for undefined or duplicate functions and jumps
+    // that cannot reach their target; threads = 0 uses every core.
+    explicit Linker(std::vector<std::string> const &object_paths, uint32_t base = CODE_SEGMENT_OFFSET,
+                    unsigned threads = 0);
+
+    std::vector<uint32_t> const &code() const { return code_; }
+    uint32_t base() const { return base_; }
+    std::size_t global_count() const { return global_count_; }
+    std::size_t relocation_count() const { return relocation_count_; }
+
+    // Writes one hexadecimal word per line, like Assembler::WriteToFile, or raw host-order words.
+    void WriteImage(std::string const &file_path, bool binary) const;
+
+private:
+    std::vector<std::unique_ptr<ObjectFile>> objects_;
+    std::vector<uint32_t> offsets_;
+    std::vector<uint32_t> code_;
+    uint32_t base_;
+    unsigned threads_;
+    std::size_t global_count_ = 0;
+    std::size_t relocation_count_ = 0;
+};
+
+} // namespace mips
+
+#endif // LINKER_H_
@@ -0,0 +1,73 @@
+#ifndef LOCKSTEP_SIMULATOR_H_
+#define LOCKSTEP_SIMULATOR_H_
+
+#include "simulator.h"
+#include <cstddef>
+
+namespace mips {
+
+#if defined(__AVX512F__)
+static constexpr std::size_t DEFAULT_LOCKSTEP_LANES = 16;
+#else
+static constexpr std::size_t DEFAULT_LOCKSTEP_LANES = 8;
+#endif
+
+// Per-lane data memory of the lockstep engine, which stays flat so it can be gathered from.
+static constexpr uint32_t DEFAULT_LOCKSTEP_MEMORY_SIZE = 0x10000;
+
+// Runs Lanes instances of one program in lockstep. Register files are stored
+// as struct-of-arrays (one row of Lanes values per register) so every
+// arithmetic instruction is a single vector operation over all instances.
+// Each lane keeps its own program counter; when branches diverge the lanes
+// sitting at the lowest program counter execute under a mask while the
+// others wait, which reconverges them at the join point of structured code.
+//
+// Data memory is interleaved by lane: word w of lane l lives at
+// memory_[w * Lanes + l], so loads and stores become gathers and scatters and
+// accesses to the same address in every lane (stack slots) are contiguous.
+//
+// The AVX-512/AVX2 paths are selected at compile time; without them the same
+// operations run as plain per-lane loops.
+template <std::size_t Lanes>
+class LockstepSimulator {
+    static_assert(Lanes == 8 || Lanes == 16, "Lockstep execution supports 8 or 16 lanes.");
+
+public:
+    explicit LockstepSimulator(std::vector<uint32_t> code,
+                               uint32_t memory_size = DEFAULT_LOCKSTEP_MEMORY_SIZE);
+
+    // Lanes at or above count are halted before execution starts.
+    void set_active_lanes(std::size_t count);
+
+    // Returns false once every lane has halted.
+    bool Step();
+
+    // Executes at most max_steps (masked) instructions and returns how many were executed.
+    uint64_t Run(uint64_t max_steps);
+
+    bool halted() const { return active_ == 0; }
+    bool halted(std::size_t lane) const { return !(active_ & (1u << lane)); }
+    uint32_t pc(std::size_t lane) const { return pc_[lane]; }
+    uint32_t reg(std::size_t lane, Instruction::Register reg) const { return registers_[reg][lane]; }
+    void set_reg(std::size_t lane, Instruction::Register reg, uint32_t value);
+    uint32_t memory(std::size_t lane, uint32_t address) const;
+
+private:
+    uint32_t NextMask(uint32_t *pc) const;
+    void ComputeIndices(uint32_t const *base, uint32_t offset, uint32_t mask, uint32_t *indices) const;
+
+    alignas(64) uint32_t registers_[32][Lanes] = {};
+    alignas(64) uint32_t pc_[Lanes];
+    std::vector<uint32_t> code_;
+    std::vector<uint32_t> memory_;
+    uint32_t memory_words_;
+    uint32_t code_end_;
+    uint32_t active_;
+};
+
+extern template class LockstepSimulator<8>;
+extern template class LockstepSimulator<16>;
+
+} // namespace mips
+
+#endif // LOCKSTEP_SIMULATOR_H_
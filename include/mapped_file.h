@@ -0,0 +1,37 @@
+#ifndef MAPPED_FILE_H_
+#define MAPPED_FILE_H_
+
+#include <cstddef>
+#include <string>
+
+namespace mips {
+
+// A whole file mapped read-only into memory and unmapped with the object;
+// the storage under the binary formats that are read in place, ObjectFile
+// and SourceMap. Moving keeps the mapping where it is, so pointers into it
+// stay valid in the object moved to.
+class MappedFile {
+public:
+    MappedFile() = default;
+    // Throws FileNotFoundException if the file cannot be opened. An empty
+    // file, or one that cannot be mapped, leaves data() null; size() is
+    // the size of the file either way.
+    explicit MappedFile(std::string const &file_path);
+    MappedFile(MappedFile &&other) noexcept;
+    MappedFile &operator=(MappedFile &&other) noexcept;
+    ~MappedFile();
+
+    MappedFile(MappedFile const &) = delete;
+    MappedFile &operator=(MappedFile const &) = delete;
+
+    void const *data() const { return data_; }
+    std::size_t size() const { return size_; }
+
+private:
+    void *data_ = nullptr;
+    std::size_t size_ = 0;
+};
+
+} // namespace mips
+
+#endif // MAPPED_FILE_H_
@@ -0,0 +1,93 @@
+#ifndef OBJECT_FILE_H_
+#define OBJECT_FILE_H_
+
+#include "mapped_file.h"
+#include "parser.h"
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace mips {
+
+class InvalidObjectException : public std::exception {
+public:
+    InvalidObjectException(std::string const &file_path, std::string const &info);
+
+    const char *what() const noexcept {
+        return message_.c_str();
+    }
+
+private:
+    std::string message_;
+};
+
+// A label of the object; value is the index of the instruction it names.
+// Functions are the only symbols other objects can refer to, and symbols
+// without DEFINED are references the linker resolves against them.
+struct ObjectSymbol {
+    enum Flags : uint32_t {
+        DEFINED = 1,
+        GLOBAL  = 2
+    };
+
+    uint32_t name;        // Offset into the string table.
+    uint32_t name_length;
+    uint32_t value;
+    uint32_t flags;
+};
+
+// Field of the word at offset to fill with the address of symbol. Types
+// are those of Parser::SymbolReference.
+struct ObjectRelocation {
+    uint32_t offset;
+    uint32_t type;
+    uint32_t symbol;
+    uint32_t reserved;
+};
+
+// Read-only view of a relocatable object file mapped into memory.
+//
+// The file holds a header followed by the encoded words, the symbols, the
+// relocations and the string table, all in host byte order. Words are
+// encoded for code starting at CODE_SEGMENT_OFFSET, but every field that
+// depends on where the code ends up carries a relocation, so the linker can
+// place the object anywhere. Branches stay within the object; a branch to
+// another object is assembled as the inverted branch over a j.
+class ObjectFile {
+public:
+    // Throws InvalidObjectException if the file is not a consistent object file.
+    explicit ObjectFile(std::string const &file_path);
+
+    // Writes the words of an assembled program with the symbols and references of its parser.
+    static void Write(std::string const &file_path, std::vector<uint32_t> const &code, Parser const &parser);
+
+    std::string const &file_path() const { return file_path_; }
+    uint32_t const *words() const { return words_; }
+    uint32_t word_count() const { return word_count_; }
+    ObjectSymbol const *symbols() const { return symbols_; }
+    uint32_t symbol_count() const { return symbol_count_; }
+    ObjectRelocation const *relocations() const { return relocations_; }
+    uint32_t relocation_count() const { return relocation_count_; }
+
+    std::string_view name(ObjectSymbol const &symbol) const {
+        return std::string_view(strings_ + symbol.name, symbol.name_length);
+    }
+
+private:
+    std::string file_path_;
+    MappedFile file_;
+    uint32_t const *words_ = nullptr;
+    ObjectSymbol const *symbols_ = nullptr;
+    ObjectRelocation const *relocations_ = nullptr;
+    char const *strings_ = nullptr;
+    uint32_t word_count_ = 0;
+    uint32_t symbol_count_ = 0;
+    uint32_t relocation_count_ = 0;
+};
+
+} // namespace mips
+
+#endif // OBJECT_FILE_H_
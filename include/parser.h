@@ -1,9 +1,12 @@
 #ifndef PARSER_H
 #define PARSER_H
 
+#include "data_segment.h"
+#include "preprocessor.h"
 #include <fstream>
 #include <vector>
 #include <unordered_map>
+#include <unordered_set>
 
 namespace mips {
 
@@ -14,6 +17,9 @@ public:
 
     const char *what() const noexcept;
 
+    // Names the file the line is in.
+    void AddFile(std::string const &file_path);
+
 private:
 	std::string message_;
 };
@@ -28,19 +34,85 @@ class Parser {
 public:
 	class InstructionData {
 	public:
-		explicit InstructionData(uint32_t opcode = {}, std::vector<std::string> &&tokens = {})
-			: opcode_(opcode), tokens_(tokens) {}
+		explicit InstructionData(uint32_t opcode = {}, std::vector<std::string> &&tokens = {},
+		                         uint32_t line_number = 0, uint32_t file = 0)
+			: opcode_(opcode), tokens_(tokens), line_number_(line_number), file_(file) {}
 
 		uint32_t opcode() const { return opcode_; }
 		std::vector<std::string> const &tokens() const { return tokens_; }
+		uint32_t line_number() const { return line_number_; }
+		// Index into Parser::files() of the file line_number is in.
+		uint32_t file() const { return file_; }
 	private:
+		friend class Parser;
+
 		uint32_t opcode_;
 		std::vector<std::string> tokens_;
+		uint32_t line_number_;
+		uint32_t file_;
 	};
 
-	explicit Parser(std::ifstream &file);
+	// A use of a label or function by j, jal or la, which the linker patches
+	// when the program is assembled into an object file, or by a .word or the
+	// offset of lw or sw, which passes that move code labels patch.
+	struct SymbolReference {
+		enum Kind : uint32_t {
+			JUMP  = 0, // target field of a j or jal
+			UPPER = 1, // immediate of the lui of an la
+			LOWER = 2, // immediate of the ori of an la
+			DATA  = 3, // count words of the data segment from byte offset instruction
+			ACCESS_UPPER = 4, // immediate of the lui $at of lw or sw with a label offset
+			ACCESS_LOWER = 5  // offset of that lw or sw
+		};
+
+		uint32_t instruction;
+		Kind kind;
+		std::string symbol;
+		uint64_t count = 1;
+	};
 
-	std::vector<InstructionData> const &instructions() { return instructions_; }
+	// Pseudo-instructions (move, li, la, b, blt, bgt, ble, bge) are expanded
+	// into real instructions here. A branch to a label that lies outside the
+	// 16-bit offset range is relaxed into the inverted branch skipping a j to
+	// the label; since that moves every later label, the file is laid out
+	// again until no branch changes form.
+	//
+	// When relocatable, symbols that are not defined in the file are left
+	// for the linker (as 0 in the encoded words) instead of being rejected,
+	// and branches to them always take the long form. j and jal must name a
+	// label there, since a numeric target would not move with the code.
+	//
+	// Lines after .data hold data directives instead of instructions, until
+	// .text:
+	//
+	//   .word v, ...   .half v, ...   .byte v, ...
+	//                  values aligned to their size; a value is a number, a
+	//                  character ('a'), a label, or v:n for n copies of v;
+	//                  only .word holds code labels, recorded as DATA references
+	//   .space n       n zero bytes
+	//   .align n       zero bytes up to a multiple of 2^n
+	//   .ascii "s"     the characters of s, with \n, \t, \0, \\ and \" escapes
+	//   .asciiz "s"    the same, followed by a zero byte
+	//
+	// A label in the data section names the address of the data after it,
+	// and may share the line of a directive, msg: .asciiz "hi".
+	// Such labels can be loaded with la and used as the offset of lw and sw,
+	// lw $t0, label($t1), which take a lui of the upper half into $at first.
+	//
+	// Lines are taken as the Preprocessor leaves them, with files naming
+	// the files they index; a stream is run through a Preprocessor first,
+	// with includes relative to the working directory.
+	Parser(std::vector<SourceLine> lines, bool relocatable = false, std::vector<std::string> files = {});
+	explicit Parser(std::istream &source, bool relocatable = false);
+
+	std::vector<InstructionData> const &instructions() const { return instructions_; }
+	std::unordered_map<std::string, uint32_t> const &functions() const { return functions_; }
+	std::unordered_map<std::string, std::pair<uint32_t, uint32_t>> const &labels() const { return labels_; }
+	std::vector<SymbolReference> const &references() const { return references_; }
+	std::unordered_map<std::string, uint32_t> const &data_labels() const { return data_labels_; }
+	DataSegment const &data() const { return data_; }
+	std::vector<std::string> const &files() const { return files_; }
+	std::size_t relaxed_branches() const { return long_statements_.size(); }
 
     void ParseImmediateInstruction();
 
@@ -50,20 +122,49 @@ private:
 	static bool IsInstruction(std::string const &value, uint32_t *opcode);
 	static bool IsRegister(std::string const &value);
 	static bool IsImmediateValue(std::string const &value);
-    void ProcessTokens(std::vector<std::string> &&tokens, uint32_t line_number, uint32_t instruction_number);
-	void CollectLabelsAndFunctions(std::ifstream &file);
-    void CollectInstructions(std::ifstream &file);
+    static bool IsLabel(std::vector<std::string> const &tokens);
+    static bool IsSection(std::vector<std::string> const &tokens);
+    static bool IsDataDirective(std::string const &value);
+    static bool HasLabelOffset(std::string const &operand);
+    bool SymbolAddress(std::string const &name, uint32_t *address) const;
+    static uint32_t ConstantSize(int64_t value);
+    uint32_t ExpansionSize(std::vector<std::string> const &tokens, uint32_t statement_number) const;
+    void ProcessTokens(std::vector<std::string> &&tokens, uint32_t line_number, uint32_t statement_number);
+    bool ExpandPseudoInstruction(std::vector<std::string> const &tokens, uint32_t line_number,
+                                 uint32_t statement_number);
+    uint32_t DataValue(std::string const &token, uint32_t line_number, bool resolve) const;
+    // The directive is tokens[first], after the label of the line if it has one.
+    void ProcessDataDirective(std::vector<std::string> const &tokens, std::size_t first, uint32_t line_number,
+                              bool resolve);
+    void PlaceDataLabels();
+    void LoadConstant(std::string const &reg, int64_t value, bool full_width, uint32_t line_number);
+	void CollectLabelsAndFunctions();
+    void CollectInstructions();
     void ParseRTypeInstruction(uint32_t opcode, std::vector<std::string> &&tokens, uint32_t line_number);
     void ParseImmediateInstruction(uint32_t opcode, std::vector<std::string> &&tokens, uint32_t line_number);
-    void ParseBranchInstruction(uint32_t opcode, std::vector<std::string> &&tokens, uint32_t line_number, uint32_t instruction_number);
+    void ParseUpperImmediateInstruction(uint32_t opcode, std::vector<std::string> &&tokens, uint32_t line_number);
+    void ParseBranchInstruction(uint32_t opcode, std::vector<std::string> &&tokens, uint32_t line_number, uint32_t statement_number);
     void ParseMemoryInstruction(uint32_t opcode, std::vector<std::string> &&tokens, uint32_t line_number);
     void ParseJumpInstruction(uint32_t opcode, std::vector<std::string> &&tokens, uint32_t line_number);
     void ParseJALInstruction(uint32_t opcode, std::vector<std::string> &&tokens, uint32_t line_number);
     void ParseJRInstruction(uint32_t opcode, std::vector<std::string> &&tokens, uint32_t line_number);
+    void ParseSyscallInstruction(uint32_t opcode, std::vector<std::string> &&tokens, uint32_t line_number);
+
+    void Parse();
 
+    std::vector<SourceLine> lines_;
+    std::vector<std::string> files_;
+    uint32_t current_file_ = 0;   // Of the line being parsed, for errors.
     std::vector<InstructionData> instructions_;
     std::unordered_map<std::string, std::pair<uint32_t, uint32_t>> labels_;
     std::unordered_map<std::string, uint32_t> functions_;
+    std::vector<SymbolReference> references_;
+    std::unordered_map<std::string, uint32_t> data_labels_;
+    std::vector<std::string> pending_data_labels_;
+    DataSegment data_;
+    std::unordered_set<uint32_t> long_statements_;
+    bool layout_changed_ = false;
+    bool relocatable_;
 };
 
 }
@@ -0,0 +1,71 @@
+#ifndef PEEPHOLE_H_
+#define PEEPHOLE_H_
+
+#include "parser.h"
+#include "scheduler.h"
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace mips {
+
+// Removes wasted instructions from a parsed program before it is encoded.
+//
+// Rules from a table are tried at every instruction over a window of the
+// instructions that are still alive, until a pass changes nothing. Removed
+// instructions are only marked during the passes so branch offsets and jump
+// addresses keep referring to the original positions; compacting at the end
+// maps every target to its new position (a removed target moves to the next
+// surviving instruction) and rewrites offsets, addresses and functions.
+// Windows longer than one instruction never extend over a branch target.
+// Instructions passed as references hold a code address that the caller
+// patches after all passes, so no rule touches them or a window across them;
+// references() gives their new positions. Neither does any rule remove
+// padding the PipelineModel needs: the slot after a branch or jump, or an
+// instruction separating a load or ALU result from a consumer that would
+// otherwise stall, such as hazard nops written in the source.
+class PeepholeOptimizer {
+public:
+    struct Slot {
+        Parser::InstructionData data;
+        bool removed = false;
+        bool target = false;
+        bool address = false;
+    };
+
+    struct Rule {
+        char const *name;
+        std::size_t window;
+        // Rewrites or removes instructions of the window; returns whether it applied.
+        bool (*apply)(Slot *const *window, std::vector<Slot> const &slots);
+    };
+
+    PeepholeOptimizer(std::vector<Parser::InstructionData> const &instructions,
+                      std::unordered_map<std::string, uint32_t> functions,
+                      PipelineModel const &model = PipelineModel(),
+                      std::vector<Parser::SymbolReference> references = {});
+
+    std::vector<Parser::InstructionData> const &instructions() const { return instructions_; }
+    std::unordered_map<std::string, uint32_t> const &functions() const { return functions_; }
+    std::vector<Parser::SymbolReference> const &references() const { return references_; }
+
+    // Instructions removed per rule, in rule table order.
+    std::vector<std::pair<char const *, uint32_t>> const &removed() const { return removed_; }
+
+    void WriteReport(std::ostream &out) const;
+
+private:
+    void Optimize(std::vector<Slot> &slots);
+    void Compact(std::vector<Slot> &slots);
+
+    std::vector<Parser::InstructionData> instructions_;
+    std::unordered_map<std::string, uint32_t> functions_;
+    std::vector<Parser::SymbolReference> references_;
+    PipelineModel model_;
+    std::vector<std::pair<char const *, uint32_t>> removed_;
+};
+
+} // namespace mips
+
+#endif // PEEPHOLE_H_
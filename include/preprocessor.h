@@ -0,0 +1,132 @@
+#ifndef PREPROCESSOR_H_
+#define PREPROCESSOR_H_
+
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace mips {
+
+// One non-empty line of source split into tokens, without its comment.
+struct SourceLine {
+    std::vector<std::string> tokens;
+    uint32_t line_number;
+    uint32_t file = 0;   // Index into Preprocessor::files().
+};
+
+// An annotation in a comment, "# @loop 10", by the line it is on.
+struct SourceAnnotation {
+    std::string text;   // From the '@' to the end of the line.
+    uint32_t line_number;
+    uint32_t file = 0;
+};
+
+// The tokenized lines of a file and the annotations in its comments.
+struct SourceFile {
+    std::vector<SourceLine> lines;
+    std::vector<SourceAnnotation> annotations;
+};
+
+// Tokenized source files by path. A file is lexed again only when its
+// modification time or size changed, so every file assembled by the same
+// process (a batch, or a daemon) shares the work of lexing common headers.
+// Safe to use from several threads.
+class IncludeCache {
+public:
+    using Lines = std::shared_ptr<SourceFile const>;
+
+    // Throws FileNotFoundException if the file cannot be read.
+    Lines Load(std::string const &file_path);
+
+    // The cache used by Assembler.
+    static IncludeCache &Shared();
+
+    uint64_t hits() const;
+    uint64_t misses() const;
+
+private:
+    struct Entry {
+        int64_t mtime_ns;
+        int64_t size;
+        Lines lines;
+    };
+
+    mutable std::mutex mutex_;
+    std::unordered_map<std::string, Entry> entries_;
+    uint64_t hits_ = 0;
+    uint64_t misses_ = 0;
+};
+
+// Expands the directives that only rearrange source text:
+//
+//   .include "file"           the lines of file, resolved relative to the
+//                             including file
+//   .macro name (%a, %b) ...  defines name; name(x, y) or name x, y then
+//   .endm                     stands for the body with %a and %b replaced.
+//                             Labels defined in the body get a suffix that
+//                             is unique per expansion.
+//   .eqv NAME value           replaces the token NAME, also negated (-NAME)
+//                             and as the offset of a memory operand, on the
+//                             lines that follow
+//
+// What is left are labels, .end lines and statements for the Parser. Lines
+// keep the file they were read from and their number in it; lines coming
+// from a macro carry the file and line that invoked it.
+class Preprocessor {
+public:
+    explicit Preprocessor(IncludeCache &cache = IncludeCache::Shared());
+
+    std::vector<SourceLine> Process(std::string const &file_path);
+
+    // Includes are resolved relative to directory.
+    std::vector<SourceLine> Process(std::istream &source, std::string const &directory = ".");
+
+    // The processed file first, then every file it included, by path.
+    std::vector<std::string> const &files() const { return files_; }
+    // Of every file, in the order of files().
+    std::vector<SourceAnnotation> const &annotations() const { return annotations_; }
+
+    // An annotation in the comment of line, if any, is stored in annotation.
+    static std::vector<std::string> Tokenize(std::string const &line, std::string *annotation = nullptr);
+    static SourceFile Tokenize(std::istream &source);
+
+private:
+    static constexpr uint32_t MAX_DEPTH = 64;
+
+    struct Macro {
+        std::vector<std::string> parameters;
+        std::vector<SourceLine> body;
+        std::vector<std::string> labels;
+    };
+
+    // Lines come from files_[file], and includes in them are resolved
+    // relative to directory. A line_number other than 0 replaces the
+    // numbers of the lines in the output.
+    void ProcessLines(std::vector<SourceLine> const &lines, uint32_t file, std::string const &directory,
+                      uint32_t line_number);
+    void ProcessFile(SourceFile const &source, std::string const &file_path, std::string const &directory);
+    void Include(std::string const &path, std::string const &directory, uint32_t line_number);
+    bool Expand(std::vector<std::string> const &tokens, uint32_t file, std::string const &directory,
+                uint32_t line_number);
+    uint32_t FileIndex(std::string const &file_path);
+    void Reset();
+    void Substitute(std::vector<std::string> &tokens) const;
+
+    IncludeCache &cache_;
+    std::unordered_map<std::string, Macro> macros_;
+    std::unordered_map<std::string, std::string> constants_;
+    std::vector<std::string> include_stack_;
+    std::vector<std::string> files_;
+    std::vector<SourceAnnotation> annotations_;
+    std::vector<SourceLine> output_;
+    uint32_t depth_ = 0;
+    uint32_t expansions_ = 0;
+};
+
+} // namespace mips
+
+#endif // PREPROCESSOR_H_
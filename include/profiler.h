@@ -0,0 +1,66 @@
+#ifndef PROFILER_H_
+#define PROFILER_H_
+
+#include "parser.h"
+#include "simulator.h"
+#include <iostream>
+#include <string>
+#include <unordered_map>
+
+namespace mips {
+
+// Runs a program on the Simulator while counting executions per instruction
+// address. Calls are recognized by jal and returns by jr $ra, which drives a
+// calling context tree (one node per distinct call stack) so every executed
+// instruction is attributed to the stack it ran under. Counter updates are a
+// couple of array increments per instruction; only calls touch a hash table.
+class Profiler {
+public:
+    Profiler(std::vector<uint32_t> code, std::unordered_map<std::string, uint32_t> const &functions);
+
+    // Executes at most max_steps instructions and returns how many were executed.
+    uint64_t Run(uint64_t max_steps);
+
+    Simulator &simulator() { return simulator_; }
+    Simulator const &simulator() const { return simulator_; }
+    std::vector<uint64_t> const &counts() const { return counts_; }
+
+    // One "caller;callee;... samples" line per call stack, for flame graph tools.
+    void WriteFoldedStacks(std::ostream &out) const;
+
+    // One "address count" line per executed instruction, the profile read by LayoutOptimizer.
+    void WriteCounts(std::ostream &out) const;
+
+    // Self and inclusive instruction counts per function followed by call edges.
+    void WriteCallGraph(std::ostream &out) const;
+
+    // Prefixes every line of the source files, as Parser::files() names
+    // them, with the executions of the instructions on it. Each file after
+    // the first follows a line naming it.
+    void WriteAnnotatedSource(std::vector<std::string> const &files,
+                              std::vector<Parser::InstructionData> const &instructions, std::ostream &out) const;
+
+private:
+    struct Node {
+        uint32_t parent;
+        uint32_t function;
+        uint64_t samples;
+    };
+
+    uint32_t FunctionAt(uint32_t address) const;
+    void EnterFunction(uint32_t address);
+    void ReturnFromFunction();
+
+    Simulator simulator_;
+    std::vector<uint32_t> code_;
+    std::vector<uint64_t> counts_;
+    std::vector<std::pair<uint32_t, std::string>> functions_;
+    std::vector<Node> nodes_;
+    std::unordered_map<uint64_t, uint32_t> children_;
+    std::unordered_map<uint64_t, uint64_t> calls_;
+    uint32_t current_;
+};
+
+} // namespace mips
+
+#endif // PROFILER_H_
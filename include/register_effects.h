@@ -0,0 +1,59 @@
+#ifndef REGISTER_EFFECTS_H_
+#define REGISTER_EFFECTS_H_
+
+#include "instructions.h"
+#include "parser.h"
+#include <array>
+#include <cstdint>
+#include <string>
+
+namespace mips {
+
+// The registers one instruction reads and the one it writes, and how it
+// leaves its block; the model of an instruction shared by the Scheduler and
+// the TimingAnalyzer. $zero is never recorded. A syscall reads $v0 and the
+// argument registers the SpimSyscalls handler uses, $a0 and $a1.
+struct RegisterEffects {
+    enum Kind : uint8_t {
+        ALU,
+        LOAD,
+        STORE,
+        BRANCH,
+        JUMP,
+        CALL,
+        JUMP_REGISTER,
+        SYSCALL
+    };
+
+    // Consumers that read their operands in ID (beq, bne, jr) see longer latencies.
+    enum ReadClass : uint8_t {
+        EXECUTE = 0,
+        DECODE  = 1
+    };
+
+    static constexpr uint8_t NO_REGISTER = 0xff;
+
+    static RegisterEffects Of(Parser::InstructionData const &data);
+
+    Kind kind;
+    uint8_t reads[3];
+    uint8_t read_count = 0;
+    uint8_t write = NO_REGISTER;
+
+    bool terminator() const { return kind >= BRANCH; }
+    bool has_delay_slot() const { return kind >= BRANCH && kind != SYSCALL; }
+    ReadClass read_class() const { return kind == BRANCH || kind == JUMP_REGISTER ? DECODE : EXECUTE; }
+
+private:
+    void Read(std::string const &name);
+    void Read(Instruction::Register reg) { reads[read_count++] = static_cast<uint8_t>(reg); }
+    void Write(std::string const &name);
+};
+
+// Earliest cycle or position, relative to the start of a block, from which
+// each register can be read by a consumer of each ReadClass.
+using RegisterResidue = std::array<std::array<int64_t, 2>, 32>;
+
+} // namespace mips
+
+#endif // REGISTER_EFFECTS_H_
@@ -0,0 +1,91 @@
+#ifndef SCHEDULER_H_
+#define SCHEDULER_H_
+
+#include "parser.h"
+#include "register_effects.h"
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace mips {
+
+class InvalidPipelineModelException : public std::exception {
+public:
+    explicit InvalidPipelineModelException(std::string const &spec);
+
+    const char *what() const noexcept {
+        return message_.c_str();
+    }
+
+private:
+    std::string message_;
+};
+
+// Hazards of the target pipeline, as the number of instructions that must
+// separate a producer from a consumer of its result. The defaults describe a
+// five stage pipeline with forwarding into EX and branches resolved in ID.
+struct PipelineModel {
+    uint32_t load_use = 1;     // lw -> ALU, memory or store-data use.
+    uint32_t alu = 0;          // ALU -> ALU, memory or store-data use.
+    uint32_t branch_alu = 1;   // ALU -> beq, bne or jr operand.
+    uint32_t branch_load = 2;  // lw -> beq, bne or jr operand.
+    bool delay_slots = false;  // The instruction after a branch or jump always executes.
+
+    // Instructions that must separate a producer of the kind from a consumer reading its result in the class.
+    uint32_t Latency(RegisterEffects::Kind producer, RegisterEffects::ReadClass consumer) const {
+        if (producer == RegisterEffects::LOAD) {
+            return consumer == RegisterEffects::DECODE ? branch_load : load_use;
+        }
+        return consumer == RegisterEffects::DECODE ? branch_alu : alu;
+    }
+
+    // Parses comma separated key=value pairs: load, alu, branch-alu,
+    // branch-load and delay-slots (0 or 1), e.g. "load=1,branch-alu=0".
+    static PipelineModel Parse(std::string const &spec);
+};
+
+// Reorders the instructions of every basic block to hide the latencies of
+// a PipelineModel and pads with nops (add $zero, $zero, $zero) only where a
+// hazard remains.
+//
+// Blocks are those of the ControlFlowGraph; the branch, jump, call or
+// syscall ending a block stays last in it. Within a block a dependence graph is built from the
+// registers each instruction reads and writes (RAW edges carry the latency,
+// WAR and WAW edges only order) with loads and stores kept in order against
+// stores, and a list scheduler issues the ready instruction with the longest
+// latency path to the end of the block first. Latencies still pending when a
+// block ends are carried into its successors, iterating until they settle.
+//
+// With delay slots enabled, the slot after every branch or jump is filled
+// with an instruction of the same block that nothing else depends on, or a
+// nop when there is none.
+//
+// references are instructions holding a code address for the caller to
+// patch, and references() the positions the schedule gave them.
+class Scheduler {
+public:
+    Scheduler(std::vector<Parser::InstructionData> const &instructions,
+              std::unordered_map<std::string, uint32_t> functions, PipelineModel const &model,
+              std::vector<Parser::SymbolReference> references = {});
+
+    std::vector<Parser::InstructionData> const &instructions() const { return instructions_; }
+    std::unordered_map<std::string, uint32_t> const &functions() const { return functions_; }
+    std::vector<Parser::SymbolReference> const &references() const { return references_; }
+    uint32_t nops_inserted() const { return nops_inserted_; }
+    uint32_t delay_slots_filled() const { return delay_slots_filled_; }
+
+    void WriteReport(std::ostream &out) const;
+
+private:
+    std::vector<Parser::InstructionData> instructions_;
+    std::unordered_map<std::string, uint32_t> functions_;
+    std::vector<Parser::SymbolReference> references_;
+    uint32_t blocks_ = 0;
+    uint32_t nops_inserted_ = 0;
+    uint32_t delay_slots_filled_ = 0;
+};
+
+} // namespace mips
+
+#endif // SCHEDULER_H_
@@ -0,0 +1,115 @@
+#ifndef SIMULATOR_H_
+#define SIMULATOR_H_
+
+#include "guest_memory.h"
+#include "instructions.h"
+#include <stdexcept>
+#include <vector>
+
+namespace mips {
+
+class Simulator;
+
+// Services the syscall instruction. The service number is in $v0 and the
+// arguments in $a0/$a1; results are written back through the Simulator.
+class SyscallHandler {
+public:
+    virtual ~SyscallHandler() = default;
+    virtual void Handle(Simulator &simulator) = 0;
+};
+
+class MemoryAccessException : public std::exception {
+public:
+    MemoryAccessException(uint32_t address, uint32_t pc);
+
+    const char *what() const noexcept {
+        return message_.c_str();
+    }
+
+private:
+    std::string message_;
+};
+
+class InvalidInstructionException : public std::exception {
+public:
+    InvalidInstructionException(uint32_t word, uint32_t pc);
+
+    const char *what() const noexcept {
+        return message_.c_str();
+    }
+
+private:
+    std::string message_;
+};
+
+class InvalidSnapshotException : public std::exception {
+public:
+    InvalidSnapshotException(std::string const &file_path, std::string const &info);
+
+    const char *what() const noexcept {
+        return message_.c_str();
+    }
+
+private:
+    std::string message_;
+};
+
+// Executes an assembled program one instruction at a time. Code is fetched
+// from CODE_SEGMENT_OFFSET, data memory is a sparse GuestMemory spanning the
+// 32-bit address space and $sp starts at STACK_TOP. The program halts once the
+// program counter leaves the code segment or it exits through a syscall.
+// Executing syscall without a SyscallHandler installed is an invalid instruction.
+class Simulator {
+public:
+    static constexpr uint32_t STACK_TOP = 0x7fffeffc;
+
+    explicit Simulator(std::vector<uint32_t> code);
+
+    // Restores the state saved by SaveSnapshot. Memory pages are mapped from
+    // the file copy-on-write, so restoring does not copy them and any number
+    // of simulators can be forked from one snapshot.
+    static Simulator FromSnapshot(std::vector<uint32_t> code, std::string const &file_path);
+
+    // Writes PC, registers and every allocated page that is not all zeros.
+    // Pages are stored page aligned after a directory of their page numbers.
+    void SaveSnapshot(std::string const &file_path) const;
+
+    // Returns false if the program has already halted.
+    bool Step();
+
+    // Executes at most max_steps instructions and returns how many were executed.
+    uint64_t Run(uint64_t max_steps);
+
+    bool halted() const { return exited_ || pc_ - CODE_SEGMENT_OFFSET >= code_end_; }
+    bool exited() const { return exited_; }
+    uint32_t exit_code() const { return exit_code_; }
+    uint32_t pc() const { return pc_; }
+    uint32_t reg(Instruction::Register reg) const { return registers_[reg]; }
+    void set_reg(Instruction::Register reg, uint32_t value);
+
+    uint32_t Load(uint32_t address) const;
+    void Store(uint32_t address, uint32_t value);
+
+    // The handler is not owned and must outlive the simulator's execution.
+    void set_syscall_handler(SyscallHandler *handler) { syscall_handler_ = handler; }
+
+    // Halts the program; called by syscall handlers.
+    void Exit(uint32_t code);
+
+    GuestMemory &memory() { return memory_; }
+    GuestMemory const &memory() const { return memory_; }
+
+private:
+    std::vector<uint32_t> code_;
+    GuestMemory memory_;
+    uint32_t registers_[32] = {};
+    uint32_t pc_;
+    uint32_t code_end_;
+    SyscallHandler *syscall_handler_ = nullptr;
+    bool exited_ = false;
+    uint32_t exit_code_ = 0;
+};
+
+} // namespace mips
+
+#endif // SIMULATOR_H_
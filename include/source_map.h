@@ -0,0 +1,119 @@
+#ifndef SOURCE_MAP_H_
+#define SOURCE_MAP_H_
+
+#include "mapped_file.h"
+#include "parser.h"
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace mips {
+
+class InvalidSourceMapException : public std::exception {
+public:
+    InvalidSourceMapException(std::string const &file_path, std::string const &info);
+
+    const char *what() const noexcept {
+        return message_.c_str();
+    }
+
+private:
+    std::string message_;
+};
+
+// The instructions from address up to the next entry come from line of file.
+struct SourceMapLine {
+    uint32_t address;
+    uint32_t line;
+    uint32_t file;   // Index into the file table.
+};
+
+// The path of a source file.
+struct SourceMapFile {
+    uint32_t name;        // Offset into the string table.
+    uint32_t name_length;
+};
+
+// A label naming the instruction at address.
+struct SourceMapSymbol {
+    uint32_t address;
+    uint32_t name;        // Offset into the string table.
+    uint32_t name_length;
+    uint32_t reserved;
+};
+
+struct SourceLocation {
+    std::string_view file;
+    uint32_t line;
+    std::string_view symbol;   // Empty before the first label.
+    uint32_t offset;           // Bytes past symbol, or past the start of the code without one.
+};
+
+// Read-only view of an address to source index mapped into memory, for
+// symbolizing the pc values of traces and waveforms.
+//
+// The file holds a header followed by the line entries and the symbols,
+// both sorted by address, the source files and the string table, all in
+// host byte order. Consecutive instructions of the same line of a file
+// share one entry, and a lookup is a binary search in each table.
+class SourceMap {
+public:
+    using Label = std::pair<uint32_t, std::string>;   // Instruction index, name.
+
+    // Throws InvalidSourceMapException if the file is not a consistent index.
+    explicit SourceMap(std::string const &file_path);
+
+    // Writes the index of an assembled program; labels sorted by instruction,
+    // files as Parser::files() names them. Of several labels of one
+    // instruction the index keeps a function, else the first.
+    static void Write(std::string const &file_path, std::vector<Parser::InstructionData> const &instructions,
+                      std::vector<Label> const &labels, std::unordered_map<std::string, uint32_t> const &functions,
+                      std::vector<std::string> const &files);
+
+    // One row per instruction: address, encoded word, line, the instruction
+    // as assembled and the source line it came from, after the labels naming
+    // it. A comment names the file whenever the rows move to another one.
+    static void WriteListing(std::ostream &out, std::vector<Parser::InstructionData> const &instructions,
+                             std::vector<uint32_t> const &code, std::vector<Label> const &labels,
+                             std::vector<std::string> const &files);
+
+    // Returns false for an address outside the code.
+    bool Lookup(uint32_t address, SourceLocation *location) const;
+
+    std::string const &file_path() const { return file_path_; }
+    uint32_t end() const { return end_; }
+    SourceMapLine const *lines() const { return lines_; }
+    uint32_t line_count() const { return line_count_; }
+    SourceMapSymbol const *symbols() const { return symbols_; }
+    uint32_t symbol_count() const { return symbol_count_; }
+    SourceMapFile const *files() const { return files_; }
+    uint32_t file_count() const { return file_count_; }
+
+    std::string_view name(SourceMapSymbol const &symbol) const {
+        return std::string_view(strings_ + symbol.name, symbol.name_length);
+    }
+
+    std::string_view name(SourceMapFile const &file) const {
+        return std::string_view(strings_ + file.name, file.name_length);
+    }
+
+private:
+    std::string file_path_;
+    MappedFile file_;
+    SourceMapLine const *lines_ = nullptr;
+    SourceMapSymbol const *symbols_ = nullptr;
+    SourceMapFile const *files_ = nullptr;
+    char const *strings_ = nullptr;
+    uint32_t end_ = 0;   // Address past the last instruction.
+    uint32_t line_count_ = 0;
+    uint32_t symbol_count_ = 0;
+    uint32_t file_count_ = 0;
+};
+
+} // namespace mips
+
+#endif // SOURCE_MAP_H_
@@ -0,0 +1,77 @@
+#ifndef SYSCALLS_H_
+#define SYSCALLS_H_
+
+#include "simulator.h"
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace mips {
+
+class UnsupportedSyscallException : public std::exception {
+public:
+    UnsupportedSyscallException(uint32_t service, uint32_t pc);
+
+    const char *what() const noexcept {
+        return message_.c_str();
+    }
+
+private:
+    std::string message_;
+};
+
+// The SPIM syscall services: print_int (1), print_string (4), read_int (5),
+// sbrk (9), exit (10), print_char (11), read_char (12) and exit2 (17).
+//
+// Program output goes to a large buffer that is written to the host in one
+// call when it fills up, before input is read and when the handler is flushed
+// or destroyed, so printing in a loop does not cost a host call per syscall.
+// Input is read into a buffer too, but each refill takes whatever the host
+// has ready, so a program reading a terminal or a pipe sees every line as it
+// arrives rather than once a whole buffer is full.
+//
+// Handlers of simulators running at the same time on the same host streams
+// must share a host_lock. Each host write is then a whole buffer and each
+// refill goes to one handler; which handler gets which input is unspecified.
+class SpimSyscalls : public SyscallHandler {
+public:
+    // sbrk hands out memory upwards from here, like SPIM's heap.
+    static constexpr uint32_t HEAP_START = 0x10040000;
+
+    static constexpr std::size_t OUTPUT_BUFFER_SIZE = 1 << 20;
+    static constexpr std::size_t INPUT_BUFFER_SIZE = 1 << 16;
+
+    explicit SpimSyscalls(std::FILE *out = stdout, std::FILE *in = stdin, std::mutex *host_lock = nullptr);
+    ~SpimSyscalls() override;
+
+    SpimSyscalls(SpimSyscalls const &) = delete;
+    SpimSyscalls &operator=(SpimSyscalls const &) = delete;
+
+    void Handle(Simulator &simulator) override;
+
+    // Writes the buffered output to the host.
+    void Flush();
+
+private:
+    std::unique_lock<std::mutex> LockHost();
+    void Write(char const *data, std::size_t size);
+    void WriteString(Simulator const &simulator, uint32_t address);
+    int ReadChar();
+    int PeekChar();
+    uint32_t ReadInt();
+
+    std::FILE *out_;
+    std::FILE *in_;
+    std::mutex *host_lock_;
+    std::unique_ptr<char[]> output_;
+    std::size_t output_size_ = 0;
+    std::unique_ptr<char[]> input_;
+    std::size_t input_position_ = 0;
+    std::size_t input_size_ = 0;
+    uint32_t heap_break_ = HEAP_START;
+};
+
+} // namespace mips
+
+#endif // SYSCALLS_H_
@@ -0,0 +1,106 @@
+#ifndef TIMING_H_
+#define TIMING_H_
+
+#include "cfg.h"
+#include "scheduler.h"
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace mips {
+
+class InvalidCostModelException : public std::exception {
+public:
+    explicit InvalidCostModelException(std::string const &spec);
+
+    const char *what() const noexcept {
+        return message_.c_str();
+    }
+
+private:
+    std::string message_;
+};
+
+// Cycles each kind of instruction takes to issue, and the bubble behind a
+// taken branch or a jump. Hazard stalls come from a PipelineModel.
+struct CostModel {
+    uint32_t alu = 1;
+    uint32_t load = 1;
+    uint32_t store = 1;
+    uint32_t branch = 1;   // beq, bne
+    uint32_t jump = 1;     // j, jal, jr
+    uint32_t syscall = 1;
+    uint32_t taken = 1;    // Added to every taken branch and every jump.
+
+    // Parses comma separated key=value pairs named as above, e.g. "load=2,taken=0".
+    static CostModel Parse(std::string const &spec);
+};
+
+// Bounds the cycles of one call of every function without running it.
+//
+// Blocks are timed by issuing their instructions in order under the
+// CostModel, stalling for the PipelineModel latencies; a stall caused by a
+// predecessor's last instructions is charged to the edge between them,
+// along with the taken-branch penalty. Loops are the natural loops of the
+// ControlFlowGraph and need a bound in a comment of the file they are in,
+//
+//   # @loop 10       the header runs at most 10 times per entry to the loop
+//   # @loop 2..10    and at least 2 times
+//
+// on the loop's branch back to the header, or on a line from the one after
+// the instruction before the header up to the header's first instruction
+// (its label). Innermost loops are collapsed first, each into one node
+// costing (n - 1) trips around the loop plus the path out of it; what is
+// left is acyclic and the longest and shortest path from the entry to a
+// return give the worst and best case. A jal costs its callee's bounds, so
+// recursion, a loop without a bound or a cycle that is not a natural loop
+// leave the function, and its callers, unbounded.
+class TimingAnalyzer {
+public:
+    struct FunctionTiming {
+        std::string name;
+        bool bounded = true;
+        std::string reason;   // Why it is not bounded.
+        uint64_t best = 0;
+        uint64_t worst = 0;
+    };
+
+    // The loop bounds are the @loop annotations, as the Preprocessor collects them.
+    TimingAnalyzer(std::vector<Parser::InstructionData> const &instructions,
+                   std::unordered_map<std::string, uint32_t> const &functions,
+                   std::vector<SourceAnnotation> const &annotations,
+                   CostModel const &cost = CostModel(), PipelineModel const &pipeline = PipelineModel());
+
+    // In the order of ControlFlowGraph::functions().
+    std::vector<FunctionTiming> const &functions() const { return timings_; }
+
+    // Bounds per function, then every call path from the functions nobody
+    // calls with the most calls per run of the first function in the path.
+    void WriteReport(std::ostream &out) const;
+
+private:
+    struct CallSite {
+        std::size_t callee;
+        uint64_t count;   // Most executions per call of the caller.
+    };
+
+    void AnalyzeFunction(std::size_t function);
+
+    std::vector<Parser::InstructionData> const &instructions_;
+    ControlFlowGraph cfg_;
+    CostModel cost_;
+    PipelineModel pipeline_;
+    // File in the upper half and line in the lower -> (min, max) trips.
+    std::unordered_map<uint64_t, std::pair<uint64_t, uint64_t>> bounds_;
+    std::vector<uint64_t> block_cycles_;
+    std::vector<std::vector<uint64_t>> edge_cycles_;   // Per block, parallel to its successors.
+    std::vector<FunctionTiming> timings_;
+    std::vector<std::vector<CallSite>> calls_;
+    std::vector<uint8_t> state_;   // Per function: 0 not analyzed, 1 in progress, 2 done.
+};
+
+} // namespace mips
+
+#endif // TIMING_H_
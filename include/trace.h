@@ -0,0 +1,136 @@
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include "simulator.h"
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+#include <thread>
+
+namespace mips {
+
+// One executed instruction: where it ran, what it was and its side effects.
+struct TraceRecord {
+    uint64_t index = 0;
+    uint32_t pc = 0;
+    uint32_t word = 0;
+    bool register_write = false;
+    uint8_t reg = 0;
+    uint32_t reg_value = 0;
+    bool load = false;
+    bool store = false;
+    uint32_t address = 0;
+    uint32_t memory_value = 0;
+};
+
+// Trace file layout (all integers little-endian):
+//
+//   header  "MIPSTRC1", uint32 version, uint32 reserved
+//   blocks  uint32 raw size, uint32 stored size, uint64 first instruction,
+//           uint32 record count, then the LZ-compressed records (stored raw
+//           when compression does not help)
+//   index   uint64 first instruction, uint64 file offset per block
+//   footer  uint64 index offset, uint64 instruction count, "MIPSIDX1"
+//
+// A record is a flags byte, the encoded word (omitted when it repeats the
+// last word recorded at the same PC) and varint fields: the PC as a zigzag
+// delta from the sequential PC (only when it is not sequential), the written
+// register with a zigzag delta from its previous value, and the memory
+// address as a zigzag delta from the previous access followed by the value.
+// Delta state restarts at every block so blocks decode independently.
+class TraceWriter {
+public:
+    explicit TraceWriter(std::string const &file_path);
+    ~TraceWriter();
+
+    void Append(TraceRecord const &record);
+
+    // Flushes the last block, writes the index and waits for the background writer.
+    void Close();
+
+private:
+    struct Block {
+        std::vector<uint8_t> data;
+        std::size_t size = 0;
+        uint64_t first_instruction = 0;
+        uint32_t records = 0;
+    };
+
+    void ResetDeltaState();
+    void SubmitBlock();
+    void WriteBlocks();
+
+    std::ofstream file_;
+    // Records are encoded into blocks_[active_] while the background thread
+    // compresses and writes the other one.
+    Block blocks_[2];
+    int active_ = 0;
+    bool pending_ = false;
+    bool closing_ = false;
+    bool closed_ = false;
+    std::mutex mutex_;
+    std::condition_variable condition_;
+    std::thread thread_;
+
+    std::vector<std::pair<uint64_t, uint64_t>> index_;
+    uint64_t offset_ = 0;
+    uint64_t instructions_ = 0;
+    uint32_t previous_pc_;
+    uint32_t previous_address_;
+    uint32_t registers_[32];
+    std::pair<uint32_t, uint32_t> word_cache_[256];
+};
+
+class TraceReader {
+public:
+    explicit TraceReader(std::string const &file_path);
+
+    uint64_t size() const { return instructions_; }
+
+    // Positions the reader so that the next record returned has the given index.
+    void Seek(uint64_t instruction);
+
+    // Returns false at the end of the trace.
+    bool Next(TraceRecord *record);
+
+private:
+    void ScanBlocks();
+    bool LoadBlock(std::size_t block);
+
+    std::ifstream file_;
+    std::vector<std::pair<uint64_t, uint64_t>> index_;
+    uint64_t instructions_ = 0;
+    std::size_t block_ = 0;
+    std::vector<uint8_t> data_;
+    std::size_t position_ = 0;
+    uint64_t next_index_ = 0;
+    uint32_t previous_pc_;
+    uint32_t previous_address_;
+    uint32_t registers_[32];
+    std::pair<uint32_t, uint32_t> word_cache_[256];
+};
+
+// Runs a program on the Simulator and streams every executed instruction to a trace file.
+class Tracer {
+public:
+    Tracer(std::vector<uint32_t> code, std::string const &file_path);
+
+    // Executes at most max_steps instructions and returns how many were executed.
+    uint64_t Run(uint64_t max_steps);
+
+    // Completes the trace file; called by the destructor otherwise.
+    void Close();
+
+    Simulator &simulator() { return simulator_; }
+    Simulator const &simulator() const { return simulator_; }
+
+private:
+    Simulator simulator_;
+    std::vector<uint32_t> code_;
+    TraceWriter writer_;
+    uint64_t executed_ = 0;
+};
+
+} // namespace mips
+
+#endif // TRACE_H_
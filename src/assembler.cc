@@ -1,22 +1,110 @@
 #include "algorithms.h"
 #include "assembler.h"
+#include "object_file.h"
+#include "source_map.h"
 
 namespace mips {
 
-Assembler::Assembler(std::string const &file_path)
+namespace {
+
+// tokens with address in the field a la, lw or sw reference fills.
+std::vector<std::string> EncodeAddress(std::vector<std::string> tokens, Parser::SymbolReference::Kind kind,
+                                       uint32_t address) {
+    switch (kind) {
+    case Parser::SymbolReference::UPPER:
+        tokens[2] = std::to_string(address >> 16u);
+        break;
+    case Parser::SymbolReference::LOWER:
+        tokens[3] = std::to_string(address & 0xffffu);
+        break;
+    case Parser::SymbolReference::ACCESS_UPPER:
+        tokens[2] = std::to_string(((address + 0x8000u) >> 16u) & 0xffffu);
+        break;
+    default:
+        tokens[2] = std::to_string(static_cast<int16_t>(address & 0xffffu));
+        break;
+    }
+    return tokens;
+}
+
+} // namespace
+
+Assembler::Assembler(std::string const &file_path, AssemblerOptions const &options)
         : file_path_(file_path) {
-    std::ifstream file(file_path_);
-    if (file.is_open()) {
-        parser_ = std::make_unique<Parser>(file);
-        auto const &data = parser_->instructions();
-        std::transform(std::begin(data), std::end(data), std::back_inserter(instructions_),
-                       [](auto &&instructionData) {
-            return InstructionFactory::CreateInstruction(instructionData);
-        });
-        file.close();
-    } else {
-        throw FileNotFoundException(file_path);
+    Preprocessor preprocessor;
+    std::vector<SourceLine> lines = preprocessor.Process(file_path_);
+    parser_ = std::make_unique<Parser>(std::move(lines), options.relocatable, preprocessor.files());
+    annotations_ = preprocessor.annotations();
+    program_ = parser_->instructions();
+    functions_ = parser_->functions();
+    data_ = parser_->data();
+    // Code labels whose address is taken, by a .word, la or a lw or sw
+    // offset, move with the code: the passes carry them like functions and
+    // keep them reachable, and the data and the instructions holding their
+    // address are patched from where they end up.
+    std::unordered_set<std::string> taken;
+    std::unordered_set<std::string> added;
+    std::vector<Parser::SymbolReference> addresses;
+    for (auto const &reference : parser_->references()) {
+        auto const label = parser_->labels().find(reference.symbol);
+        if (reference.kind == Parser::SymbolReference::JUMP || label == parser_->labels().end()
+            || parser_->data_labels().count(reference.symbol) != 0) {
+            continue;
+        }
+        taken.insert(reference.symbol);
+        if (functions_.emplace(reference.symbol, label->second.second).second) {
+            added.insert(reference.symbol);
+        }
+        if (reference.kind != Parser::SymbolReference::DATA) {
+            addresses.push_back(reference);
+        }
+    }
+    if (!options.profile.empty()) {
+        std::ifstream profile(options.profile);
+        if (!profile.is_open()) {
+            throw FileNotFoundException(options.profile);
+        }
+        layout_ = std::make_unique<LayoutOptimizer>(*parser_, functions_,
+                                                    LayoutOptimizer::ReadProfile(profile, *parser_), addresses);
+        program_ = layout_->instructions();
+        functions_ = layout_->functions();
+        addresses = layout_->references();
+    }
+    if (options.optimize) {
+        eliminator_ = std::make_unique<DeadCodeEliminator>(program_, functions_, taken, addresses);
+        program_ = eliminator_->instructions();
+        functions_ = eliminator_->functions();
+        addresses = eliminator_->references();
+        optimizer_ = std::make_unique<PeepholeOptimizer>(program_, functions_, options.pipeline, addresses);
+        program_ = optimizer_->instructions();
+        functions_ = optimizer_->functions();
+        addresses = optimizer_->references();
+    }
+    if (options.schedule) {
+        scheduler_ = std::make_unique<Scheduler>(program_, functions_, options.pipeline, addresses);
+        program_ = scheduler_->instructions();
+        functions_ = scheduler_->functions();
+        addresses = scheduler_->references();
     }
+    for (auto const &reference : parser_->references()) {
+        if (reference.kind == Parser::SymbolReference::DATA && taken.count(reference.symbol) != 0) {
+            data_.Patch(reference.instruction, functions_.at(reference.symbol), reference.count);
+        }
+    }
+    for (auto const &reference : addresses) {
+        auto &data = program_[reference.instruction];
+        data = Parser::InstructionData(data.opcode(), EncodeAddress(data.tokens(), reference.kind,
+                                                                   functions_.at(reference.symbol)),
+                                       data.line_number(), data.file());
+    }
+    for (auto const &name : added) {
+        functions_.erase(name);
+    }
+    auto const &data = program_;
+    std::transform(std::begin(data), std::end(data), std::back_inserter(instructions_),
+                   [](auto &&instructionData) {
+        return InstructionFactory::CreateInstruction(instructionData);
+    });
 }
 
 void Assembler::WriteToFile(std::string const &file_path) {
@@ -31,6 +119,68 @@ void Assembler::WriteToFile(std::string const &file_path) {
     }
 }
 
+void Assembler::WriteDataToFile(std::string const &file_path) const {
+    std::ofstream file(file_path, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+        throw FileNotFoundException(file_path);
+    }
+    data_.WriteImage(file);
+}
+
+void Assembler::WriteObjectFile(std::string const &file_path) const {
+    ObjectFile::Write(file_path, GetCode(), *parser_);
+}
+
+void Assembler::WriteListing(std::string const &file_path) const {
+    std::ofstream file(file_path, std::ios::out | std::ios::trunc);
+    if (!file.is_open()) {
+        throw FileNotFoundException(file_path);
+    }
+    SourceMap::WriteListing(file, program_, GetCode(), Labels(), parser_->files());
+}
+
+void Assembler::WriteSourceMap(std::string const &file_path) const {
+    SourceMap::Write(file_path, program_, Labels(), functions_, parser_->files());
+}
+
+std::vector<std::pair<uint32_t, std::string>> Assembler::Labels() const {
+    auto const &parsed = parser_->instructions();
+    bool const moved = layout_ != nullptr || eliminator_ != nullptr || scheduler_ != nullptr;
+    // Keyed by file in the upper half and line in the lower.
+    auto const line_of = [](Parser::InstructionData const &data) {
+        return uint64_t{data.file()} << 32u | data.line_number();
+    };
+    std::unordered_map<uint64_t, uint32_t> first_of_line;
+    if (moved) {
+        for (std::size_t i = program_.size(); i-- > 0;) {
+            first_of_line[line_of(program_[i])] = static_cast<uint32_t>(i);
+        }
+    }
+    std::vector<std::pair<uint32_t, std::string>> labels;
+    for (auto const &label : parser_->labels()) {
+        uint32_t const index = label.second.first - 1;
+        if (!moved) {
+            labels.emplace_back(index, label.first);
+        } else if (index < parsed.size()) {
+            auto found = first_of_line.find(line_of(parsed[index]));
+            if (found != first_of_line.end()) {
+                labels.emplace_back(found->second, label.first);
+            }
+        }
+    }
+    std::sort(std::begin(labels), std::end(labels));
+    return labels;
+}
+
+std::vector<uint32_t> Assembler::GetCode() const {
+    std::vector<uint32_t> code;
+    code.reserve(instructions_.size());
+    for (auto const &instruction : instructions_) {
+        code.push_back(instruction->GetRepresentation());
+    }
+    return code;
+}
+
 FileNotFoundException::FileNotFoundException(const std::string &file_path) {
     message_ = "File " + file_path + " was not found.";
 }
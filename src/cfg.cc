@@ -0,0 +1,223 @@
+#include "cfg.h"
+#include "instructions.h"
+#include <algorithm>
+#include <cstdlib>
+#include <deque>
+#include <map>
+
+namespace mips {
+
+namespace {
+
+bool IsBranch(Parser::InstructionData const &data) {
+    return data.opcode() == Instruction::BEQ || data.opcode() == Instruction::BNE;
+}
+
+bool EndsBlock(Parser::InstructionData const &data) {
+    return IsBranch(data) || data.opcode() == Instruction::J || data.opcode() == Instruction::JAL
+            || (data.opcode() == Instruction::RTYPE && (data.tokens()[0] == "jr" || data.tokens()[0] == "syscall"));
+}
+
+bool IsReturn(Parser::InstructionData const &data) {
+    return data.opcode() == Instruction::RTYPE && data.tokens()[0] == "jr";
+}
+
+int64_t AddressToIndex(int64_t address) {
+    return (address - CODE_SEGMENT_OFFSET) / 4;
+}
+
+std::string Hex(uint32_t value) {
+    static constexpr char digits[] = "0123456789abcdef";
+    std::string text = "0x00000000";
+    for (int i = 9; i >= 2; --i, value >>= 4u) {
+        text[static_cast<std::size_t>(i)] = digits[value & 0xfu];
+    }
+    return text;
+}
+
+} // namespace
+
+ControlFlowGraph::ControlFlowGraph(std::vector<Parser::InstructionData> const &instructions,
+                                   std::unordered_map<std::string, uint32_t> const &functions)
+        : instructions_(instructions), block_of_(instructions.size()) {
+    std::size_t const size = instructions.size();
+    if (size == 0) {
+        return;
+    }
+    auto const in_program = [&](int64_t index) { return index >= 0 && index < static_cast<int64_t>(size); };
+
+    // Function entries by instruction index, named by the Parser or after their address.
+    std::map<std::size_t, std::string> entries;
+    for (auto const &function : functions) {
+        int64_t const entry = AddressToIndex(function.second);
+        if (in_program(entry)) {
+            auto const inserted = entries.emplace(static_cast<std::size_t>(entry), function.first);
+            if (!inserted.second && function.first < inserted.first->second) {
+                inserted.first->second = function.first;
+            }
+        }
+    }
+
+    std::vector<bool> leader(size, false);
+    leader[0] = true;
+    for (std::size_t i = 0; i < size; ++i) {
+        auto const &data = instructions[i];
+        if (IsBranch(data) || data.opcode() == Instruction::J || data.opcode() == Instruction::JAL) {
+            int64_t const target = TargetOf(i);
+            if (in_program(target)) {
+                leader[static_cast<std::size_t>(target)] = true;
+                if (data.opcode() == Instruction::JAL) {
+                    entries.emplace(static_cast<std::size_t>(target),
+                                    "function_" + Hex(CODE_SEGMENT_OFFSET + static_cast<uint32_t>(target) * 4).substr(2));
+                }
+            }
+        }
+        if (EndsBlock(data) && i + 1 < size) {
+            leader[i + 1] = true;
+        }
+    }
+    for (auto const &entry : entries) {
+        leader[entry.first] = true;
+    }
+
+    for (std::size_t i = 0; i < size; ++i) {
+        if (leader[i]) {
+            blocks_.push_back({i, i, {}, {}});
+        }
+        blocks_.back().end = i + 1;
+        block_of_[i] = blocks_.size() - 1;
+    }
+
+    std::map<std::size_t, std::size_t> function_at; // Entry block -> function.
+    for (auto const &entry : entries) {
+        function_at[block_of_[entry.first]] = functions_.size();
+        functions_.push_back({entry.second, block_of_[entry.first], {}, {}});
+    }
+
+    for (std::size_t b = 0; b < blocks_.size(); ++b) {
+        BasicBlock &block = blocks_[b];
+        std::size_t const last = block.end - 1;
+        auto const &data = instructions[last];
+        auto const add_successor = [&](int64_t index) {
+            if (in_program(index)) {
+                std::size_t const successor = block_of_[static_cast<std::size_t>(index)];
+                if (std::find(std::begin(block.successors), std::end(block.successors), successor)
+                        == std::end(block.successors)) {
+                    block.successors.push_back(successor);
+                }
+            }
+        };
+        if (IsBranch(data) || data.opcode() == Instruction::J) {
+            add_successor(TargetOf(last));
+        }
+        if (data.opcode() == Instruction::JAL) {
+            int64_t const target = TargetOf(last);
+            if (in_program(target)) {
+                block.callee = function_at[block_of_[static_cast<std::size_t>(target)]];
+                functions_[block.callee].callers.push_back(b);
+            }
+        }
+        if (data.opcode() != Instruction::J && !IsReturn(data)) {
+            add_successor(static_cast<int64_t>(block.end));
+        }
+        for (std::size_t successor : block.successors) {
+            blocks_[successor].predecessors.push_back(b);
+        }
+    }
+
+    for (std::size_t f = 0; f < functions_.size(); ++f) {
+        std::deque<std::size_t> work{functions_[f].entry};
+        while (!work.empty()) {
+            std::size_t const b = work.front();
+            work.pop_front();
+            if (blocks_[b].function != NONE) {
+                continue;
+            }
+            blocks_[b].function = f;
+            functions_[f].blocks.push_back(b);
+            for (std::size_t successor : blocks_[b].successors) {
+                work.push_back(successor);
+            }
+        }
+        std::sort(std::begin(functions_[f].blocks), std::end(functions_[f].blocks));
+    }
+}
+
+int64_t ControlFlowGraph::TargetOf(std::size_t instruction) const {
+    auto const &data = instructions_[instruction];
+    if (IsBranch(data)) {
+        return static_cast<int64_t>(instruction) + 1 + std::strtoll(data.tokens()[3].c_str(), nullptr, 0);
+    }
+    return AddressToIndex(std::strtoll(data.tokens()[1].c_str(), nullptr, 0));
+}
+
+std::vector<bool> ControlFlowGraph::ReachableBlocks(std::vector<std::size_t> const &roots) const {
+    std::vector<bool> reachable(blocks_.size(), false);
+    std::vector<std::size_t> work = roots;
+    if (!blocks_.empty()) {
+        work.push_back(0);
+    }
+    for (auto const &function : functions_) {
+        if (function.name == "main") {
+            work.push_back(function.entry);
+        }
+    }
+    while (!work.empty()) {
+        std::size_t const b = work.back();
+        work.pop_back();
+        if (reachable[b]) {
+            continue;
+        }
+        reachable[b] = true;
+        work.insert(std::end(work), std::begin(blocks_[b].successors), std::end(blocks_[b].successors));
+        if (blocks_[b].callee != NONE) {
+            work.push_back(functions_[blocks_[b].callee].entry);
+        }
+    }
+    return reachable;
+}
+
+void ControlFlowGraph::WriteDot(std::ostream &out) const {
+    std::vector<bool> const reachable = ReachableBlocks();
+    auto const write_block = [&](std::size_t b, char const *indent) {
+        BasicBlock const &block = blocks_[b];
+        out << indent << 'B' << b << " [label=\"" << Hex(CODE_SEGMENT_OFFSET + static_cast<uint32_t>(block.begin) * 4)
+            << ":\\l";
+        for (std::size_t i = block.begin; i < block.end; ++i) {
+            auto const &tokens = instructions_[i].tokens();
+            out << "  " << tokens[0];
+            for (std::size_t t = 1; t < tokens.size(); ++t) {
+                out << (t == 1 ? " " : ", ") << tokens[t];
+            }
+            out << "\\l";
+        }
+        out << '"' << (reachable[b] ? "" : ", style=filled, fillcolor=gray") << "];\n";
+    };
+
+    out << "digraph cfg {\n";
+    out << "    node [shape=box, fontname=monospace];\n";
+    for (std::size_t f = 0; f < functions_.size(); ++f) {
+        out << "    subgraph cluster_" << f << " {\n";
+        out << "        label=\"" << functions_[f].name << "\";\n";
+        for (std::size_t b : functions_[f].blocks) {
+            write_block(b, "        ");
+        }
+        out << "    }\n";
+    }
+    for (std::size_t b = 0; b < blocks_.size(); ++b) {
+        if (blocks_[b].function == NONE) {
+            write_block(b, "    ");
+        }
+    }
+    for (std::size_t b = 0; b < blocks_.size(); ++b) {
+        for (std::size_t successor : blocks_[b].successors) {
+            out << "    B" << b << " -> B" << successor << ";\n";
+        }
+        if (blocks_[b].callee != NONE) {
+            out << "    B" << b << " -> B" << functions_[blocks_[b].callee].entry << " [style=dashed];\n";
+        }
+    }
+    out << "}\n";
+}
+
+} // namespace mips
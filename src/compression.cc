@@ -0,0 +1,161 @@
+#include "compression.h"
+#include <cstring>
+
+namespace mips {
+
+namespace {
+
+constexpr std::size_t MIN_MATCH = 4;
+// Literals only at the end of the input, so matches never reach its last bytes.
+constexpr std::size_t LAST_LITERALS = 5;
+constexpr std::size_t MAX_OFFSET = 0xffff;
+constexpr unsigned HASH_BITS = 14;
+
+inline uint32_t Read32(uint8_t const *p) {
+    uint32_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+inline uint64_t Read64(uint8_t const *p) {
+    uint64_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+inline uint32_t Hash(uint32_t sequence) {
+    return (sequence * 2654435761u) >> (32u - HASH_BITS);
+}
+
+void PutLength(std::size_t length, std::vector<uint8_t> &out) {
+    while (length >= 255) {
+        out.push_back(255);
+        length -= 255;
+    }
+    out.push_back(static_cast<uint8_t>(length));
+}
+
+void PutSequence(uint8_t const *literals, std::size_t literal_length, std::size_t offset,
+                 std::size_t match_length, std::vector<uint8_t> &out) {
+    std::size_t const match_code = match_length >= MIN_MATCH ? match_length - MIN_MATCH : 0;
+    uint8_t token = static_cast<uint8_t>((literal_length < 15 ? literal_length : 15) << 4u);
+    token |= static_cast<uint8_t>(match_code < 15 ? match_code : 15);
+    out.push_back(token);
+    if (literal_length >= 15) {
+        PutLength(literal_length - 15, out);
+    }
+    out.insert(out.end(), literals, literals + literal_length);
+    if (match_length == 0) {
+        return;
+    }
+    out.push_back(static_cast<uint8_t>(offset));
+    out.push_back(static_cast<uint8_t>(offset >> 8u));
+    if (match_code >= 15) {
+        PutLength(match_code - 15, out);
+    }
+}
+
+std::size_t GetLength(uint8_t const *&in, uint8_t const *end) {
+    std::size_t length = 0;
+    uint8_t byte;
+    do {
+        if (in == end) {
+            throw CorruptDataException("Truncated length.");
+        }
+        byte = *in++;
+        length += byte;
+    } while (byte == 255);
+    return length;
+}
+
+} // namespace
+
+CorruptDataException::CorruptDataException(std::string const &info) {
+    message_ = "Corrupt data: " + info;
+}
+
+void LZCompress(uint8_t const *data, std::size_t size, std::vector<uint8_t> &out) {
+    std::vector<uint32_t> table(1u << HASH_BITS, 0);
+    std::size_t anchor = 0;
+    std::size_t i = 0;
+    std::size_t const limit = size > MIN_MATCH + LAST_LITERALS ? size - MIN_MATCH - LAST_LITERALS : 0;
+
+    // Incompressible stretches are skipped faster the longer they get.
+    std::size_t misses = 0;
+
+    while (i < limit) {
+        uint32_t const sequence = Read32(data + i);
+        uint32_t const hash = Hash(sequence);
+        // Positions are stored off by one so that zero means empty.
+        std::size_t const candidate = table[hash];
+        table[hash] = static_cast<uint32_t>(i + 1);
+        if (candidate == 0 || i + 1 - candidate > MAX_OFFSET || Read32(data + candidate - 1) != sequence) {
+            i += 1 + (misses++ >> 6u);
+            continue;
+        }
+        misses = 0;
+
+        std::size_t const match = candidate - 1;
+        std::size_t length = MIN_MATCH;
+        std::size_t const max_length = size - LAST_LITERALS - i;
+        while (length + 8 <= max_length && Read64(data + match + length) == Read64(data + i + length)) {
+            length += 8;
+        }
+        while (length < max_length && data[match + length] == data[i + length]) {
+            ++length;
+        }
+        PutSequence(data + anchor, i - anchor, i - match, length, out);
+        i += length;
+        anchor = i;
+    }
+    PutSequence(data + anchor, size - anchor, 0, 0, out);
+}
+
+void LZDecompress(uint8_t const *data, std::size_t size, uint8_t *out, std::size_t raw_size) {
+    uint8_t const *in = data;
+    uint8_t const *const in_end = data + size;
+    std::size_t written = 0;
+
+    while (in < in_end) {
+        uint8_t const token = *in++;
+        std::size_t literal_length = token >> 4u;
+        if (literal_length == 15) {
+            literal_length += GetLength(in, in_end);
+        }
+        if (literal_length > static_cast<std::size_t>(in_end - in) || literal_length > raw_size - written) {
+            throw CorruptDataException("Literals out of bounds.");
+        }
+        std::memcpy(out + written, in, literal_length);
+        in += literal_length;
+        written += literal_length;
+        if (in == in_end) {
+            break;
+        }
+
+        if (in_end - in < 2) {
+            throw CorruptDataException("Truncated match offset.");
+        }
+        std::size_t const offset = in[0] | (static_cast<std::size_t>(in[1]) << 8u);
+        in += 2;
+        std::size_t match_length = token & 0x0fu;
+        if (match_length == 15) {
+            match_length += GetLength(in, in_end);
+        }
+        match_length += MIN_MATCH;
+        if (offset == 0 || offset > written || match_length > raw_size - written) {
+            throw CorruptDataException("Match out of bounds.");
+        }
+        // Matches may overlap the bytes they produce, so copy forwards one byte at a time.
+        uint8_t const *from = out + written - offset;
+        for (std::size_t k = 0; k < match_length; ++k) {
+            out[written + k] = from[k];
+        }
+        written += match_length;
+    }
+
+    if (written != raw_size) {
+        throw CorruptDataException("Unexpected decompressed size.");
+    }
+}
+
+} // namespace mips
@@ -0,0 +1,174 @@
+#include "data_segment.h"
+#include <algorithm>
+
+namespace mips {
+
+namespace {
+
+constexpr std::size_t WRITE_BUFFER = 1u << 20u;
+
+// The word made of value repeated, for a unit that divides 4.
+uint32_t RepeatedWord(uint32_t unit, uint32_t value) {
+    switch (unit) {
+    case 1:
+        return (value & 0xffu) * 0x01010101u;
+    case 2:
+        return (value & 0xffffu) * 0x00010001u;
+    default:
+        return value;
+    }
+}
+
+} // namespace
+
+void DataSegment::Clear() {
+    items_.clear();
+    size_ = 0;
+}
+
+void DataSegment::Align(uint32_t alignment) {
+    uint64_t const padding = (alignment - (address() & (alignment - 1))) & (alignment - 1);
+    if (padding != 0) {
+        Append(1, 0, padding);
+    }
+}
+
+void DataSegment::Append(uint32_t unit, uint32_t value, uint64_t count) {
+    if (count == 0) {
+        return;
+    }
+    if (unit < 4) {
+        value &= (1u << (8 * unit)) - 1;
+    }
+    if (count == 1) {
+        std::string bytes;
+        for (uint32_t i = 0; i < unit; ++i) {
+            bytes.push_back(static_cast<char>(value >> (8 * i)));
+        }
+        AppendBytes(bytes);
+        return;
+    }
+    if (!items_.empty() && items_.back().unit == unit && items_.back().value == value) {
+        items_.back().count += count;
+    } else {
+        items_.push_back({unit, value, count, {}});
+    }
+    size_ += unit * count;
+}
+
+void DataSegment::AppendBytes(std::string const &bytes) {
+    if (items_.empty() || items_.back().unit != 0) {
+        items_.push_back({0, 0, 0, {}});
+    }
+    items_.back().bytes += bytes;
+    size_ += bytes.size();
+}
+
+void DataSegment::Patch(uint64_t offset, uint32_t value, uint64_t count) {
+    uint64_t position = 0;
+    for (auto item = std::begin(items_); item != std::end(items_); ++item) {
+        uint64_t const size = item->unit == 0 ? item->bytes.size() : item->unit * item->count;
+        if (offset >= position + size) {
+            position += size;
+            continue;
+        }
+        if (item->unit == 0) {
+            for (uint64_t i = 0; i < count * 4; ++i) {
+                item->bytes[offset - position + i] = static_cast<char>(value >> (8 * (i % 4)));
+            }
+            return;
+        }
+        // A run splits into what comes before the words, the words and what follows.
+        Item const run = *item;
+        uint64_t const before = (offset - position) / run.unit;
+        uint64_t const after = run.count - before - count * 4 / run.unit;
+        std::vector<Item> parts;
+        if (before != 0) {
+            parts.push_back({run.unit, run.value, before, {}});
+        }
+        parts.push_back({4, value, count, {}});
+        if (after != 0) {
+            parts.push_back({run.unit, run.value, after, {}});
+        }
+        item = items_.erase(item);
+        items_.insert(item, std::begin(parts), std::end(parts));
+        return;
+    }
+}
+
+template <typename Sink>
+void DataSegment::ForEachRun(Sink &&sink) const {
+    uint64_t address = DATA_SEGMENT_OFFSET;
+    uint32_t word = 0;
+    auto put = [&](uint8_t byte) {
+        word |= uint32_t{byte} << (8 * (address & 3u));
+        if ((++address & 3u) == 0) {
+            sink(static_cast<uint32_t>((address - 4) >> 2), word, uint64_t{1});
+            word = 0;
+        }
+    };
+    for (auto const &item : items_) {
+        if (item.unit == 0) {
+            for (char byte : item.bytes) {
+                put(static_cast<uint8_t>(byte));
+            }
+            continue;
+        }
+        // Items start aligned to their unit, so once the address is word
+        // aligned the pattern starts over at its first byte.
+        uint64_t const bytes = item.count * item.unit;
+        uint64_t i = 0;
+        for (; i < bytes && (address & 3u) != 0; ++i) {
+            put(static_cast<uint8_t>(item.value >> (8 * (i % item.unit))));
+        }
+        uint64_t const words = (bytes - i) / 4;
+        if (words != 0) {
+            sink(static_cast<uint32_t>(address >> 2), RepeatedWord(item.unit, item.value), words);
+            address += words * 4;
+            i += words * 4;
+        }
+        for (; i < bytes; ++i) {
+            put(static_cast<uint8_t>(item.value >> (8 * (i % item.unit))));
+        }
+    }
+    if ((address & 3u) != 0) {
+        sink(static_cast<uint32_t>(address >> 2), word, uint64_t{1});
+    }
+}
+
+void DataSegment::WriteImage(std::ostream &out) const {
+    static constexpr char DIGITS[] = "0123456789abcdef";
+    std::vector<char> buffer;
+    buffer.reserve(WRITE_BUFFER + 9);
+    auto append = [&buffer](uint32_t value) {
+        for (int digit = 0; digit < 8; ++digit) {
+            buffer.push_back(DIGITS[(value >> (28 - 4 * digit)) & 0xfu]);
+        }
+        buffer.push_back('\n');
+    };
+    buffer.push_back('@');
+    append(DATA_SEGMENT_OFFSET >> 2);
+    ForEachRun([&](uint32_t, uint32_t word, uint64_t count) {
+        for (uint64_t i = 0; i < count; ++i) {
+            append(word);
+            if (buffer.size() >= WRITE_BUFFER) {
+                out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+                buffer.clear();
+            }
+        }
+    });
+    out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+}
+
+void DataSegment::Load(GuestMemory &memory) const {
+    ForEachRun([&memory](uint32_t word_address, uint32_t word, uint64_t count) {
+        if (word == 0) {
+            return;
+        }
+        for (uint64_t i = 0; i < count; ++i) {
+            memory.Store(static_cast<uint32_t>((word_address + i) << 2), word);
+        }
+    });
+}
+
+} // namespace mips
@@ -0,0 +1,97 @@
+#include "dead_code.h"
+#include "cfg.h"
+#include "instructions.h"
+#include <algorithm>
+#include <cstdlib>
+
+namespace mips {
+
+DeadCodeEliminator::DeadCodeEliminator(std::vector<Parser::InstructionData> const &instructions,
+                                       std::unordered_map<std::string, uint32_t> const &functions,
+                                       std::unordered_set<std::string> const &taken,
+                                       std::vector<Parser::SymbolReference> const &references) {
+    ControlFlowGraph const cfg(instructions, functions);
+    std::vector<std::size_t> roots;
+    for (auto const &function : cfg.functions()) {
+        if (taken.count(function.name) != 0) {
+            roots.push_back(function.entry);
+        }
+    }
+    std::vector<bool> const reachable = cfg.ReachableBlocks(roots);
+    int64_t const size = static_cast<int64_t>(instructions.size());
+
+    // new_index[i] is where instruction i ends up, or where the code after it starts if it is removed.
+    std::vector<int64_t> new_index(instructions.size() + 1);
+    std::vector<bool> keep(instructions.size());
+    int64_t kept = 0;
+    for (std::size_t i = 0; i < instructions.size(); ++i) {
+        keep[i] = reachable[cfg.block_of(i)];
+        new_index[i] = kept;
+        kept += keep[i];
+    }
+    new_index[instructions.size()] = kept;
+    for (std::size_t b = 0; b < cfg.blocks().size(); ++b) {
+        removed_blocks_ += !reachable[b];
+    }
+    removed_instructions_ = static_cast<uint32_t>(size - kept);
+
+    auto const map_index = [&](int64_t index) {
+        if (index < 0) {
+            return index;
+        }
+        if (index > size) {
+            return index - size + kept;
+        }
+        return new_index[static_cast<std::size_t>(index)];
+    };
+    auto const map_address = [&](int64_t address) {
+        if (address < CODE_SEGMENT_OFFSET || (address - CODE_SEGMENT_OFFSET) % 4 != 0) {
+            return address;
+        }
+        return CODE_SEGMENT_OFFSET + map_index((address - CODE_SEGMENT_OFFSET) / 4) * 4;
+    };
+
+    instructions_.reserve(static_cast<std::size_t>(kept));
+    for (std::size_t i = 0; i < instructions.size(); ++i) {
+        if (!keep[i]) {
+            continue;
+        }
+        auto const &data = instructions[i];
+        std::vector<std::string> tokens = data.tokens();
+        if (data.opcode() == Instruction::BEQ || data.opcode() == Instruction::BNE) {
+            tokens[3] = std::to_string(map_index(cfg.TargetOf(i)) - new_index[i] - 1);
+        } else if (data.opcode() == Instruction::J || data.opcode() == Instruction::JAL) {
+            tokens[1] = std::to_string(map_address(std::strtoll(tokens[1].c_str(), nullptr, 0)));
+        }
+        instructions_.emplace_back(data.opcode(), std::move(tokens), data.line_number(), data.file());
+    }
+
+    for (auto const &function : functions) {
+        int64_t const entry = (static_cast<int64_t>(function.second) - CODE_SEGMENT_OFFSET) / 4;
+        if (entry >= 0 && entry < size && !keep[static_cast<std::size_t>(entry)]) {
+            removed_functions_.push_back(function.first);
+        } else {
+            functions_.emplace(function.first, static_cast<uint32_t>(map_address(function.second)));
+        }
+    }
+    std::sort(std::begin(removed_functions_), std::end(removed_functions_));
+    for (auto reference : references) {
+        if (keep[reference.instruction]) {
+            reference.instruction = static_cast<uint32_t>(new_index[reference.instruction]);
+            references_.push_back(std::move(reference));
+        }
+    }
+}
+
+void DeadCodeEliminator::WriteReport(std::ostream &out) const {
+    out << "Removed " << removed_instructions_ << " unreachable instructions in " << removed_blocks_ << " blocks";
+    if (!removed_functions_.empty()) {
+        out << ", functions:";
+        for (auto const &name : removed_functions_) {
+            out << ' ' << name;
+        }
+    }
+    out << ".\n";
+}
+
+} // namespace mips
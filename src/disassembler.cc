@@ -0,0 +1,376 @@
+#include "disassembler.h"
+#include "guest_memory.h"
+#include "instructions.h"
+#include "mapped_file.h"
+#include "parser.h"
+#include "simulator.h"
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cstring>
+#include <iomanip>
+#include <memory>
+#include <sstream>
+
+namespace mips {
+
+namespace {
+
+enum Format : uint8_t {
+    INVALID,
+    REGISTER,
+    JUMP_REGISTER,
+    SYSCALL,
+    IMMEDIATE,
+    UNSIGNED_IMMEDIATE,
+    UPPER_IMMEDIATE,
+    BRANCH,
+    MEMORY,
+    JUMP,
+    CALL
+};
+
+// The mnemonic is stored as it starts the line, "\tadd ", padded so it is
+// copied with one fixed-size store.
+struct Entry {
+    char text[16];
+    uint8_t length;
+    Format format;
+    uint32_t zero_fields; // Bits that must be clear for the word to reassemble identically.
+};
+
+constexpr Entry MakeEntry(char const *mnemonic, Format format, uint32_t zero_fields) {
+    Entry entry = {{'\t'}, 1, format, zero_fields};
+    for (; *mnemonic != '\0'; ++mnemonic) {
+        entry.text[entry.length++] = *mnemonic;
+    }
+    if (format != SYSCALL) {
+        entry.text[entry.length++] = ' ';
+    }
+    return entry;
+}
+
+// Indexed by the opcode, or by 64 + funct for R-type words.
+constexpr std::array<Entry, 128> MakeTable() {
+    std::array<Entry, 128> table = {};
+    for (auto &entry : table) {
+        entry = MakeEntry("", INVALID, 0);
+    }
+    table[Instruction::ADDI >> 26u] = MakeEntry("addi", IMMEDIATE, 0);
+    table[Instruction::SLTI >> 26u] = MakeEntry("slti", IMMEDIATE, 0);
+    table[Instruction::ANDI >> 26u] = MakeEntry("andi", UNSIGNED_IMMEDIATE, 0);
+    table[Instruction::ORI >> 26u]  = MakeEntry("ori", UNSIGNED_IMMEDIATE, 0);
+    table[Instruction::LUI >> 26u]  = MakeEntry("lui", UPPER_IMMEDIATE, 0x03e00000u);
+    table[Instruction::BEQ >> 26u]  = MakeEntry("beq", BRANCH, 0);
+    table[Instruction::BNE >> 26u]  = MakeEntry("bne", BRANCH, 0);
+    table[Instruction::LW >> 26u]   = MakeEntry("lw", MEMORY, 0);
+    table[Instruction::SW >> 26u]   = MakeEntry("sw", MEMORY, 0);
+    table[Instruction::J >> 26u]    = MakeEntry("j", JUMP, 0);
+    table[Instruction::JAL >> 26u]  = MakeEntry("jal", CALL, 0);
+    table[64 + Instruction::FUNCT_ADD]     = MakeEntry("add", REGISTER, 0x000007c0u);
+    table[64 + Instruction::FUNCT_SUB]     = MakeEntry("sub", REGISTER, 0x000007c0u);
+    table[64 + Instruction::FUNCT_AND]     = MakeEntry("and", REGISTER, 0x000007c0u);
+    table[64 + Instruction::FUNCT_OR]      = MakeEntry("or", REGISTER, 0x000007c0u);
+    table[64 + Instruction::FUNCT_SLT]     = MakeEntry("slt", REGISTER, 0x000007c0u);
+    table[64 + Instruction::FUNCT_JR]      = MakeEntry("jr", JUMP_REGISTER, 0x001fffc0u);
+    table[64 + Instruction::FUNCT_SYSCALL] = MakeEntry("syscall", SYSCALL, 0x03ffffc0u);
+    return table;
+}
+
+constexpr std::array<Entry, 128> TABLE = MakeTable();
+
+bool IsSpace(char c) {
+    return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+
+template <std::size_t N>
+char *Append(char *out, char const (&text)[N]) {
+    std::memcpy(out, text, N - 1);
+    return out + N - 1;
+}
+
+// Register names padded to eight bytes so they are copied with one fixed-size store.
+struct Name {
+    char text[8];
+    uint8_t length;
+};
+
+std::array<Name, 32> MakeRegisterNames() {
+    std::array<Name, 32> names = {};
+    for (uint32_t reg = 0; reg < 32; ++reg) {
+        char const *name = Instruction::RegisterNumberToName(static_cast<Instruction::Register>(reg));
+        names[reg].length = static_cast<uint8_t>(std::strlen(name));
+        std::memcpy(names[reg].text, name, names[reg].length);
+    }
+    return names;
+}
+
+std::array<Name, 32> const REGISTER_NAMES = MakeRegisterNames();
+
+char *AppendRegister(char *out, uint32_t reg) {
+    Name const &name = REGISTER_NAMES[reg];
+    std::memcpy(out, name.text, sizeof(name.text));
+    return out + name.length;
+}
+
+// Writes the separator, then the register name.
+char *AppendRegister(char *out, char const (&separator)[3], uint32_t reg) {
+    return AppendRegister(Append(out, separator), reg);
+}
+
+char *AppendNumber(char *out, int64_t value) {
+    return std::to_chars(out, out + 24, value).ptr;
+}
+
+constexpr std::array<char, 200> MakeDigitPairs() {
+    std::array<char, 200> pairs = {};
+    for (int i = 0; i < 100; ++i) {
+        pairs[2 * i] = static_cast<char>('0' + i / 10);
+        pairs[2 * i + 1] = static_cast<char>('0' + i % 10);
+    }
+    return pairs;
+}
+
+constexpr std::array<char, 200> DIGIT_PAIRS = MakeDigitPairs();
+
+// A 16-bit immediate, signed or not. The five digits are always formatted
+// in a register and shifted past the leading zeros, so the random widths of
+// immediates cost no mispredicted branches. The byte stores merge into one.
+char *AppendImmediate(char *out, int32_t value) {
+    *out = '-';
+    out += value < 0;
+    uint32_t const magnitude = static_cast<uint32_t>(value < 0 ? -value : value);
+    uint32_t const high = magnitude / 100;
+    char const *const middle = &DIGIT_PAIRS[2 * (high % 100)];
+    char const *const low = &DIGIT_PAIRS[2 * (magnitude % 100)];
+    uint64_t digits = uint64_t{'0' + high / 100} | uint64_t(uint8_t(middle[0])) << 8u
+            | uint64_t(uint8_t(middle[1])) << 16u | uint64_t(uint8_t(low[0])) << 24u
+            | uint64_t(uint8_t(low[1])) << 32u;
+    uint32_t const length = 1 + (magnitude >= 10) + (magnitude >= 100) + (magnitude >= 1000) + (magnitude >= 10000);
+    digits >>= 8 * (5 - length);
+    for (int i = 0; i < 8; ++i) {
+        out[i] = static_cast<char>(digits >> (8 * i));
+    }
+    return out + length;
+}
+
+constexpr std::array<char, 512> MakeHexPairs() {
+    std::array<char, 512> pairs = {};
+    for (int i = 0; i < 256; ++i) {
+        pairs[2 * i] = "0123456789abcdef"[i >> 4];
+        pairs[2 * i + 1] = "0123456789abcdef"[i & 0xf];
+    }
+    return pairs;
+}
+
+constexpr std::array<char, 512> HEX_PAIRS = MakeHexPairs();
+
+// Eight digits, a byte at a time.
+char *AppendHex(char *out, uint32_t value) {
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        std::memcpy(out, &HEX_PAIRS[2 * ((value >> shift) & 0xffu)], 2);
+        out += 2;
+    }
+    return out;
+}
+
+// The words of a text image, which must run from the start of the code
+// segment without gaps; later words replace earlier ones at the same address.
+std::vector<uint32_t> LayOutCode(std::string const &file_path, std::vector<ImageSegment> const &segments) {
+    uint64_t const first = CODE_SEGMENT_OFFSET >> 2u;
+    uint64_t const limit = DATA_SEGMENT_OFFSET >> 2u;
+    std::vector<uint32_t> words;
+    for (auto const &segment : segments) {
+        if (segment.words.empty()) {
+            continue;
+        }
+        uint64_t const end = uint64_t{segment.word_address} + segment.words.size();
+        bool const outside = segment.word_address < first || end > limit;
+        if (outside || segment.word_address > first + words.size()) {
+            std::ostringstream info;
+            info << "words at @" << std::hex << std::setw(8) << std::setfill('0') << segment.word_address
+                 << (outside ? " lie outside the code segment." : " leave a gap in the code.");
+            throw InvalidImageException(file_path, info.str());
+        }
+        words.resize(std::max<std::size_t>(words.size(), end - first));
+        std::copy(segment.words.begin(), segment.words.end(), words.begin() + (segment.word_address - first));
+    }
+    return words;
+}
+
+} // namespace
+
+InvalidImageException::InvalidImageException(std::string const &file_path, std::string const &info) {
+    message_ = "Invalid image " + file_path + ": " + info;
+}
+
+std::vector<uint32_t> Disassembler::ReadImage(std::string const &file_path) {
+    MappedFile file(file_path);
+    if (file.size() == 0) {
+        return {};
+    }
+    if (file.data() == nullptr) {
+        throw InvalidImageException(file_path, "cannot be mapped.");
+    }
+    auto const *data = static_cast<char const *>(file.data());
+
+    std::size_t const sniff = std::min<std::size_t>(file.size(), 64);
+    bool const text = std::all_of(data, data + sniff, [](char c) { return IsSpace(c) || (c >= ' ' && c <= '~'); });
+    if (text) {
+        try {
+            return LayOutCode(file_path, ParseImage(std::string_view(data, file.size()), CODE_SEGMENT_OFFSET >> 2u));
+        } catch (UnexpectedSymbolException &e) {
+            e.AddFile(file_path);
+            throw;
+        }
+    }
+    if (file.size() % 4 != 0) {
+        throw InvalidImageException(file_path, "binary image size is not a multiple of 4.");
+    }
+    std::vector<uint32_t> words(file.size() / 4);
+    std::memcpy(words.data(), data, file.size());
+    return words;
+}
+
+void Disassembler::DecodeBatch(uint32_t const *words, std::size_t count, uint8_t *indices) {
+    for (std::size_t i = 0; i < count; ++i) {
+        uint32_t const word = words[i];
+        uint32_t const opcode = word >> 26u;
+        uint32_t const rtype = 0u - static_cast<uint32_t>(opcode == 0);
+        indices[i] = static_cast<uint8_t>(opcode | ((64u | (word & 0x3fu)) & rtype));
+    }
+}
+
+Disassembler::Disassembler(std::vector<uint32_t> code)
+        : code_(std::move(code)), indices_(code_.size()), labels_(code_.size(), NO_LABEL) {
+    for (std::size_t start = 0; start < code_.size(); start += BATCH_SIZE) {
+        DecodeBatch(code_.data() + start, std::min(BATCH_SIZE, code_.size() - start), indices_.data() + start);
+    }
+
+    for (uint32_t i = 0; i < code_.size(); ++i) {
+        Entry const &entry = TABLE[indices_[i]];
+        if (entry.format == INVALID || (code_[i] & entry.zero_fields) != 0) {
+            throw InvalidInstructionException(code_[i], CODE_SEGMENT_OFFSET + i * 4);
+        }
+        if (entry.format == BRANCH || entry.format == JUMP || entry.format == CALL) {
+            uint32_t const target = TargetIndex(i);
+            if (target != NO_TARGET) {
+                labels_[target] |= entry.format == CALL ? FUNCTION : LABEL;
+            }
+        }
+    }
+    if (!code_.empty()) {
+        labels_[0] |= FUNCTION;
+    }
+}
+
+uint32_t Disassembler::TargetIndex(uint32_t index) const {
+    uint32_t const word = code_[index];
+    if (TABLE[indices_[index]].format == BRANCH) {
+        int64_t const target = int64_t{index} + 1 + static_cast<int32_t>(Instruction::SignedImm16Of(word));
+        return target >= 0 && target < static_cast<int64_t>(code_.size()) ? static_cast<uint32_t>(target) : NO_TARGET;
+    }
+    uint32_t const pc = CODE_SEGMENT_OFFSET + index * 4;
+    uint32_t const address = (pc & 0xfc000000u) | Instruction::TargetOf(word);
+    uint32_t const offset = address - CODE_SEGMENT_OFFSET;
+    return (offset & 3u) == 0 && offset / 4 < code_.size() ? offset / 4 : NO_TARGET;
+}
+
+// main, function_<address> or label_<address>.
+char *Disassembler::AppendName(char *out, uint32_t index) const {
+    if (index == 0) {
+        return Append(out, "main");
+    }
+    out = (labels_[index] & FUNCTION) ? Append(out, "function_") : Append(out, "label_");
+    return AppendHex(out, CODE_SEGMENT_OFFSET + index * 4);
+}
+
+char *Disassembler::AppendInstruction(char *out, uint32_t index) const {
+    uint32_t const word = code_[index];
+    Entry const &entry = TABLE[indices_[index]];
+    std::memcpy(out, entry.text, sizeof(entry.text));
+    out += entry.length;
+    switch (entry.format) {
+    case REGISTER:
+        out = AppendRegister(out, Instruction::RdOf(word));
+        out = AppendRegister(out, ", ", Instruction::RsOf(word));
+        out = AppendRegister(out, ", ", Instruction::RtOf(word));
+        break;
+    case JUMP_REGISTER:
+        out = AppendRegister(out, Instruction::RsOf(word));
+        break;
+    case IMMEDIATE:
+    case UNSIGNED_IMMEDIATE:
+        out = AppendRegister(out, Instruction::RtOf(word));
+        out = AppendRegister(out, ", ", Instruction::RsOf(word));
+        out = AppendImmediate(Append(out, ", "), entry.format == IMMEDIATE
+                              ? static_cast<int32_t>(Instruction::SignedImm16Of(word))
+                              : static_cast<int32_t>(Instruction::Imm16Of(word)));
+        break;
+    case UPPER_IMMEDIATE:
+        out = AppendRegister(out, Instruction::RtOf(word));
+        out = AppendImmediate(Append(out, ", "), static_cast<int32_t>(Instruction::Imm16Of(word)));
+        break;
+    case BRANCH:
+    case JUMP:
+    case CALL: {
+        if (entry.format == BRANCH) {
+            out = AppendRegister(out, Instruction::RtOf(word));
+            out = AppendRegister(out, ", ", Instruction::RsOf(word));
+            out = Append(out, ", ");
+        }
+        uint32_t const target = TargetIndex(index);
+        if (target != NO_TARGET) {
+            out = AppendName(out, target);
+        } else if (entry.format == BRANCH) {
+            out = AppendImmediate(out, static_cast<int32_t>(Instruction::SignedImm16Of(word)));
+        } else {
+            out = AppendNumber(out, Instruction::TargetOf(word));
+        }
+        break;
+    }
+    case MEMORY:
+        out = AppendRegister(out, Instruction::RtOf(word));
+        out = AppendImmediate(Append(out, ", "), static_cast<int32_t>(Instruction::SignedImm16Of(word)));
+        *out++ = '(';
+        out = AppendRegister(out, Instruction::RsOf(word));
+        *out++ = ')';
+        break;
+    default:
+        break;
+    }
+    *out++ = '\n';
+    return out;
+}
+
+void Disassembler::Write(std::ostream &out) const {
+    // Flushed whenever less than one line of room is left.
+    static constexpr std::size_t BUFFER_SIZE = 1 << 20;
+    static constexpr std::size_t MAX_LINE = 128;
+    std::unique_ptr<char[]> buffer(new char[BUFFER_SIZE]);
+    char *const end = buffer.get() + BUFFER_SIZE - 3 * MAX_LINE;
+    char *p = buffer.get();
+    uint32_t function = 0;
+    for (uint32_t i = 0; i < code_.size(); ++i) {
+        if (labels_[i] != NO_LABEL) {
+            if ((labels_[i] & FUNCTION) && i != 0) {
+                p = AppendName(Append(p, ".end "), function);
+                p = Append(p, "\n\n");
+                function = i;
+            }
+            p = Append(AppendName(p, i), ":\n");
+        }
+        p = AppendInstruction(p, i);
+        if (p >= end) {
+            out.write(buffer.get(), p - buffer.get());
+            p = buffer.get();
+        }
+    }
+    if (!code_.empty()) {
+        p = AppendName(Append(p, ".end "), function);
+        p = Append(p, "\n\n");
+    }
+    out.write(buffer.get(), p - buffer.get());
+}
+
+} // namespace mips
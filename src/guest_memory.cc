@@ -0,0 +1,189 @@
+#include "guest_memory.h"
+#include "parser.h"
+#include <algorithm>
+#include <iomanip>
+#include <iterator>
+#include <string>
+#include <sys/mman.h>
+
+namespace mips {
+
+namespace {
+
+constexpr std::array<int8_t, 256> MakeHexTable() {
+    std::array<int8_t, 256> table = {};
+    for (auto &value : table) {
+        value = -1;
+    }
+    for (int c = 0; c < 10; ++c) {
+        table['0' + c] = static_cast<int8_t>(c);
+    }
+    for (int c = 0; c < 6; ++c) {
+        table['a' + c] = static_cast<int8_t>(10 + c);
+        table['A' + c] = static_cast<int8_t>(10 + c);
+    }
+    return table;
+}
+
+constexpr std::array<int8_t, 256> HEX = MakeHexTable();
+
+bool IsSpace(char c) {
+    return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+
+// A token ends at whitespace or at a comment.
+bool EndsToken(std::string_view text, std::size_t i) {
+    return i == text.size() || IsSpace(text[i]) || text.compare(i, 2, "//") == 0;
+}
+
+} // namespace
+
+std::vector<ImageSegment> ParseImage(std::string_view text, uint32_t word_address) {
+    std::vector<ImageSegment> segments(1, ImageSegment{word_address, {}});
+    segments.back().words.reserve(text.size() / 9 + 1);
+    uint32_t line_number = 1;
+    std::size_t i = 0;
+    while (i < text.size()) {
+        if (IsSpace(text[i])) {
+            line_number += text[i] == '\n';
+            ++i;
+            continue;
+        }
+        if (EndsToken(text, i)) {
+            i = std::min(text.find('\n', i), text.size());
+            continue;
+        }
+        std::size_t const start = i;
+        bool const address = text[i] == '@';
+        i += address;
+        uint32_t value = 0;
+        std::size_t const digits = i;
+        while (i < text.size() && HEX[static_cast<unsigned char>(text[i])] >= 0) {
+            value = (value << 4u) | static_cast<uint32_t>(HEX[static_cast<unsigned char>(text[i])]);
+            ++i;
+        }
+        if (i == digits || i - digits > 8 || !EndsToken(text, i)) {
+            std::size_t const token_end = text.find_first_of(" \n\r\t", start);
+            throw UnexpectedSymbolException(std::string(text.substr(start, token_end - start)), line_number,
+                                            "Expected hexadecimal word or @address.");
+        }
+        if (!address) {
+            segments.back().words.push_back(value);
+        } else if (value > 0x3fffffffu) {
+            throw UnexpectedSymbolException(std::string(text.substr(start, i - start)), line_number,
+                                            "Word address out of range.");
+        } else if (segments.back().words.empty()) {
+            segments.back().word_address = value;
+        } else {
+            segments.push_back(ImageSegment{value, {}});
+        }
+    }
+    return segments;
+}
+
+void GuestMemory::Unmapper::operator()(void *mapping) const {
+    munmap(mapping, size);
+}
+
+GuestMemory::GuestMemory() = default;
+GuestMemory::GuestMemory(GuestMemory &&) noexcept = default;
+GuestMemory &GuestMemory::operator=(GuestMemory &&) noexcept = default;
+GuestMemory::~GuestMemory() = default;
+
+uint32_t *GuestMemory::FindPage(uint32_t page_number) const {
+    auto const &table = directory_[page_number >> TABLE_BITS];
+    return table ? table[page_number & (TABLE_SIZE - 1)] : nullptr;
+}
+
+uint32_t *&GuestMemory::PageEntry(uint32_t page_number) {
+    auto &table = directory_[page_number >> TABLE_BITS];
+    if (!table) {
+        table.reset(new uint32_t *[TABLE_SIZE]());
+    }
+    return table[page_number & (TABLE_SIZE - 1)];
+}
+
+uint32_t GuestMemory::LoadSlow(uint32_t address) const {
+    uint32_t const page_number = address >> PAGE_BITS;
+    uint32_t *page = FindPage(page_number);
+    if (page == nullptr) {
+        return 0;
+    }
+    cached_page_number_ = page_number;
+    cached_page_ = page;
+    return page[(address & (PAGE_SIZE - 1)) >> 2];
+}
+
+void GuestMemory::StoreSlow(uint32_t address, uint32_t value) {
+    uint32_t const page_number = address >> PAGE_BITS;
+    uint32_t *&page = PageEntry(page_number);
+    if (page == nullptr) {
+        if (free_pages_ == 0) {
+            chunks_.emplace_back(new uint32_t[CHUNK_PAGES * PAGE_WORDS]());
+            next_free_page_ = chunks_.back().get();
+            free_pages_ = CHUNK_PAGES;
+        }
+        page = next_free_page_;
+        next_free_page_ += PAGE_WORDS;
+        --free_pages_;
+    }
+    cached_page_number_ = page_number;
+    cached_page_ = page;
+    page[(address & (PAGE_SIZE - 1)) >> 2] = value;
+}
+
+std::vector<std::pair<uint32_t, uint32_t const *>> GuestMemory::Pages() const {
+    std::vector<std::pair<uint32_t, uint32_t const *>> pages;
+    for (uint32_t directory = 0; directory < TABLE_SIZE; ++directory) {
+        if (!directory_[directory]) {
+            continue;
+        }
+        for (uint32_t entry = 0; entry < TABLE_SIZE; ++entry) {
+            if (uint32_t const *page = directory_[directory][entry]) {
+                pages.emplace_back((directory << TABLE_BITS) | entry, page);
+            }
+        }
+    }
+    return pages;
+}
+
+void GuestMemory::AdoptMapping(void *mapping, std::size_t count, uint32_t const *page_numbers) {
+    mappings_.emplace_back(mapping, Unmapper{count * PAGE_SIZE});
+    uint32_t *page = static_cast<uint32_t *>(mapping);
+    for (std::size_t i = 0; i < count; ++i, page += PAGE_WORDS) {
+        PageEntry(page_numbers[i]) = page;
+    }
+    cached_page_number_ = NO_PAGE;
+}
+
+void GuestMemory::LoadImage(std::istream &in) {
+    std::string const text{std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()};
+    for (auto const &segment : ParseImage(text)) {
+        for (std::size_t i = 0; i < segment.words.size(); ++i) {
+            Store(static_cast<uint32_t>((segment.word_address + i) << 2u), segment.words[i]);
+        }
+    }
+}
+
+void GuestMemory::DumpImage(std::ostream &out) const {
+    uint32_t next_word_address = 0;
+    bool first = true;
+    out << std::hex << std::setfill('0');
+    for (auto const &page : Pages()) {
+        if (std::all_of(page.second, page.second + PAGE_WORDS, [](uint32_t word) { return word == 0; })) {
+            continue;
+        }
+        uint32_t const word_address = page.first << (PAGE_BITS - 2);
+        if (first || word_address != next_word_address) {
+            out << '@' << std::setw(8) << word_address << '\n';
+        }
+        for (uint32_t i = 0; i < PAGE_WORDS; ++i) {
+            out << std::setw(8) << page.second[i] << '\n';
+        }
+        next_word_address = word_address + PAGE_WORDS;
+        first = false;
+    }
+    out << std::dec << std::setfill(' ');
+}
+
+} // namespace mips
@@ -38,9 +38,13 @@ std::unique_ptr<Instruction> InstructionFactory::CreateInstruction(
 				RETURN_RTYPE_INSTRUCTION(OR);
 			} else if(data.tokens()[0] == "and") {
 				RETURN_RTYPE_INSTRUCTION(AND);
+			} else if(data.tokens()[0] == "slt") {
+				RETURN_RTYPE_INSTRUCTION(SLT);
             } else if(data.tokens()[0] == "jr") {
             return std::make_unique<JRInstruction>(
                         Instruction::RegisterNameToNumber(data.tokens()[1]));
+            } else if(data.tokens()[0] == "syscall") {
+                return std::make_unique<SYSCALLInstruction>();
             }
         break;
         case Instruction::ADDI:
@@ -55,6 +59,10 @@ std::unique_ptr<Instruction> InstructionFactory::CreateInstruction(
 			RETURN_IMMEDIATE_INSTRUCTION(ANDI);
         case Instruction::SLTI:
             RETURN_IMMEDIATE_INSTRUCTION(SLTI);
+        case Instruction::LUI:
+            return std::make_unique<LUIInstruction>(
+                        Instruction::RegisterNameToNumber(data.tokens()[1]),
+                        static_cast<uint16_t>(std::strtoul(data.tokens()[2].c_str(), nullptr, 0)));
         case Instruction::LW:
 			RETURN_MEMORY_INSTRUCTION(LW);
 		case Instruction::SW:
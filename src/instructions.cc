@@ -33,6 +33,14 @@ Instruction::Register Instruction::RegisterNameToNumber(const std::string &name)
     return ZERO;
 }
 
+char const *Instruction::RegisterNumberToName(Instruction::Register reg) {
+    static constexpr char const *names[] = {"$zero", "$at", "$v0", "$v1", "$a0", "$a1", "$a2", "$a3",
+                                            "$t0", "$t1", "$t2", "$t3", "$t4", "$t5", "$t6", "$t7",
+                                            "$s0", "$s1", "$s2", "$s3", "$s4", "$s5", "$s6", "$s7",
+                                            "$t8", "$t9", "$k0", "$k1", "$gp", "$sp", "$fp", "$ra"};
+    return names[reg & 0x1f];
+}
+
 Instruction::~Instruction() {}
 
 Instruction::Instruction(Instruction::Opcode opcode) : opcode_(opcode) {}
@@ -66,6 +74,10 @@ SLTIInstruction::SLTIInstruction(Instruction::Register rt, Instruction::Register
     ImmediateInstruction(SLTI, rt, rs, imm16) {
 }
 
+LUIInstruction::LUIInstruction(Instruction::Register rt, uint16_t imm16) :
+    ImmediateInstruction(LUI, rt, ZERO, imm16) {
+}
+
 BEQInstruction::BEQInstruction(Instruction::Register rt, Instruction::Register rs, uint16_t imm16) :
     ImmediateInstruction(BEQ, rt, rs, imm16) {
 }
@@ -88,19 +100,19 @@ RTYPEInstruction::RTYPEInstruction(Instruction::Register rd, Instruction::Regist
 uint32_t RTYPEInstruction::GetRepresentation() const { return instruction_; }
 
 ADDInstruction::ADDInstruction(Instruction::Register rd, Instruction::Register rs, Instruction::Register rt, uint8_t shamt)
-    : RTYPEInstruction(rd, rs, rt, shamt, 0x20) {}
+    : RTYPEInstruction(rd, rs, rt, shamt, FUNCT_ADD) {}
 
 SUBInstruction::SUBInstruction(Instruction::Register rd, Instruction::Register rs, Instruction::Register rt, uint8_t shamt)
-    : RTYPEInstruction(rd, rs, rt, shamt, 0x22) {}
+    : RTYPEInstruction(rd, rs, rt, shamt, FUNCT_SUB) {}
 
 ANDInstruction::ANDInstruction(Instruction::Register rd, Instruction::Register rs, Instruction::Register rt, uint8_t shamt)
-    : RTYPEInstruction(rd, rs, rt, shamt, 0x24) {}
+    : RTYPEInstruction(rd, rs, rt, shamt, FUNCT_AND) {}
 
 ORInstruction::ORInstruction(Instruction::Register rd, Instruction::Register rs, Instruction::Register rt, uint8_t shamt)
-    : RTYPEInstruction(rd, rs, rt, shamt, 0x25) {}
+    : RTYPEInstruction(rd, rs, rt, shamt, FUNCT_OR) {}
 
 SLTInstruction::SLTInstruction(Instruction::Register rd, Instruction::Register rs, Instruction::Register rt, uint8_t shamt)
-    : RTYPEInstruction(rd, rs, rt, shamt, 0x2a) {}
+    : RTYPEInstruction(rd, rs, rt, shamt, FUNCT_SLT) {}
 
 LWInstruction::LWInstruction(Instruction::Register rd, uint16_t imm16, Instruction::Register rt)
     : MemoryInstruction(LW, rd, rt, imm16) {}
@@ -120,6 +132,8 @@ JALInstruction::JALInstruction(uint32_t offset) : JumpInstruction(JAL, offset) {
 
 JInstruction::JInstruction(uint32_t offset) : JumpInstruction(J, offset) {}
 
-JRInstruction::JRInstruction(Instruction::Register reg) : RTYPEInstruction(ZERO, reg, ZERO, 0, 0x8) {}
+SYSCALLInstruction::SYSCALLInstruction() : RTYPEInstruction(ZERO, ZERO, ZERO, 0, FUNCT_SYSCALL) {}
+
+JRInstruction::JRInstruction(Instruction::Register reg) : RTYPEInstruction(ZERO, reg, ZERO, 0, FUNCT_JR) {}
 
 } // namespace mips
@@ -0,0 +1,360 @@
+#include "layout.h"
+#include "cfg.h"
+#include "instructions.h"
+#include <algorithm>
+#include <cstdlib>
+#include <limits>
+#include <sstream>
+
+namespace mips {
+
+namespace {
+
+constexpr std::size_t NONE = ControlFlowGraph::NONE;
+
+// How control leaves a block.
+enum Exit : uint8_t {
+    FALLS,    // Into the next instruction, also after a syscall.
+    BRANCH,   // beq or bne: to the target or the next instruction.
+    ALWAYS,   // j, jr or a beq of a register with itself.
+    CALL      // jal, returning to the next instruction.
+};
+
+bool FitsSigned16(int64_t value) {
+    return value >= INT16_MIN && value <= INT16_MAX;
+}
+
+uint32_t Inverted(uint32_t opcode) {
+    return opcode == Instruction::BEQ ? Instruction::BNE : Instruction::BEQ;
+}
+
+char const *BranchName(uint32_t opcode) {
+    return opcode == Instruction::BEQ ? "beq" : "bne";
+}
+
+} // namespace
+
+InvalidProfileException::InvalidProfileException(std::string const &line, uint32_t line_number) {
+    message_ = "Invalid profile line " + std::to_string(line_number) + " \"" + line
+            + "\": expected an address or label of the program and a count.";
+}
+
+std::vector<uint64_t> LayoutOptimizer::ReadProfile(std::istream &in, Parser const &parser) {
+    std::size_t const size = parser.instructions().size();
+    std::vector<uint64_t> counts(size);
+    std::string line;
+    for (uint32_t line_number = 1; std::getline(in, line); ++line_number) {
+        std::istringstream fields(line.substr(0, line.find('#')));
+        std::string key;
+        std::string count;
+        if (!(fields >> key)) {
+            continue;
+        }
+        std::string rest;
+        if (!(fields >> count) || (fields >> rest) || count.find_first_not_of("0123456789") != std::string::npos) {
+            throw InvalidProfileException(line, line_number);
+        }
+        uint64_t index;
+        if (isdigit(static_cast<unsigned char>(key[0]))) {
+            char *end;
+            uint64_t const address = std::strtoull(key.c_str(), &end, 0);
+            index = (address - CODE_SEGMENT_OFFSET) / 4;
+            if (*end != '\0' || address < CODE_SEGMENT_OFFSET || address % 4 != 0 || index >= size) {
+                throw InvalidProfileException(line, line_number);
+            }
+        } else {
+            auto found = parser.labels().find(key);
+            if (found == parser.labels().end() || found->second.first > size) {
+                throw InvalidProfileException(line, line_number);
+            }
+            index = found->second.first - 1;
+            if (index == size) {
+                continue;
+            }
+        }
+        counts[index] += std::strtoull(count.c_str(), nullptr, 10);
+    }
+    return counts;
+}
+
+LayoutOptimizer::LayoutOptimizer(Parser const &parser, std::unordered_map<std::string, uint32_t> const &functions,
+                                 std::vector<uint64_t> const &counts,
+                                 std::vector<Parser::SymbolReference> const &references) {
+    auto const &instructions = parser.instructions();
+    std::size_t const size = instructions.size();
+    if (size == 0) {
+        functions_ = functions;
+        references_ = references;
+        return;
+    }
+    ControlFlowGraph const cfg(instructions, functions);
+    auto const &blocks = cfg.blocks();
+    std::size_t const n = blocks.size();
+    std::size_t const end = n;   // The block index standing for the end of the program.
+    blocks_ = static_cast<uint32_t>(n);
+
+    std::vector<uint64_t> count(n, 0);
+    std::vector<Exit> exit(n);
+    std::vector<std::size_t> taken(n, NONE);
+    std::vector<std::size_t> fall(n, NONE);
+    for (std::size_t b = 0; b < n; ++b) {
+        for (std::size_t i = blocks[b].begin; i < blocks[b].end && i < counts.size(); ++i) {
+            count[b] = std::max(count[b], counts[i]);
+        }
+        std::size_t const last = blocks[b].end - 1;
+        auto const &data = instructions[last];
+        uint32_t const opcode = data.opcode();
+        if (opcode == Instruction::BEQ || opcode == Instruction::BNE) {
+            exit[b] = opcode == Instruction::BEQ && data.tokens()[1] == data.tokens()[2] ? ALWAYS : BRANCH;
+        } else if (opcode == Instruction::J || (opcode == Instruction::RTYPE && data.tokens()[0] == "jr")) {
+            exit[b] = ALWAYS;
+        } else {
+            exit[b] = opcode == Instruction::JAL ? CALL : FALLS;
+        }
+        if (opcode == Instruction::BEQ || opcode == Instruction::BNE || opcode == Instruction::J) {
+            int64_t const target = cfg.TargetOf(last);
+            if (target >= 0 && target < static_cast<int64_t>(size)) {
+                taken[b] = cfg.block_of(static_cast<std::size_t>(target));
+            }
+        }
+        if (exit[b] != ALWAYS) {
+            fall[b] = blocks[b].end < size ? cfg.block_of(blocks[b].end) : end;
+        }
+    }
+
+    auto const weight = [&](std::size_t b, std::size_t s) -> uint64_t {
+        if (exit[b] != BRANCH || taken[b] == NONE || taken[b] == fall[b]) {
+            return count[b];
+        }
+        std::size_t const other = s == taken[b] ? fall[b] : taken[b];
+        if (s != end && blocks[s].predecessors.size() == 1) {
+            return std::min(count[b], count[s]);
+        }
+        if (other != end && blocks[other].predecessors.size() == 1) {
+            return count[b] - std::min(count[b], count[other]);
+        }
+        return std::min(count[b], s == end ? count[b] : count[s]);
+    };
+
+    // Chains of blocks that stay adjacent, grown along the heaviest edges
+    // first; on equal weight fall-through edges win, keeping the source order.
+    std::size_t const orphans = cfg.functions().size();
+    auto const group = [&](std::size_t b) {
+        return blocks[b].function == NONE ? orphans : blocks[b].function;
+    };
+    std::vector<bool> fixed_head(n, false);
+    fixed_head[0] = true;
+    for (auto const &function : cfg.functions()) {
+        fixed_head[function.entry] = true;
+    }
+    struct Edge {
+        uint64_t weight;
+        bool fall;
+        std::size_t from;
+        std::size_t to;
+    };
+    std::vector<Edge> edges;
+    for (std::size_t b = 0; b < n; ++b) {
+        if (fall[b] != NONE && fall[b] != end) {
+            edges.push_back({exit[b] == CALL ? std::numeric_limits<uint64_t>::max() : weight(b, fall[b]), true, b,
+                             fall[b]});
+        }
+        if (exit[b] != CALL && taken[b] != NONE && taken[b] != fall[b]) {
+            edges.push_back({weight(b, taken[b]), false, b, taken[b]});
+        }
+    }
+    std::stable_sort(std::begin(edges), std::end(edges), [](Edge const &a, Edge const &b) {
+        return a.weight != b.weight ? a.weight > b.weight : a.fall && !b.fall;
+    });
+    std::vector<std::vector<std::size_t>> chains(n);
+    std::vector<std::size_t> chain_of(n);
+    for (std::size_t b = 0; b < n; ++b) {
+        chains[b] = {b};
+        chain_of[b] = b;
+    }
+    for (auto const &edge : edges) {
+        std::size_t const from = chain_of[edge.from];
+        std::size_t const to = chain_of[edge.to];
+        if (from == to || fixed_head[edge.to] || group(edge.from) != group(edge.to)
+            || chains[from].back() != edge.from || chains[to].front() != edge.to) {
+            continue;
+        }
+        for (std::size_t b : chains[to]) {
+            chain_of[b] = from;
+        }
+        chains[from].insert(std::end(chains[from]), std::begin(chains[to]), std::end(chains[to]));
+        chains[to].clear();
+    }
+
+    // The chain of the first block, then executed chains by function and
+    // weight, then every chain that never ran in source order.
+    std::vector<uint64_t> chain_weight(n, 0);
+    std::vector<uint64_t> group_weight(orphans + 1, 0);
+    for (std::size_t b = 0; b < n; ++b) {
+        chain_weight[chain_of[b]] = std::max(chain_weight[chain_of[b]], count[b]);
+        group_weight[group(b)] += count[b];
+    }
+    std::vector<std::size_t> hot;
+    std::vector<std::size_t> cold;
+    for (std::size_t c = 0; c < n; ++c) {
+        if (!chains[c].empty() && c != chain_of[0]) {
+            (chain_weight[c] != 0 ? hot : cold).push_back(c);
+        }
+    }
+    auto const is_entry = [&](std::size_t c) -> bool { return fixed_head[chains[c].front()]; };
+    std::stable_sort(std::begin(hot), std::end(hot), [&](std::size_t a, std::size_t b) {
+        std::size_t const group_a = group(chains[a].front());
+        std::size_t const group_b = group(chains[b].front());
+        if (group_a != group_b) {
+            return group_weight[group_a] != group_weight[group_b] ? group_weight[group_a] > group_weight[group_b]
+                                                                  : group_a < group_b;
+        }
+        if (is_entry(a) != is_entry(b)) {
+            return is_entry(a);
+        }
+        return chain_weight[a] > chain_weight[b];
+    });
+    std::vector<std::size_t> order = chains[chain_of[0]];
+    for (auto const *list : {&hot, &cold}) {
+        for (std::size_t c : *list) {
+            order.insert(std::end(order), std::begin(chains[c]), std::end(chains[c]));
+        }
+    }
+
+    // What each block needs now that its neighbours changed.
+    std::vector<bool> invert(n, false);
+    std::vector<bool> jump(n, false);
+    std::vector<bool> drop(n, false);
+    std::vector<bool> long_form(n, false);
+    for (std::size_t i = 0; i < n; ++i) {
+        std::size_t const b = order[i];
+        std::size_t const next = i + 1 < n ? order[i + 1] : end;
+        if (fall[b] == NONE && taken[b] == next && instructions[blocks[b].end - 1].opcode() != Instruction::RTYPE) {
+            drop[b] = true;
+            ++jumps_removed_;
+        }
+        if (fall[b] == NONE || fall[b] == next) {
+            continue;
+        }
+        if (exit[b] == BRANCH && taken[b] == next) {
+            invert[b] = true;
+            ++inverted_;
+        } else {
+            jump[b] = true;
+            ++jumps_added_;
+        }
+    }
+    for (std::size_t b = 0; b < n; ++b) {
+        uint64_t const into_fall = fall[b] == NONE ? 0 : weight(b, fall[b]);
+        uint64_t const into_taken = taken[b] == NONE || taken[b] == fall[b] ? 0 : weight(b, taken[b]);
+        if (exit[b] == ALWAYS && instructions[blocks[b].end - 1].opcode() != Instruction::RTYPE) {
+            taken_before_ += count[b];
+            taken_after_ += drop[b] ? 0 : count[b];
+        } else if (exit[b] == BRANCH) {
+            taken_before_ += into_taken;
+            taken_after_ += invert[b] ? into_fall : into_taken + (jump[b] ? into_fall : 0);
+        } else if (jump[b]) {
+            taken_after_ += count[b];
+        }
+    }
+
+    // Lays out again until no branch needs its long form.
+    std::vector<int64_t> start(n + 1);
+    auto const new_index = [&](int64_t index) -> int64_t {
+        if (index < 0) {
+            return index;
+        }
+        if (index >= static_cast<int64_t>(size)) {
+            return index - static_cast<int64_t>(size) + start[end];
+        }
+        std::size_t const b = cfg.block_of(static_cast<std::size_t>(index));
+        return start[b] + index - static_cast<int64_t>(blocks[b].begin);
+    };
+    auto const new_address = [&](int64_t address) -> int64_t {
+        if (address < CODE_SEGMENT_OFFSET || (address - CODE_SEGMENT_OFFSET) % 4 != 0) {
+            return address;
+        }
+        return CODE_SEGMENT_OFFSET + new_index((address - CODE_SEGMENT_OFFSET) / 4) * 4;
+    };
+    auto const branch_target = [&](std::size_t b) -> int64_t {
+        return invert[b] ? (fall[b] == end ? start[end] : start[fall[b]])
+                         : new_index(cfg.TargetOf(blocks[b].end - 1));
+    };
+    for (bool changed = true; changed;) {
+        int64_t position = 0;
+        for (std::size_t b : order) {
+            start[b] = position;
+            position += static_cast<int64_t>(blocks[b].end - blocks[b].begin) + jump[b] - drop[b]
+                    + (long_form[b] && exit[b] == BRANCH);
+        }
+        start[end] = position;
+        changed = false;
+        for (std::size_t b = 0; b < n; ++b) {
+            bool const branches = instructions[blocks[b].end - 1].opcode() == Instruction::BEQ
+                    || instructions[blocks[b].end - 1].opcode() == Instruction::BNE;
+            int64_t const at = start[b] + static_cast<int64_t>(blocks[b].end - blocks[b].begin) - 1;
+            if (branches && !drop[b] && !long_form[b] && !FitsSigned16(branch_target(b) - at - 1)) {
+                long_form[b] = true;
+                changed = true;
+            }
+        }
+    }
+
+    instructions_.reserve(static_cast<std::size_t>(start[end]));
+    // Added jumps take the line of the instruction they follow.
+    auto const jump_to = [&](int64_t index, Parser::InstructionData const &from) {
+        instructions_.emplace_back(Instruction::J, std::vector<std::string>{
+                "j", std::to_string(CODE_SEGMENT_OFFSET + index * 4)}, from.line_number(), from.file());
+    };
+    for (std::size_t b : order) {
+        for (std::size_t i = blocks[b].begin; i < blocks[b].end; ++i) {
+            if (drop[b] && i + 1 == blocks[b].end) {
+                break;
+            }
+            auto const &data = instructions[i];
+            std::vector<std::string> tokens = data.tokens();
+            uint32_t opcode = data.opcode();
+            if (opcode == Instruction::BEQ || opcode == Instruction::BNE) {
+                int64_t const target = branch_target(b);
+                if (invert[b]) {
+                    opcode = Inverted(opcode);
+                }
+                if (long_form[b]) {
+                    // As the Parser relaxes it: the opposite branch skips a j to the target.
+                    if (exit[b] == BRANCH) {
+                        instructions_.emplace_back(Inverted(opcode), std::vector<std::string>{
+                                BranchName(Inverted(opcode)), tokens[1], tokens[2], "1"}, data.line_number(),
+                                data.file());
+                    }
+                    jump_to(target, data);
+                    continue;
+                }
+                tokens[0] = BranchName(opcode);
+                tokens[3] = std::to_string(target - static_cast<int64_t>(instructions_.size()) - 1);
+            } else if (opcode == Instruction::J || opcode == Instruction::JAL) {
+                tokens[1] = std::to_string(new_address(std::strtoll(tokens[1].c_str(), nullptr, 0)));
+            }
+            instructions_.emplace_back(opcode, std::move(tokens), data.line_number(), data.file());
+        }
+        if (jump[b]) {
+            jump_to(fall[b] == end ? start[end] : start[fall[b]], instructions[blocks[b].end - 1]);
+        }
+    }
+
+    for (auto const &function : functions) {
+        functions_.emplace(function.first, static_cast<uint32_t>(new_address(function.second)));
+    }
+    // lui, ori, lw and sw keep their offset within their block.
+    for (auto reference : references) {
+        reference.instruction = static_cast<uint32_t>(new_index(reference.instruction));
+        references_.push_back(std::move(reference));
+    }
+}
+
+void LayoutOptimizer::WriteReport(std::ostream &out) const {
+    out << "Laid out " << blocks_ << " basic blocks: " << inverted_ << " branches inverted, " << jumps_added_
+        << " jumps added, " << jumps_removed_ << " jumps removed, estimated taken branches and jumps "
+        << taken_before_ << " -> " << taken_after_ << ".\n";
+}
+
+} // namespace mips
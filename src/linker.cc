@@ -0,0 +1,240 @@
+#include "linker.h"
+#include "assembler.h"
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <thread>
+
+namespace mips {
+
+namespace {
+
+constexpr std::size_t RELOCATION_CHUNK = 1u << 16u;
+constexpr std::size_t FORMAT_CHUNK = 1u << 16u;
+
+std::string ToHex(uint32_t value) {
+    char buffer[11];
+    std::snprintf(buffer, sizeof(buffer), "0x%08x", value);
+    return buffer;
+}
+
+// Calls function(i) for every i below count on up to threads threads, which
+// take the next index as they finish. Rethrows the exception of the lowest
+// failing index, so errors are reported deterministically.
+template <typename Function>
+void ParallelFor(std::size_t count, unsigned threads, Function const &function) {
+    std::vector<std::exception_ptr> errors(count);
+    std::atomic<std::size_t> next{0};
+    auto work = [&] {
+        for (std::size_t i; (i = next.fetch_add(1, std::memory_order_relaxed)) < count;) {
+            try {
+                function(i);
+            } catch (...) {
+                errors[i] = std::current_exception();
+            }
+        }
+    };
+    std::vector<std::thread> workers;
+    for (unsigned t = 1; t < std::min<std::size_t>(threads, count); ++t) {
+        workers.emplace_back(work);
+    }
+    work();
+    for (auto &worker : workers) {
+        worker.join();
+    }
+    for (auto const &error : errors) {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+}
+
+// Open addressing table from function name to (object + 1) << 32 | symbol.
+// Slots only go from empty to full, with one compare-and-swap, so inserts
+// from any number of threads need no locks; names are compared in place in
+// the mapped objects.
+class GlobalSymbolTable {
+public:
+    GlobalSymbolTable(std::vector<std::unique_ptr<ObjectFile>> const &objects, std::size_t count)
+            : objects_(objects) {
+        std::size_t capacity = 16;
+        while (capacity < count * 2) {
+            capacity *= 2;
+        }
+        slots_.reset(new std::atomic<uint64_t>[capacity]);
+        for (std::size_t i = 0; i < capacity; ++i) {
+            slots_[i].store(0, std::memory_order_relaxed);
+        }
+        mask_ = capacity - 1;
+    }
+
+    // Returns 0, or the entry that already holds the same name.
+    uint64_t Insert(uint32_t object, uint32_t symbol) {
+        uint64_t const entry = (uint64_t{object} + 1) << 32u | symbol;
+        std::string_view const name = NameOf(entry);
+        for (std::size_t i = std::hash<std::string_view>()(name) & mask_;; i = (i + 1) & mask_) {
+            uint64_t current = 0;
+            if (slots_[i].compare_exchange_strong(current, entry, std::memory_order_acq_rel)) {
+                return 0;
+            }
+            if (NameOf(current) == name) {
+                return current;
+            }
+        }
+    }
+
+    // Returns 0 when the name is not in the table. Only valid once inserts are done.
+    uint64_t Find(std::string_view name) const {
+        for (std::size_t i = std::hash<std::string_view>()(name) & mask_;; i = (i + 1) & mask_) {
+            uint64_t const current = slots_[i].load(std::memory_order_relaxed);
+            if (current == 0 || NameOf(current) == name) {
+                return current;
+            }
+        }
+    }
+
+    static uint32_t ObjectOf(uint64_t entry) { return static_cast<uint32_t>(entry >> 32u) - 1; }
+    static uint32_t SymbolOf(uint64_t entry) { return static_cast<uint32_t>(entry); }
+
+private:
+    std::string_view NameOf(uint64_t entry) const {
+        ObjectFile const &object = *objects_[ObjectOf(entry)];
+        return object.name(object.symbols()[SymbolOf(entry)]);
+    }
+
+    std::vector<std::unique_ptr<ObjectFile>> const &objects_;
+    std::unique_ptr<std::atomic<uint64_t>[]> slots_;
+    std::size_t mask_;
+};
+
+} // namespace
+
+LinkException::LinkException(std::string const &info) {
+    message_ = "Link failed: " + info;
+}
+
+Linker::Linker(std::vector<std::string> const &object_paths, uint32_t base, unsigned threads)
+        : base_(base), threads_(threads != 0 ? threads : std::max(1u, std::thread::hardware_concurrency())) {
+    if ((base & 3u) != 0) {
+        throw LinkException("base address " + ToHex(base) + " is not word aligned.");
+    }
+    objects_.resize(object_paths.size());
+    ParallelFor(object_paths.size(), threads_, [&](std::size_t i) {
+        objects_[i] = std::make_unique<ObjectFile>(object_paths[i]);
+    });
+
+    uint64_t words = 0;
+    std::size_t globals = 0;
+    for (auto const &object : objects_) {
+        offsets_.push_back(static_cast<uint32_t>(words));
+        words += object->word_count();
+        for (uint32_t s = 0; s < object->symbol_count(); ++s) {
+            ObjectSymbol const &symbol = object->symbols()[s];
+            globals += (symbol.flags & ObjectSymbol::DEFINED) && (symbol.flags & ObjectSymbol::GLOBAL);
+        }
+        relocation_count_ += object->relocation_count();
+    }
+    if (base + words * 4 > 0x100000000ull) {
+        throw LinkException("program does not fit above " + ToHex(base) + ".");
+    }
+    global_count_ = globals;
+
+    GlobalSymbolTable table(objects_, globals);
+    ParallelFor(objects_.size(), threads_, [&](std::size_t o) {
+        ObjectFile const &object = *objects_[o];
+        for (uint32_t s = 0; s < object.symbol_count(); ++s) {
+            ObjectSymbol const &symbol = object.symbols()[s];
+            if (!(symbol.flags & ObjectSymbol::DEFINED) || !(symbol.flags & ObjectSymbol::GLOBAL)) {
+                continue;
+            }
+            if (uint64_t const other = table.Insert(static_cast<uint32_t>(o), s)) {
+                throw LinkException("function \"" + std::string(object.name(symbol)) + "\" is defined in both "
+                                    + objects_[GlobalSymbolTable::ObjectOf(other)]->file_path() + " and "
+                                    + object.file_path() + ".");
+            }
+        }
+    });
+
+    code_.resize(static_cast<std::size_t>(words));
+    ParallelFor(objects_.size(), threads_, [&](std::size_t o) {
+        std::memcpy(code_.data() + offsets_[o], objects_[o]->words(), objects_[o]->word_count() * 4u);
+    });
+
+    std::vector<std::pair<uint32_t, uint32_t>> chunks;
+    for (uint32_t o = 0; o < objects_.size(); ++o) {
+        for (uint32_t begin = 0; begin < objects_[o]->relocation_count(); begin += RELOCATION_CHUNK) {
+            chunks.emplace_back(o, begin);
+        }
+    }
+    ParallelFor(chunks.size(), threads_, [&](std::size_t c) {
+        uint32_t const o = chunks[c].first;
+        ObjectFile const &object = *objects_[o];
+        uint32_t const end = static_cast<uint32_t>(
+                std::min<std::size_t>(object.relocation_count(), chunks[c].second + RELOCATION_CHUNK));
+        for (uint32_t r = chunks[c].second; r < end; ++r) {
+            ObjectRelocation const &relocation = object.relocations()[r];
+            ObjectSymbol const &symbol = object.symbols()[relocation.symbol];
+            uint32_t address;
+            if (symbol.flags & ObjectSymbol::DEFINED) {
+                address = base_ + (offsets_[o] + symbol.value) * 4;
+            } else if (uint64_t const entry = table.Find(object.name(symbol))) {
+                uint32_t const defining = GlobalSymbolTable::ObjectOf(entry);
+                address = base_ + (offsets_[defining]
+                                   + objects_[defining]->symbols()[GlobalSymbolTable::SymbolOf(entry)].value) * 4;
+            } else {
+                throw LinkException("undefined function \"" + std::string(object.name(symbol))
+                                    + "\" referenced in " + object.file_path() + ".");
+            }
+
+            uint32_t const index = offsets_[o] + relocation.offset;
+            uint32_t &word = code_[index];
+            switch (relocation.type) {
+            case Parser::SymbolReference::JUMP: {
+                uint32_t const site = base_ + index * 4;
+                if (((site ^ address) & 0xfc000000u) != 0) {
+                    throw LinkException("jump at " + ToHex(site) + " in " + object.file_path()
+                                        + " cannot reach " + ToHex(address) + ".");
+                }
+                word = (word & 0xfc000000u) | (address & 0x03ffffffu);
+                break;
+            }
+            case Parser::SymbolReference::UPPER:
+                word = (word & 0xffff0000u) | (address >> 16u);
+                break;
+            default:
+                word = (word & 0xffff0000u) | (address & 0xffffu);
+                break;
+            }
+        }
+    });
+}
+
+void Linker::WriteImage(std::string const &file_path, bool binary) const {
+    std::ofstream file(file_path, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+        throw FileNotFoundException(file_path);
+    }
+    if (binary) {
+        file.write(reinterpret_cast<char const *>(code_.data()), static_cast<std::streamsize>(code_.size() * 4));
+        return;
+    }
+    // Every line is eight digits and a newline, so chunks format independently.
+    static constexpr char DIGITS[] = "0123456789abcdef";
+    std::vector<char> text(code_.size() * 9);
+    ParallelFor((code_.size() + FORMAT_CHUNK - 1) / FORMAT_CHUNK, threads_, [&](std::size_t c) {
+        std::size_t const end = std::min(code_.size(), (c + 1) * FORMAT_CHUNK);
+        for (std::size_t i = c * FORMAT_CHUNK; i < end; ++i) {
+            char *line = text.data() + i * 9;
+            for (int digit = 0; digit < 8; ++digit) {
+                line[digit] = DIGITS[(code_[i] >> (28 - 4 * digit)) & 0xfu];
+            }
+            line[8] = '\n';
+        }
+    });
+    file.write(text.data(), static_cast<std::streamsize>(text.size()));
+}
+
+} // namespace mips
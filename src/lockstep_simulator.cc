@@ -0,0 +1,367 @@
+#include "lockstep_simulator.h"
+#include <limits>
+
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+namespace mips {
+
+namespace {
+
+enum class AluOp { ADD, SUB, AND, OR, SLT };
+
+template <AluOp OP>
+inline uint32_t ScalarAlu(uint32_t a, uint32_t b) {
+    switch (OP) {
+    case AluOp::ADD: return a + b;
+    case AluOp::SUB: return a - b;
+    case AluOp::AND: return a & b;
+    case AluOp::OR:  return a | b;
+    case AluOp::SLT: return static_cast<int32_t>(a) < static_cast<int32_t>(b);
+    }
+    return 0;
+}
+
+#if defined(__AVX512F__)
+template <AluOp OP>
+inline __m512i VectorAlu(__m512i a, __m512i b) {
+    switch (OP) {
+    case AluOp::ADD: return _mm512_add_epi32(a, b);
+    case AluOp::SUB: return _mm512_sub_epi32(a, b);
+    case AluOp::AND: return _mm512_and_si512(a, b);
+    case AluOp::OR:  return _mm512_or_si512(a, b);
+    case AluOp::SLT: return _mm512_maskz_set1_epi32(_mm512_cmplt_epi32_mask(a, b), 1);
+    }
+    return a;
+}
+#endif
+
+#if defined(__AVX2__)
+template <AluOp OP>
+inline __m256i VectorAlu(__m256i a, __m256i b) {
+    switch (OP) {
+    case AluOp::ADD: return _mm256_add_epi32(a, b);
+    case AluOp::SUB: return _mm256_sub_epi32(a, b);
+    case AluOp::AND: return _mm256_and_si256(a, b);
+    case AluOp::OR:  return _mm256_or_si256(a, b);
+    case AluOp::SLT: return _mm256_srli_epi32(_mm256_cmpgt_epi32(b, a), 31);
+    }
+    return a;
+}
+
+// Expands the low 8 bits of a lane mask into a vector of all-ones/all-zeros lanes.
+inline __m256i MaskVector(uint32_t bits) {
+    __m256i const lane_bits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+    __m256i const selected = _mm256_and_si256(_mm256_set1_epi32(static_cast<int>(bits)), lane_bits);
+    return _mm256_cmpeq_epi32(selected, lane_bits);
+}
+#endif
+
+// dst[l] = OP(a[l], b[l]) for every lane l selected by mask.
+template <std::size_t Lanes, AluOp OP>
+void ExecuteAlu(uint32_t *dst, uint32_t const *a, uint32_t const *b, uint32_t mask) {
+#if defined(__AVX512F__)
+    if constexpr (Lanes % 16 == 0) {
+        for (std::size_t i = 0; i < Lanes; i += 16) {
+            __m512i const va = _mm512_loadu_si512(a + i);
+            __m512i const vb = _mm512_loadu_si512(b + i);
+            __m512i const vd = _mm512_loadu_si512(dst + i);
+            __mmask16 const k = static_cast<__mmask16>(mask >> i);
+            _mm512_storeu_si512(dst + i, _mm512_mask_blend_epi32(k, vd, VectorAlu<OP>(va, vb)));
+        }
+        return;
+    }
+#endif
+#if defined(__AVX2__)
+    if constexpr (Lanes % 8 == 0) {
+        for (std::size_t i = 0; i < Lanes; i += 8) {
+            __m256i const va = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(a + i));
+            __m256i const vb = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(b + i));
+            __m256i const vd = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(dst + i));
+            __m256i const result = _mm256_blendv_epi8(vd, VectorAlu<OP>(va, vb), MaskVector(mask >> i));
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), result);
+        }
+        return;
+    }
+#endif
+    for (std::size_t l = 0; l < Lanes; ++l) {
+        uint32_t const result = ScalarAlu<OP>(a[l], b[l]);
+        dst[l] = ((mask >> l) & 1u) ? result : dst[l];
+    }
+}
+
+// dst[l] = memory[indices[l]] for every lane l selected by mask.
+template <std::size_t Lanes>
+void Gather(uint32_t *dst, uint32_t const *memory, uint32_t const *indices, uint32_t mask) {
+#if defined(__AVX512F__)
+    if constexpr (Lanes % 16 == 0) {
+        for (std::size_t i = 0; i < Lanes; i += 16) {
+            __m512i const vi = _mm512_loadu_si512(indices + i);
+            __m512i const vd = _mm512_loadu_si512(dst + i);
+            __mmask16 const k = static_cast<__mmask16>(mask >> i);
+            _mm512_storeu_si512(dst + i, _mm512_mask_i32gather_epi32(vd, k, vi, memory, 4));
+        }
+        return;
+    }
+#endif
+#if defined(__AVX2__)
+    if constexpr (Lanes % 8 == 0) {
+        for (std::size_t i = 0; i < Lanes; i += 8) {
+            __m256i const vi = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(indices + i));
+            __m256i const vd = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(dst + i));
+            __m256i const result = _mm256_mask_i32gather_epi32(
+                        vd, reinterpret_cast<int const *>(memory), vi, MaskVector(mask >> i), 4);
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), result);
+        }
+        return;
+    }
+#endif
+    for (std::size_t l = 0; l < Lanes; ++l) {
+        if ((mask >> l) & 1u) {
+            dst[l] = memory[indices[l]];
+        }
+    }
+}
+
+// memory[indices[l]] = values[l] for every lane l selected by mask. AVX2 has
+// no scatter, so only AVX-512 gets a vector path.
+template <std::size_t Lanes>
+void Scatter(uint32_t *memory, uint32_t const *indices, uint32_t const *values, uint32_t mask) {
+#if defined(__AVX512F__)
+    if constexpr (Lanes % 16 == 0) {
+        for (std::size_t i = 0; i < Lanes; i += 16) {
+            __m512i const vi = _mm512_loadu_si512(indices + i);
+            __m512i const vv = _mm512_loadu_si512(values + i);
+            _mm512_mask_i32scatter_epi32(memory, static_cast<__mmask16>(mask >> i), vi, vv, 4);
+        }
+        return;
+    }
+#endif
+    for (std::size_t l = 0; l < Lanes; ++l) {
+        if ((mask >> l) & 1u) {
+            memory[indices[l]] = values[l];
+        }
+    }
+}
+
+} // namespace
+
+template <std::size_t Lanes>
+LockstepSimulator<Lanes>::LockstepSimulator(std::vector<uint32_t> code, uint32_t memory_size)
+        : code_(std::move(code)), memory_(static_cast<std::size_t>(memory_size / 4) * Lanes),
+          memory_words_(memory_size / 4), code_end_(static_cast<uint32_t>(code_.size() * 4)),
+          active_(code_.empty() ? 0 : static_cast<uint32_t>((1ull << Lanes) - 1)) {
+    for (std::size_t l = 0; l < Lanes; ++l) {
+        pc_[l] = CODE_SEGMENT_OFFSET;
+        registers_[Instruction::SP][l] = memory_size & ~3u;
+    }
+}
+
+template <std::size_t Lanes>
+void LockstepSimulator<Lanes>::set_active_lanes(std::size_t count) {
+    if (count < Lanes) {
+        active_ &= static_cast<uint32_t>((1ull << count) - 1);
+    }
+}
+
+template <std::size_t Lanes>
+void LockstepSimulator<Lanes>::set_reg(std::size_t lane, Instruction::Register reg, uint32_t value) {
+    if (reg != Instruction::ZERO) {
+        registers_[reg][lane] = value;
+    }
+}
+
+template <std::size_t Lanes>
+uint32_t LockstepSimulator<Lanes>::memory(std::size_t lane, uint32_t address) const {
+    if ((address & 3u) != 0 || address / 4 >= memory_words_) {
+        throw MemoryAccessException(address, pc_[lane]);
+    }
+    return memory_[static_cast<std::size_t>(address / 4) * Lanes + lane];
+}
+
+template <std::size_t Lanes>
+uint32_t LockstepSimulator<Lanes>::NextMask(uint32_t *pc) const {
+    uint32_t min_pc = std::numeric_limits<uint32_t>::max();
+    for (std::size_t l = 0; l < Lanes; ++l) {
+        if (((active_ >> l) & 1u) && pc_[l] < min_pc) {
+            min_pc = pc_[l];
+        }
+    }
+    uint32_t mask = 0;
+    for (std::size_t l = 0; l < Lanes; ++l) {
+        mask |= static_cast<uint32_t>(pc_[l] == min_pc) << l;
+    }
+    *pc = min_pc;
+    return mask & active_;
+}
+
+template <std::size_t Lanes>
+void LockstepSimulator<Lanes>::ComputeIndices(uint32_t const *base, uint32_t offset, uint32_t mask,
+                                              uint32_t *indices) const {
+    for (std::size_t l = 0; l < Lanes; ++l) {
+        uint32_t const address = base[l] + offset;
+        bool const selected = (mask >> l) & 1u;
+        if (selected && ((address & 3u) != 0 || address / 4 >= memory_words_)) {
+            throw MemoryAccessException(address, pc_[l]);
+        }
+        indices[l] = selected ? (address / 4) * static_cast<uint32_t>(Lanes) + static_cast<uint32_t>(l)
+                              : static_cast<uint32_t>(l);
+    }
+}
+
+template <std::size_t Lanes>
+bool LockstepSimulator<Lanes>::Step() {
+    if (active_ == 0) {
+        return false;
+    }
+
+    uint32_t pc;
+    uint32_t const mask = NextMask(&pc);
+    uint32_t const word = code_[(pc - CODE_SEGMENT_OFFSET) / 4];
+    uint32_t const rs = Instruction::RsOf(word);
+    uint32_t const rt = Instruction::RtOf(word);
+    uint32_t next_pc = pc + 4;
+    bool per_lane_target = false;
+
+    alignas(64) uint32_t operand[Lanes];
+    auto splat = [&operand](uint32_t value) {
+        for (std::size_t l = 0; l < Lanes; ++l) {
+            operand[l] = value;
+        }
+        return operand;
+    };
+
+    switch (Instruction::OpcodeOf(word)) {
+    case Instruction::RTYPE: {
+        uint32_t *dst = registers_[Instruction::RdOf(word)];
+        uint32_t const *a = registers_[rs];
+        uint32_t const *b = registers_[rt];
+        bool const discard = Instruction::RdOf(word) == Instruction::ZERO;
+        switch (Instruction::FunctOf(word)) {
+        case Instruction::FUNCT_ADD:
+            if (!discard) ExecuteAlu<Lanes, AluOp::ADD>(dst, a, b, mask);
+            break;
+        case Instruction::FUNCT_SUB:
+            if (!discard) ExecuteAlu<Lanes, AluOp::SUB>(dst, a, b, mask);
+            break;
+        case Instruction::FUNCT_AND:
+            if (!discard) ExecuteAlu<Lanes, AluOp::AND>(dst, a, b, mask);
+            break;
+        case Instruction::FUNCT_OR:
+            if (!discard) ExecuteAlu<Lanes, AluOp::OR>(dst, a, b, mask);
+            break;
+        case Instruction::FUNCT_SLT:
+            if (!discard) ExecuteAlu<Lanes, AluOp::SLT>(dst, a, b, mask);
+            break;
+        case Instruction::FUNCT_JR:
+            for (std::size_t l = 0; l < Lanes; ++l) {
+                if ((mask >> l) & 1u) {
+                    pc_[l] = registers_[rs][l];
+                }
+            }
+            per_lane_target = true;
+            break;
+        default:
+            throw InvalidInstructionException(word, pc);
+        }
+        break;
+    }
+    case Instruction::ADDI:
+        if (rt != Instruction::ZERO) {
+            ExecuteAlu<Lanes, AluOp::ADD>(registers_[rt], registers_[rs],
+                                          splat(Instruction::SignedImm16Of(word)), mask);
+        }
+        break;
+    case Instruction::ANDI:
+        if (rt != Instruction::ZERO) {
+            ExecuteAlu<Lanes, AluOp::AND>(registers_[rt], registers_[rs],
+                                          splat(Instruction::Imm16Of(word)), mask);
+        }
+        break;
+    case Instruction::ORI:
+        if (rt != Instruction::ZERO) {
+            ExecuteAlu<Lanes, AluOp::OR>(registers_[rt], registers_[rs],
+                                         splat(Instruction::Imm16Of(word)), mask);
+        }
+        break;
+    case Instruction::SLTI:
+        if (rt != Instruction::ZERO) {
+            ExecuteAlu<Lanes, AluOp::SLT>(registers_[rt], registers_[rs],
+                                          splat(Instruction::SignedImm16Of(word)), mask);
+        }
+        break;
+    case Instruction::LUI:
+        if (rt != Instruction::ZERO) {
+            ExecuteAlu<Lanes, AluOp::OR>(registers_[rt], registers_[Instruction::ZERO],
+                                         splat(Instruction::Imm16Of(word) << 16u), mask);
+        }
+        break;
+    case Instruction::LW: {
+        alignas(64) uint32_t indices[Lanes];
+        ComputeIndices(registers_[rs], Instruction::SignedImm16Of(word), mask, indices);
+        if (rt != Instruction::ZERO) {
+            Gather<Lanes>(registers_[rt], memory_.data(), indices, mask);
+        }
+        break;
+    }
+    case Instruction::SW: {
+        alignas(64) uint32_t indices[Lanes];
+        ComputeIndices(registers_[rs], Instruction::SignedImm16Of(word), mask, indices);
+        Scatter<Lanes>(memory_.data(), indices, registers_[rt], mask);
+        break;
+    }
+    case Instruction::BEQ:
+    case Instruction::BNE: {
+        bool const equal_taken = Instruction::OpcodeOf(word) == Instruction::BEQ;
+        uint32_t const target = next_pc + (Instruction::SignedImm16Of(word) << 2u);
+        for (std::size_t l = 0; l < Lanes; ++l) {
+            if ((mask >> l) & 1u) {
+                bool const equal = registers_[rs][l] == registers_[rt][l];
+                pc_[l] = (equal == equal_taken) ? target : next_pc;
+            }
+        }
+        per_lane_target = true;
+        break;
+    }
+    case Instruction::JAL:
+        for (std::size_t l = 0; l < Lanes; ++l) {
+            if ((mask >> l) & 1u) {
+                registers_[Instruction::RA][l] = next_pc;
+            }
+        }
+        next_pc = (pc & 0xfc000000u) | Instruction::TargetOf(word);
+        break;
+    case Instruction::J:
+        next_pc = (pc & 0xfc000000u) | Instruction::TargetOf(word);
+        break;
+    default:
+        throw InvalidInstructionException(word, pc);
+    }
+
+    for (std::size_t l = 0; l < Lanes; ++l) {
+        if ((mask >> l) & 1u) {
+            if (!per_lane_target) {
+                pc_[l] = next_pc;
+            }
+            if (pc_[l] - CODE_SEGMENT_OFFSET >= code_end_) {
+                active_ &= ~(1u << l);
+            }
+        }
+    }
+    return true;
+}
+
+template <std::size_t Lanes>
+uint64_t LockstepSimulator<Lanes>::Run(uint64_t max_steps) {
+    uint64_t steps = 0;
+    while (steps < max_steps && Step()) {
+        ++steps;
+    }
+    return steps;
+}
+
+template class LockstepSimulator<8>;
+template class LockstepSimulator<16>;
+
+} // namespace mips
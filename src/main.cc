@@ -1,26 +1,361 @@
 #include "assembler.h"
+#include "cfg.h"
+#include "lockstep_simulator.h"
+#include "profiler.h"
+#include "simulator.h"
+#include "syscalls.h"
+#include "timing.h"
+#include "trace.h"
 #include <iostream>
 #include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace {
+
+constexpr uint64_t DEFAULT_MAX_STEPS = 100000000;
+
+void PrintUsage() {
+	std::cerr << "Usage: assembler <input_file> -o <output_file> [-d <data_file>]\n";
+	std::cerr << "       assembler <input_file> -c -o <object_file>\n";
+	std::cerr << "       assembler <input_file> [--listing <listing_file>] [--index <index_file>]\n";
+	std::cerr << "       assembler <input_file> --run [--max-steps <n>] [--snapshot <file>]\n";
+	std::cerr << "                 [--load-data <mem_file>] [--dump-data <mem_file>]\n";
+	std::cerr << "       assembler <input_file> --run --restore <file> [--forks <n>] [--max-steps <n>]\n";
+	std::cerr << "       assembler <input_file> --lockstep <instances> [--max-steps <n>]\n";
+	std::cerr << "       assembler <input_file> --profile <output_prefix> [--max-steps <n>]\n";
+	std::cerr << "       assembler <input_file> --trace <trace_file> [--max-steps <n>]\n";
+	std::cerr << "       assembler <input_file> --dump-cfg <dot_file>\n";
+	std::cerr << "       assembler <input_file> --wcet [--cost <model>]\n";
+	std::cerr << "The data segment goes to <data_file>, by default <output_file> with _data before .mem,\n";
+	std::cerr << "and is loaded before --load-data when running.\n";
+	std::cerr << "Options applied before any of the above:\n";
+	std::cerr << "       --layout <counts_file>  reorder blocks and functions by the <output_prefix>.counts\n";
+	std::cerr << "                               of a --profile run without any of these options\n";
+	std::cerr << "       -O                      remove unreachable code, then apply peephole rules\n";
+	std::cerr << "                               that keep the padding --pipeline needs\n";
+	std::cerr << "       --schedule              reorder for the pipeline and insert nops for hazards\n";
+	std::cerr << "       --pipeline <model>      key=value pairs of load, alu, branch-alu, branch-load\n";
+	std::cerr << "                               and delay-slots, e.g. load=1,delay-slots=1\n";
+	std::cerr << "--wcet bounds the cycles of every function; loops need a \"# @loop <max>\" or\n";
+	std::cerr << "\"# @loop <min>..<max>\" comment on their back branch or header label. --cost takes\n";
+	std::cerr << "key=value pairs of alu, load, store, branch, jump, syscall and taken (cycles).\n";
+	std::cerr << "--listing writes address, word, line and source per instruction; --index writes the\n";
+	std::cerr << "binary address to file, line and label map read by tracedump --map.\n";
+}
+
+// Describes how a run ended, for the "Executed ..." lines.
+std::string RunStatus(mips::Simulator const &simulator) {
+	if (!simulator.halted()) {
+		return " (step limit reached)";
+	}
+	if (simulator.exited()) {
+		return " (exited with code " + std::to_string(simulator.exit_code()) + ")";
+	}
+	return "";
+}
+
+// code.mem -> code_data.mem
+std::string DataFileFor(std::string const &code_file) {
+	std::string const stem = code_file.size() > 4 && code_file.compare(code_file.size() - 4, 4, ".mem") == 0
+	        ? code_file.substr(0, code_file.size() - 4)
+	        : code_file;
+	return stem + "_data.mem";
+}
+
+// The program's data segment, then the image in file_path over it.
+void LoadData(mips::Simulator &simulator, mips::DataSegment const &data, std::string const &file_path) {
+	data.Load(simulator.memory());
+	if (file_path.empty()) {
+		return;
+	}
+	std::ifstream file(file_path);
+	if (!file.is_open()) {
+		throw mips::FileNotFoundException(file_path);
+	}
+	simulator.memory().LoadImage(file);
+}
+
+void DumpData(mips::Simulator const &simulator, std::string const &file_path) {
+	if (file_path.empty()) {
+		return;
+	}
+	std::ofstream file(file_path);
+	if (!file.is_open()) {
+		throw mips::FileNotFoundException(file_path);
+	}
+	simulator.memory().DumpImage(file);
+}
+
+void PrintRegisters(mips::Simulator const &simulator) {
+	for (int i = 1; i < 32; ++i) {
+		auto reg = static_cast<mips::Instruction::Register>(i);
+		uint32_t value = simulator.reg(reg);
+		if (value != 0) {
+			std::cout << mips::Instruction::RegisterNumberToName(reg) << " = "
+			          << static_cast<int32_t>(value) << '\n';
+		}
+	}
+}
+
+// Runs one instance per input value; instance i starts with $a0 = i and reports $v0.
+void RunLockstep(std::vector<uint32_t> const &code, uint32_t instances, uint64_t max_steps) {
+	constexpr std::size_t lanes = mips::DEFAULT_LOCKSTEP_LANES;
+	for (uint32_t first = 0; first < instances; first += lanes) {
+		mips::LockstepSimulator<lanes> simulator(code);
+		std::size_t count = std::min<std::size_t>(lanes, instances - first);
+		simulator.set_active_lanes(count);
+		for (std::size_t lane = 0; lane < count; ++lane) {
+			simulator.set_reg(lane, mips::Instruction::A0, static_cast<uint32_t>(first + lane));
+		}
+		simulator.Run(max_steps);
+		for (std::size_t lane = 0; lane < count; ++lane) {
+			std::cout << "instance " << first + lane << ": $v0 = "
+			          << static_cast<int32_t>(simulator.reg(lane, mips::Instruction::V0))
+			          << (simulator.halted(lane) ? "" : " (step limit reached)") << '\n';
+		}
+	}
+}
+
+// Runs forks copies of a snapshot in parallel; fork i starts with $a0 = i and reports $v0.
+void RunForks(std::vector<uint32_t> const &code, std::string const &snapshot, uint32_t forks, uint64_t max_steps) {
+	std::vector<mips::Simulator> simulators;
+	std::vector<std::unique_ptr<mips::SpimSyscalls>> syscalls;
+	// The forks share stdin and stdout.
+	std::mutex host_lock;
+	for (uint32_t i = 0; i < forks; ++i) {
+		simulators.push_back(mips::Simulator::FromSnapshot(code, snapshot));
+		simulators.back().set_reg(mips::Instruction::A0, i);
+		syscalls.push_back(std::make_unique<mips::SpimSyscalls>(stdout, stdin, &host_lock));
+		simulators.back().set_syscall_handler(syscalls.back().get());
+	}
+
+	std::vector<std::exception_ptr> errors(forks);
+	std::vector<std::thread> threads;
+	uint32_t const n_threads = std::max(1u, std::min(forks, std::thread::hardware_concurrency()));
+	for (uint32_t t = 0; t < n_threads; ++t) {
+		threads.emplace_back([&, t] {
+			for (uint32_t i = t; i < forks; i += n_threads) {
+				try {
+					simulators[i].Run(max_steps);
+				} catch (...) {
+					errors[i] = std::current_exception();
+				}
+			}
+		});
+	}
+	for (auto &thread : threads) {
+		thread.join();
+	}
+
+	for (uint32_t i = 0; i < forks; ++i) {
+		syscalls[i]->Flush();
+		if (errors[i]) {
+			std::rethrow_exception(errors[i]);
+		}
+		std::cout << "fork " << i << ": $v0 = " << static_cast<int32_t>(simulators[i].reg(mips::Instruction::V0))
+		          << RunStatus(simulators[i]) << '\n';
+	}
+}
+
+// Writes <prefix>.folded, <prefix>.lst and <prefix>.counts and prints the call graph.
+void Profile(mips::Assembler const &assembler, std::string const &prefix, std::string const &data_file,
+             uint64_t max_steps) {
+	mips::Profiler profiler(assembler.GetCode(), assembler.functions());
+	mips::SpimSyscalls syscalls;
+	profiler.simulator().set_syscall_handler(&syscalls);
+	LoadData(profiler.simulator(), assembler.data(), data_file);
+	uint64_t steps = profiler.Run(max_steps);
+	syscalls.Flush();
+	std::cout << "Executed " << steps << " instructions" << RunStatus(profiler.simulator()) << ".\n\n";
+	profiler.WriteCallGraph(std::cout);
+
+	std::ofstream folded(prefix + ".folded");
+	profiler.WriteFoldedStacks(folded);
+	std::ofstream counts(prefix + ".counts");
+	profiler.WriteCounts(counts);
+	std::ofstream listing(prefix + ".lst");
+	profiler.WriteAnnotatedSource(assembler.parser().files(), assembler.instructions(), listing);
+}
+
+} // namespace
 
 int main(int argc, char const *argv[]) {
 	std::string src_file;
 	std::string dest_file;
+	std::string data_file;
+	bool run = false;
+	mips::AssemblerOptions options;
+	std::string pipeline;
+	uint32_t lockstep_instances = 0;
+	std::string profile_prefix;
+	std::string trace_file;
+	std::string cfg_file;
+	std::string listing_file;
+	std::string index_file;
+	bool wcet = false;
+	std::string cost;
+	std::string snapshot_file;
+	std::string restore_file;
+	uint32_t forks = 0;
+	std::string load_data_file;
+	std::string dump_data_file;
+	uint64_t max_steps = DEFAULT_MAX_STEPS;
 
 	if(argc == 1) {
 		src_file = "test.s";
 		dest_file = "code.mem";
-	} else if(argc == 4 && strcmp(argv[2], "-o") == 0) {
-		src_file = argv[1];
-		dest_file = argv[3];
 	} else {
-		std::cerr << "Invalid number of parameters " << argc << ".";
-		std::cerr << "Usage: assembler <input_file> -o <output_file>\n";
-		std::exit(EXIT_FAILURE);
+		src_file = argv[1];
+		for (int i = 2; i < argc; ++i) {
+			if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+				dest_file = argv[++i];
+			} else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+				data_file = argv[++i];
+			} else if (strcmp(argv[i], "-c") == 0) {
+				options.relocatable = true;
+			} else if (strcmp(argv[i], "--layout") == 0 && i + 1 < argc) {
+				options.profile = argv[++i];
+			} else if (strcmp(argv[i], "-O") == 0) {
+				options.optimize = true;
+			} else if (strcmp(argv[i], "--schedule") == 0) {
+				options.schedule = true;
+			} else if (strcmp(argv[i], "--pipeline") == 0 && i + 1 < argc) {
+				pipeline = argv[++i];
+			} else if (strcmp(argv[i], "--run") == 0) {
+				run = true;
+			} else if (strcmp(argv[i], "--lockstep") == 0 && i + 1 < argc) {
+				lockstep_instances = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 0));
+			} else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc) {
+				profile_prefix = argv[++i];
+			} else if (strcmp(argv[i], "--dump-cfg") == 0 && i + 1 < argc) {
+				cfg_file = argv[++i];
+			} else if (strcmp(argv[i], "--listing") == 0 && i + 1 < argc) {
+				listing_file = argv[++i];
+			} else if (strcmp(argv[i], "--index") == 0 && i + 1 < argc) {
+				index_file = argv[++i];
+			} else if (strcmp(argv[i], "--wcet") == 0) {
+				wcet = true;
+			} else if (strcmp(argv[i], "--cost") == 0 && i + 1 < argc) {
+				cost = argv[++i];
+			} else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+				trace_file = argv[++i];
+			} else if (strcmp(argv[i], "--snapshot") == 0 && i + 1 < argc) {
+				snapshot_file = argv[++i];
+			} else if (strcmp(argv[i], "--restore") == 0 && i + 1 < argc) {
+				restore_file = argv[++i];
+			} else if (strcmp(argv[i], "--forks") == 0 && i + 1 < argc) {
+				forks = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 0));
+			} else if (strcmp(argv[i], "--load-data") == 0 && i + 1 < argc) {
+				load_data_file = argv[++i];
+			} else if (strcmp(argv[i], "--dump-data") == 0 && i + 1 < argc) {
+				dump_data_file = argv[++i];
+			} else if (strcmp(argv[i], "--max-steps") == 0 && i + 1 < argc) {
+				max_steps = std::strtoull(argv[++i], nullptr, 0);
+			} else {
+				std::cerr << "Invalid parameter " << argv[i] << ".\n";
+				PrintUsage();
+				std::exit(EXIT_FAILURE);
+			}
+		}
+		if (dest_file.empty() && !run && lockstep_instances == 0 && profile_prefix.empty()
+		    && trace_file.empty() && cfg_file.empty() && !wcet && listing_file.empty() && index_file.empty()) {
+			std::cerr << "Invalid number of parameters " << argc << ".\n";
+			PrintUsage();
+			std::exit(EXIT_FAILURE);
+		}
+		if (options.relocatable && (dest_file.empty() || !options.profile.empty() || options.optimize || options.schedule
+		                            || run || lockstep_instances != 0 || !profile_prefix.empty() || !trace_file.empty()
+		                            || !cfg_file.empty() || wcet || !listing_file.empty() || !index_file.empty())) {
+			std::cerr << "-c only combines with -o.\n";
+			PrintUsage();
+			std::exit(EXIT_FAILURE);
+		}
+		if (forks != 0 && restore_file.empty()) {
+			std::cerr << "--forks requires --restore.\n";
+			PrintUsage();
+			std::exit(EXIT_FAILURE);
+		}
 	}
 
 	try {
-		mips::Assembler assembler(src_file);
-		assembler.WriteToFile(dest_file);
+		if (!pipeline.empty()) {
+			options.pipeline = mips::PipelineModel::Parse(pipeline);
+		}
+		mips::Assembler assembler(src_file, options);
+		if (assembler.layout() != nullptr) {
+			assembler.layout()->WriteReport(std::cout);
+		}
+		if (assembler.eliminator() != nullptr) {
+			assembler.eliminator()->WriteReport(std::cout);
+		}
+		if (assembler.optimizer() != nullptr) {
+			assembler.optimizer()->WriteReport(std::cout);
+		}
+		if (assembler.scheduler() != nullptr) {
+			assembler.scheduler()->WriteReport(std::cout);
+		}
+		if (options.relocatable) {
+			assembler.WriteObjectFile(dest_file);
+		} else if (!dest_file.empty()) {
+			assembler.WriteToFile(dest_file);
+			if (!assembler.data().empty()) {
+				assembler.WriteDataToFile(data_file.empty() ? DataFileFor(dest_file) : data_file);
+			}
+		}
+		if (!listing_file.empty()) {
+			assembler.WriteListing(listing_file);
+		}
+		if (!index_file.empty()) {
+			assembler.WriteSourceMap(index_file);
+		}
+		if (!cfg_file.empty()) {
+			std::ofstream dot(cfg_file);
+			mips::ControlFlowGraph(assembler.instructions(), assembler.functions()).WriteDot(dot);
+		}
+		if (wcet) {
+			mips::TimingAnalyzer analyzer(assembler.instructions(), assembler.functions(), assembler.annotations(),
+			                              cost.empty() ? mips::CostModel() : mips::CostModel::Parse(cost),
+			                              options.pipeline);
+			analyzer.WriteReport(std::cout);
+		}
+		if (run && forks != 0) {
+			RunForks(assembler.GetCode(), restore_file, forks, max_steps);
+		} else if (run) {
+			mips::Simulator simulator = restore_file.empty()
+			        ? mips::Simulator(assembler.GetCode())
+			        : mips::Simulator::FromSnapshot(assembler.GetCode(), restore_file);
+			mips::SpimSyscalls syscalls;
+			simulator.set_syscall_handler(&syscalls);
+			LoadData(simulator, restore_file.empty() ? assembler.data() : mips::DataSegment(),
+			         load_data_file);
+			uint64_t steps = simulator.Run(max_steps);
+			syscalls.Flush();
+			std::cout << "Executed " << steps << " instructions" << RunStatus(simulator) << ".\n";
+			PrintRegisters(simulator);
+			DumpData(simulator, dump_data_file);
+			if (!snapshot_file.empty()) {
+				simulator.SaveSnapshot(snapshot_file);
+			}
+		}
+		if (lockstep_instances != 0) {
+			RunLockstep(assembler.GetCode(), lockstep_instances, max_steps);
+		}
+		if (!profile_prefix.empty()) {
+			Profile(assembler, profile_prefix, load_data_file, max_steps);
+		}
+		if (!trace_file.empty()) {
+			mips::Tracer tracer(assembler.GetCode(), trace_file);
+			mips::SpimSyscalls syscalls;
+			tracer.simulator().set_syscall_handler(&syscalls);
+			LoadData(tracer.simulator(), assembler.data(), load_data_file);
+			uint64_t steps = tracer.Run(max_steps);
+			tracer.Close();
+			syscalls.Flush();
+			std::cout << "Traced " << steps << " instructions" << RunStatus(tracer.simulator()) << ".\n";
+		}
     } catch(std::exception const &e) {
 		std::cerr << "Error: ";
 		std::cerr << e.what() << std::endl;
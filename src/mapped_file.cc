@@ -0,0 +1,42 @@
+#include "mapped_file.h"
+#include "assembler.h"
+#include <utility>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace mips {
+
+MappedFile::MappedFile(std::string const &file_path) {
+    int fd = open(file_path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw FileNotFoundException(file_path);
+    }
+    struct stat info;
+    if (fstat(fd, &info) == 0 && info.st_size > 0) {
+        size_ = static_cast<std::size_t>(info.st_size);
+        void *mapping = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        data_ = mapping == MAP_FAILED ? nullptr : mapping;
+    }
+    close(fd);
+}
+
+MappedFile::MappedFile(MappedFile &&other) noexcept {
+    *this = std::move(other);
+}
+
+// Swaps, so the mapping this held is released by other.
+MappedFile &MappedFile::operator=(MappedFile &&other) noexcept {
+    std::swap(data_, other.data_);
+    std::swap(size_, other.size_);
+    return *this;
+}
+
+MappedFile::~MappedFile() {
+    if (data_ != nullptr) {
+        munmap(data_, size_);
+    }
+}
+
+} // namespace mips
@@ -0,0 +1,132 @@
+#include "object_file.h"
+#include "assembler.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+namespace mips {
+
+namespace {
+
+constexpr char OBJECT_MAGIC[8] = {'M', 'I', 'P', 'S', 'O', 'B', 'J', '1'};
+constexpr uint32_t OBJECT_VERSION = 1;
+
+struct ObjectHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t word_count;
+    uint32_t symbol_count;
+    uint32_t relocation_count;
+    uint32_t string_size;
+    uint32_t reserved;
+};
+
+uint64_t ObjectSize(ObjectHeader const &header) {
+    return sizeof(ObjectHeader) + uint64_t{header.word_count} * 4
+            + uint64_t{header.symbol_count} * sizeof(ObjectSymbol)
+            + uint64_t{header.relocation_count} * sizeof(ObjectRelocation) + header.string_size;
+}
+
+} // namespace
+
+InvalidObjectException::InvalidObjectException(std::string const &file_path, std::string const &info) {
+    message_ = "Invalid object file " + file_path + ": " + info;
+}
+
+ObjectFile::ObjectFile(std::string const &file_path) : file_path_(file_path), file_(file_path) {
+    if (file_.size() < sizeof(ObjectHeader)) {
+        throw InvalidObjectException(file_path, "not an object file.");
+    }
+    if (file_.data() == nullptr) {
+        throw InvalidObjectException(file_path, "cannot be mapped.");
+    }
+
+    auto const *header = static_cast<ObjectHeader const *>(file_.data());
+    if (std::memcmp(header->magic, OBJECT_MAGIC, sizeof(OBJECT_MAGIC)) != 0 || header->version != OBJECT_VERSION) {
+        throw InvalidObjectException(file_path, "not an object file.");
+    }
+    if (ObjectSize(*header) != file_.size()) {
+        throw InvalidObjectException(file_path, "truncated or oversized.");
+    }
+    word_count_ = header->word_count;
+    symbol_count_ = header->symbol_count;
+    relocation_count_ = header->relocation_count;
+    words_ = reinterpret_cast<uint32_t const *>(header + 1);
+    symbols_ = reinterpret_cast<ObjectSymbol const *>(words_ + word_count_);
+    relocations_ = reinterpret_cast<ObjectRelocation const *>(symbols_ + symbol_count_);
+    strings_ = reinterpret_cast<char const *>(relocations_ + relocation_count_);
+
+    for (uint32_t i = 0; i < symbol_count_; ++i) {
+        ObjectSymbol const &symbol = symbols_[i];
+        if (uint64_t{symbol.name} + symbol.name_length > header->string_size
+                || ((symbol.flags & ObjectSymbol::DEFINED) && symbol.value > word_count_)) {
+            throw InvalidObjectException(file_path, "symbol " + std::to_string(i) + " is out of range.");
+        }
+    }
+    for (uint32_t i = 0; i < relocation_count_; ++i) {
+        ObjectRelocation const &relocation = relocations_[i];
+        if (relocation.offset >= word_count_ || relocation.symbol >= symbol_count_
+                || relocation.type > Parser::SymbolReference::LOWER) {
+            throw InvalidObjectException(file_path, "relocation " + std::to_string(i) + " is out of range.");
+        }
+    }
+}
+
+void ObjectFile::Write(std::string const &file_path, std::vector<uint32_t> const &code, Parser const &parser) {
+    std::vector<std::pair<std::string, uint32_t>> labels;
+    for (auto const &label : parser.labels()) {
+        labels.emplace_back(label.first, label.second.first - 1);
+    }
+    std::sort(std::begin(labels), std::end(labels), [](auto const &a, auto const &b) {
+        return a.second != b.second ? a.second < b.second : a.first < b.first;
+    });
+
+    std::string strings;
+    std::vector<ObjectSymbol> symbols;
+    std::unordered_map<std::string, uint32_t> indices;
+    auto add_symbol = [&](std::string const &name, uint32_t value, uint32_t flags) {
+        indices[name] = static_cast<uint32_t>(symbols.size());
+        symbols.push_back({static_cast<uint32_t>(strings.size()), static_cast<uint32_t>(name.size()), value, flags});
+        strings += name;
+    };
+    for (auto const &label : labels) {
+        bool const function = parser.functions().count(label.first) != 0;
+        add_symbol(label.first, label.second,
+                   ObjectSymbol::DEFINED | (function ? uint32_t{ObjectSymbol::GLOBAL} : 0u));
+    }
+
+    std::vector<ObjectRelocation> relocations;
+    for (auto const &reference : parser.references()) {
+        auto found = indices.find(reference.symbol);
+        if (found == indices.end()) {
+            add_symbol(reference.symbol, 0, ObjectSymbol::GLOBAL);
+            found = indices.find(reference.symbol);
+        }
+        relocations.push_back({reference.instruction, reference.kind, found->second, 0});
+    }
+
+    ObjectHeader header = {};
+    std::memcpy(header.magic, OBJECT_MAGIC, sizeof(OBJECT_MAGIC));
+    header.version = OBJECT_VERSION;
+    header.word_count = static_cast<uint32_t>(code.size());
+    header.symbol_count = static_cast<uint32_t>(symbols.size());
+    header.relocation_count = static_cast<uint32_t>(relocations.size());
+    header.string_size = static_cast<uint32_t>(strings.size());
+
+    std::ofstream file(file_path, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+        throw FileNotFoundException(file_path);
+    }
+    file.write(reinterpret_cast<char const *>(&header), sizeof(header));
+    file.write(reinterpret_cast<char const *>(code.data()), static_cast<std::streamsize>(code.size() * 4));
+    file.write(reinterpret_cast<char const *>(symbols.data()),
+               static_cast<std::streamsize>(symbols.size() * sizeof(ObjectSymbol)));
+    file.write(reinterpret_cast<char const *>(relocations.data()),
+               static_cast<std::streamsize>(relocations.size() * sizeof(ObjectRelocation)));
+    file.write(strings.data(), static_cast<std::streamsize>(strings.size()));
+    if (!file) {
+        throw InvalidObjectException(file_path, "write failed.");
+    }
+}
+
+} // namespace mips
@@ -4,19 +4,83 @@
 #include <string>
 #include <sstream>
 #include <cassert>
+#include <cstdint>
+#include <cstdlib>
 #include <vector>
 #include <iostream>
 #include <stdexcept>
 
-#ifndef CODE_SEGMENT_OFFSET
-static constexpr uint32_t CODE_SEGMENT_OFFSET = 0x00400000;
-#endif
-
 namespace mips {
 
-Parser::Parser(std::ifstream &file) {
-    CollectLabelsAndFunctions(file);
-    CollectInstructions(file);
+namespace {
+
+int64_t ConstantValue(std::string const &value) {
+    return std::strtoll(value.c_str(), nullptr, 0);
+}
+
+bool FitsSigned16(int64_t value) {
+    return value >= INT16_MIN && value <= INT16_MAX;
+}
+
+// Replaces the escapes \n, \t, \r, \0, \\, \" and \' in text; false for any other.
+bool Unescape(std::string const &text, std::string *result) {
+    for (std::size_t i = 0; i < text.size(); ++i) {
+        if (text[i] != '\\') {
+            result->push_back(text[i]);
+            continue;
+        }
+        if (++i == text.size()) {
+            return false;
+        }
+        switch (text[i]) {
+        case 'n': result->push_back('\n'); break;
+        case 't': result->push_back('\t'); break;
+        case 'r': result->push_back('\r'); break;
+        case '0': result->push_back('\0'); break;
+        case '\\':
+        case '"':
+        case '\'': result->push_back(text[i]); break;
+        default: return false;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+Parser::Parser(std::istream &source, bool relocatable) : relocatable_(relocatable) {
+    Preprocessor preprocessor;
+    lines_ = preprocessor.Process(source);
+    files_ = preprocessor.files();
+    Parse();
+}
+
+Parser::Parser(std::vector<SourceLine> lines, bool relocatable, std::vector<std::string> files)
+        : lines_(std::move(lines)), files_(std::move(files)), relocatable_(relocatable) {
+    Parse();
+}
+
+void Parser::Parse() {
+    try {
+        // A statement only ever moves from its short to its long form, so
+        // this runs at most once more than there are branches.
+        do {
+            layout_changed_ = false;
+            labels_.clear();
+            functions_.clear();
+            instructions_.clear();
+            references_.clear();
+            data_labels_.clear();
+            CollectLabelsAndFunctions();
+            CollectInstructions();
+        } while (layout_changed_);
+    } catch (UnexpectedSymbolException &exception) {
+        // Lines of the file being assembled go without a name.
+        if (current_file_ != 0 && current_file_ < files_.size()) {
+            exception.AddFile(files_[current_file_]);
+        }
+        throw;
+    }
 }
 
 void Parser::ParseRTypeInstruction(uint32_t opcode, std::vector<std::string> &&tokens, uint32_t line_number) {
@@ -26,7 +90,7 @@ void Parser::ParseRTypeInstruction(uint32_t opcode, std::vector<std::string> &&t
     if (IsRegister(tokens[1])) {
         if (IsRegister(tokens[2])) {
             if (IsRegister(tokens[3])) {
-                instructions_.emplace_back(opcode, std::move(tokens));
+                instructions_.emplace_back(opcode, std::move(tokens), line_number);
             } else {
                 throw RegisterNameExpectedException(tokens[2], line_number);
             }
@@ -45,7 +109,7 @@ void Parser::ParseImmediateInstruction(uint32_t opcode, std::vector<std::string>
     if (IsRegister(tokens[1])) {
         if (IsRegister(tokens[2])) {
             if (IsImmediateValue(tokens[3])) {
-                instructions_.emplace_back(opcode, std::move(tokens));
+                instructions_.emplace_back(opcode, std::move(tokens), line_number);
             } else {
                 throw UnexpectedSymbolException(tokens[2], line_number,
                                                 "Expected immediate value.");
@@ -58,26 +122,62 @@ void Parser::ParseImmediateInstruction(uint32_t opcode, std::vector<std::string>
     }
 }
 
+void Parser::ParseUpperImmediateInstruction(uint32_t opcode, std::vector<std::string> &&tokens,
+                                            uint32_t line_number) {
+    if (tokens.size() != 3) {
+        throw UnexpectedSymbolException((tokens.size() > 0 ? tokens[tokens.size() - 1] : ""), line_number);
+    }
+    if (IsRegister(tokens[1])) {
+        if (IsImmediateValue(tokens[2])) {
+            instructions_.emplace_back(opcode, std::move(tokens), line_number);
+        } else {
+            throw UnexpectedSymbolException(tokens[2], line_number, "Expected immediate value.");
+        }
+    } else {
+        throw RegisterNameExpectedException(tokens[1], line_number);
+    }
+}
+
 void Parser::ParseBranchInstruction(uint32_t opcode, std::vector<std::string> &&tokens,
-                                    uint32_t line_number, uint32_t instruction_number) {
+                                    uint32_t line_number, uint32_t statement_number) {
     if (tokens.size() != 4) {
         throw UnexpectedSymbolException((tokens.size() > 0 ? tokens[tokens.size() - 1] : ""), line_number);
     }
     if (IsRegister(tokens[1])) {
         if (IsRegister(tokens[2])) {
             if (IsImmediateValue(tokens[3])) {
-                instructions_.emplace_back(opcode, std::move(tokens));
+                if (!FitsSigned16(ConstantValue(tokens[3]))) {
+                    throw UnexpectedSymbolException(tokens[3], line_number, "Branch offset does not fit in 16 bits.");
+                }
+                instructions_.emplace_back(opcode, std::move(tokens), line_number);
             } else {
                 auto found = labels_.find(tokens[3]);
-                if (found != labels_.end()) {
-                    auto const &pair = *found;
-                    tokens[3] = std::to_string(static_cast<int32_t>(pair.second.first)
-                                               - static_cast<int32_t>(instruction_number) - 2);
-                    instructions_.emplace_back(opcode, std::move(tokens));
-                } else {
+                bool const external = found == labels_.end();
+                if (external && !relocatable_) {
                     throw UnexpectedSymbolException(tokens[2], line_number,
                                                     "Expected immediate value or label name.");
                 }
+                if (long_statements_.count(statement_number) != 0) {
+                    // The inverted branch skips over a j to the label. A branch
+                    // that is always taken needs only the j.
+                    std::string label = tokens[3];
+                    if (opcode != Instruction::BEQ || tokens[1] != tokens[2]) {
+                        uint32_t const inverted = opcode == Instruction::BEQ ? Instruction::BNE : Instruction::BEQ;
+                        tokens[0] = inverted == Instruction::BEQ ? "beq" : "bne";
+                        tokens[3] = "1";
+                        instructions_.emplace_back(inverted, std::move(tokens), line_number);
+                    }
+                    ParseJumpInstruction(Instruction::J, {"j", std::move(label)}, line_number);
+                    return;
+                }
+                int64_t const offset = external ? 0 : int64_t{found->second.first}
+                        - static_cast<int64_t>(instructions_.size()) - 2;
+                if (external || !FitsSigned16(offset)) {
+                    long_statements_.insert(statement_number);
+                    layout_changed_ = true;
+                }
+                tokens[3] = std::to_string(offset);
+                instructions_.emplace_back(opcode, std::move(tokens), line_number);
             }
         } else {
             throw RegisterNameExpectedException(tokens[2], line_number);
@@ -115,7 +215,7 @@ void Parser::ParseMemoryInstruction(uint32_t opcode, std::vector<std::string> &&
         tokens.pop_back();
         tokens.push_back(value);
         tokens.push_back(reg);
-        instructions_.emplace_back(opcode, std::move(tokens));
+        instructions_.emplace_back(opcode, std::move(tokens), line_number);
     } else {
         throw RegisterNameExpectedException(tokens[1], line_number);
     }
@@ -127,12 +227,16 @@ void Parser::ParseJumpInstruction(uint32_t opcode, std::vector<std::string> &&to
         throw UnexpectedSymbolException((tokens.size() > 0 ? tokens[tokens.size() - 1] : ""), line_number);
     }
     if (IsImmediateValue(tokens[1])) {
-        instructions_.emplace_back(opcode, std::move(tokens));
+        if (relocatable_) {
+            throw UnexpectedSymbolException(tokens[1], line_number, "Jump targets in object files must be labels.");
+        }
+        instructions_.emplace_back(opcode, std::move(tokens), line_number);
     } else {
         auto value = labels_.find(tokens[1]);
-        if (value != labels_.end()) {
-            tokens[1] = std::to_string(static_cast<int32_t>(value->second.second));
-            instructions_.emplace_back(opcode, std::move(tokens));
+        if (value != labels_.end() || relocatable_) {
+            references_.push_back({static_cast<uint32_t>(instructions_.size()), SymbolReference::JUMP, tokens[1]});
+            tokens[1] = value != labels_.end() ? std::to_string(static_cast<int32_t>(value->second.second)) : "0";
+            instructions_.emplace_back(opcode, std::move(tokens), line_number);
         } else {
             throw UnexpectedSymbolException(tokens[1], line_number,
                                             "Expected immediate value or label name.");
@@ -146,12 +250,16 @@ void Parser::ParseJALInstruction(uint32_t opcode, std::vector<std::string> &&tok
         throw UnexpectedSymbolException((tokens.size() > 0 ? tokens[tokens.size() - 1] : ""), line_number);
     }
     if (IsImmediateValue(tokens[1])) {
-        instructions_.emplace_back(opcode, std::move(tokens));
+        if (relocatable_) {
+            throw UnexpectedSymbolException(tokens[1], line_number, "Jump targets in object files must be labels.");
+        }
+        instructions_.emplace_back(opcode, std::move(tokens), line_number);
     } else {
         auto value = functions_.find(tokens[1]);
-        if (value != functions_.end()) {
-            tokens[1] = std::to_string(value->second);
-            instructions_.emplace_back(opcode, std::move(tokens));
+        if (value != functions_.end() || relocatable_) {
+            references_.push_back({static_cast<uint32_t>(instructions_.size()), SymbolReference::JUMP, tokens[1]});
+            tokens[1] = value != functions_.end() ? std::to_string(value->second) : "0";
+            instructions_.emplace_back(opcode, std::move(tokens), line_number);
         } else {
             throw UnexpectedSymbolException(tokens[1], line_number,
                                             "Expected immediate value or function name.");
@@ -165,19 +273,165 @@ void Parser::ParseJRInstruction(uint32_t opcode, std::vector<std::string> &&toke
         throw UnexpectedSymbolException((tokens.size() > 0 ? tokens[tokens.size() - 1] : ""), line_number);
     }
     if (IsRegister(tokens[1])) {
-        instructions_.emplace_back(opcode, std::move(tokens));
+        instructions_.emplace_back(opcode, std::move(tokens), line_number);
     } else {
         throw RegisterNameExpectedException(tokens[1], line_number);
     }
 }
 
-void Parser::ProcessTokens(std::vector<std::string> &&tokens, uint32_t line_number, uint32_t instruction_number) {
+void Parser::ParseSyscallInstruction(uint32_t opcode, std::vector<std::string> &&tokens, uint32_t line_number)
+{
+    if (tokens.size() != 1) {
+        throw UnexpectedSymbolException(tokens[1], line_number);
+    }
+    instructions_.emplace_back(opcode, std::move(tokens), line_number);
+}
+
+void Parser::LoadConstant(std::string const &reg, int64_t value, bool full_width, uint32_t line_number) {
+    uint32_t const bits = static_cast<uint32_t>(value);
+    uint32_t const upper = bits >> 16u;
+    uint32_t const lower = bits & 0xffffu;
+    if (!full_width && FitsSigned16(static_cast<int32_t>(bits))) {
+        instructions_.emplace_back(Instruction::ADDI, std::vector<std::string>{
+                "addi", reg, "$zero", std::to_string(static_cast<int32_t>(bits))}, line_number);
+    } else if (!full_width && upper == 0) {
+        instructions_.emplace_back(Instruction::ORI, std::vector<std::string>{
+                "ori", reg, "$zero", std::to_string(lower)}, line_number);
+    } else {
+        instructions_.emplace_back(Instruction::LUI, std::vector<std::string>{
+                "lui", reg, std::to_string(upper)}, line_number);
+        if (full_width || lower != 0) {
+            instructions_.emplace_back(Instruction::ORI, std::vector<std::string>{
+                    "ori", reg, reg, std::to_string(lower)}, line_number);
+        }
+    }
+}
+
+uint32_t Parser::ConstantSize(int64_t value) {
+    uint32_t const bits = static_cast<uint32_t>(value);
+    bool const single = FitsSigned16(static_cast<int32_t>(bits)) || (bits >> 16u) == 0 || (bits & 0xffffu) == 0;
+    return single ? 1 : 2;
+}
+
+uint32_t Parser::ExpansionSize(std::vector<std::string> const &tokens, uint32_t statement_number) const {
+    if (tokens.empty()) {
+        return 0;
+    }
+    std::string const &op = tokens[0];
+    bool const relaxed = long_statements_.count(statement_number) != 0;
+    if ((op == "li" || op == "la") && tokens.size() == 3) {
+        // A label address is laid out later, so la of a label always takes lui + ori.
+        return IsImmediateValue(tokens[2]) ? ConstantSize(ConstantValue(tokens[2])) : 2;
+    }
+    if ((op == "lw" || op == "sw") && tokens.size() == 3 && HasLabelOffset(tokens[2])) {
+        return tokens[2].find('(') == std::string::npos ? 2 : 3;
+    }
+    if (op == "blt" || op == "bgt" || op == "ble" || op == "bge") {
+        return relaxed ? 3 : 2;
+    }
+    if (op == "b" || (op == "beq" && tokens.size() == 4 && tokens[1] == tokens[2])) {
+        return 1;
+    }
+    if (op == "beq" || op == "bne") {
+        return relaxed ? 2 : 1;
+    }
+    return 1;
+}
+
+bool Parser::ExpandPseudoInstruction(std::vector<std::string> const &tokens, uint32_t line_number,
+                                     uint32_t statement_number) {
+    std::string const &op = tokens[0];
+    if (op == "move") {
+        if (tokens.size() != 3) {
+            throw UnexpectedSymbolException(tokens.back(), line_number);
+        }
+        ParseRTypeInstruction(Instruction::RTYPE, {"add", tokens[1], tokens[2], "$zero"}, line_number);
+    } else if (op == "li" || op == "la") {
+        if (tokens.size() != 3) {
+            throw UnexpectedSymbolException(tokens.back(), line_number);
+        }
+        if (!IsRegister(tokens[1])) {
+            throw RegisterNameExpectedException(tokens[1], line_number);
+        }
+        uint32_t address = 0;
+        bool const defined = SymbolAddress(tokens[2], &address);
+        if (IsImmediateValue(tokens[2])) {
+            int64_t const value = ConstantValue(tokens[2]);
+            if (value < INT32_MIN || value > UINT32_MAX) {
+                throw UnexpectedSymbolException(tokens[2], line_number, "Constant does not fit in 32 bits.");
+            }
+            LoadConstant(tokens[1], value, false, line_number);
+        } else if (op == "la" && (defined || relocatable_)) {
+            uint32_t const upper = static_cast<uint32_t>(instructions_.size());
+            references_.push_back({upper, SymbolReference::UPPER, tokens[2]});
+            references_.push_back({upper + 1, SymbolReference::LOWER, tokens[2]});
+            LoadConstant(tokens[1], address, true, line_number);
+        } else {
+            throw UnexpectedSymbolException(tokens[2], line_number, op == "la"
+                                            ? "Expected immediate value or label name."
+                                            : "Expected immediate value.");
+        }
+    } else if ((op == "lw" || op == "sw") && tokens.size() == 3 && HasLabelOffset(tokens[2])) {
+        // The low half is sign extended by the access, so the upper half is rounded.
+        std::string const &operand = tokens[2];
+        std::size_t const open_paren_index = operand.find('(');
+        uint32_t address;
+        if (relocatable_) {
+            throw UnexpectedSymbolException(operand, line_number, "Labels cannot be offsets in object files.");
+        }
+        if (!SymbolAddress(operand.substr(0, open_paren_index), &address)) {
+            throw UnexpectedSymbolException(operand, line_number, "Expected immediate value or label name.");
+        }
+        references_.push_back({static_cast<uint32_t>(instructions_.size()), SymbolReference::ACCESS_UPPER,
+                               operand.substr(0, open_paren_index)});
+        instructions_.emplace_back(Instruction::LUI, std::vector<std::string>{
+                "lui", "$at", std::to_string(((address + 0x8000u) >> 16u) & 0xffffu)}, line_number);
+        if (open_paren_index != std::string::npos) {
+            std::size_t const close_paren_index = operand.find(')');
+            if (close_paren_index == std::string::npos) {
+                throw UnexpectedSymbolException(operand, line_number, "Expected \")\".");
+            }
+            ParseRTypeInstruction(Instruction::RTYPE, {"add", "$at", "$at", operand.substr(
+                    open_paren_index + 1, close_paren_index - open_paren_index - 1)}, line_number);
+        }
+        references_.push_back({static_cast<uint32_t>(instructions_.size()), SymbolReference::ACCESS_LOWER,
+                               operand.substr(0, open_paren_index)});
+        ParseMemoryInstruction(op == "lw" ? Instruction::LW : Instruction::SW, {op, tokens[1],
+                               std::to_string(static_cast<int16_t>(address & 0xffffu)) + "($at)"}, line_number);
+    } else if (op == "b") {
+        if (tokens.size() != 2) {
+            throw UnexpectedSymbolException(tokens.back(), line_number);
+        }
+        ParseBranchInstruction(Instruction::BEQ, {"beq", "$zero", "$zero", tokens[1]}, line_number, statement_number);
+    } else if (op == "blt" || op == "bgt" || op == "ble" || op == "bge") {
+        if (tokens.size() != 4) {
+            throw UnexpectedSymbolException(tokens.back(), line_number);
+        }
+        // blt/bge compare s < t, bgt/ble compare t < s; blt/bgt branch when it holds.
+        bool const swapped = op == "bgt" || op == "ble";
+        bool const on_less = op == "blt" || op == "bgt";
+        ParseRTypeInstruction(Instruction::RTYPE, {"slt", "$at", tokens[swapped ? 2 : 1], tokens[swapped ? 1 : 2]},
+                              line_number);
+        ParseBranchInstruction(on_less ? Instruction::BNE : Instruction::BEQ,
+                               {on_less ? "bne" : "beq", "$at", "$zero", tokens[3]}, line_number, statement_number);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+void Parser::ProcessTokens(std::vector<std::string> &&tokens, uint32_t line_number, uint32_t statement_number) {
 	uint32_t opcode;
+    if (ExpandPseudoInstruction(tokens, line_number, statement_number)) {
+        return;
+    }
     if (IsInstruction(tokens[0], &opcode)) {
 		switch(opcode) {
 		case Instruction::RTYPE:
             if (tokens[0] == "jr") {
                 ParseJRInstruction(opcode, std::move(tokens), line_number);
+            } else if (tokens[0] == "syscall") {
+                ParseSyscallInstruction(opcode, std::move(tokens), line_number);
             } else {
                 ParseRTypeInstruction(opcode, std::move(tokens), line_number);
             }
@@ -186,11 +440,14 @@ void Parser::ProcessTokens(std::vector<std::string> &&tokens, uint32_t line_numb
 		case Instruction::ORI:
 		case Instruction::ANDI:
         case Instruction::SLTI:
-            ParseImmediateInstruction(opcode, std::move(tokens), instruction_number);
+            ParseImmediateInstruction(opcode, std::move(tokens), line_number);
 			break;
+        case Instruction::LUI:
+            ParseUpperImmediateInstruction(opcode, std::move(tokens), line_number);
+            break;
         case Instruction::BEQ:
         case Instruction::BNE:
-            ParseBranchInstruction(opcode, std::move(tokens), line_number, instruction_number);
+            ParseBranchInstruction(opcode, std::move(tokens), line_number, statement_number);
             break;
 		case Instruction::LW:
 		case Instruction::SW:
@@ -213,16 +470,16 @@ void Parser::ProcessTokens(std::vector<std::string> &&tokens, uint32_t line_numb
 
 bool Parser::IsInstruction(std::string const &value, uint32_t *opcode) {
 	assert(opcode != nullptr);
-    static constexpr char instruction_strings[][5] = {"add", "sub", "slt", "or", "and", "beq",
+    static constexpr char instruction_strings[][8] = {"add", "sub", "slt", "or", "and", "beq",
                                                       "bne", "addi", "ori", "andi", "slti", "sw",
-                                                      "lw", "jal", "j", "jr"};
+                                                      "lw", "jal", "j", "jr", "syscall", "lui"};
 
     static constexpr Instruction::Opcode opcodes[] = {Instruction::RTYPE, Instruction::RTYPE, Instruction::RTYPE,
                                                       Instruction::RTYPE, Instruction::RTYPE, Instruction::BEQ,
                                                       Instruction::BNE, Instruction::ADDI, Instruction::ORI,
                                                       Instruction::ANDI, Instruction::SLTI, Instruction::SW,
                                                       Instruction::LW, Instruction::JAL, Instruction::J,
-                                                      Instruction::RTYPE };
+                                                      Instruction::RTYPE, Instruction::RTYPE, Instruction::LUI };
 
     static constexpr size_t n_instructions = sizeof(opcodes) / sizeof(opcodes[0]);
 
@@ -238,41 +495,14 @@ bool Parser::IsInstruction(std::string const &value, uint32_t *opcode) {
 }
 
 bool Parser::IsRegister(std::string const &value) {
-    if (value.length() == 3) {
-        if (value[0] == '$') {
-            if (value[1] == 't') {
-                if (value[2] <= '7' && value[2] >= '0') {
-					return true;
-				}
-            } else if (value[1] == 'a') {
-                if (value[2] >= '0' && value[2] <= '1') {
-					return true;
-				}
-            } else if (value[1] == 'v') {
-                if (value[2] >= '0' && value[2] <= '1') {
-                    return true;
-                }
-            } else if (value[1] == 's') {
-                if ((value[2] >= '0' && value[2] <= '7') || value[2] == 'p') {
-					return true;
-				}
-            } else if (value[1] == 'r' && value[2] == 'a') {
-                return true;
-            }
-		}
-	} else if (value == "$zero") {
-		return true;
-	}
-	return false;
+    return value == "$zero" || Instruction::RegisterNameToNumber(value) != Instruction::ZERO;
 }
 
 bool Parser::IsImmediateValue(std::string const &value) {
     bool hex = value.length() > 2 && value[0] == '0' && value[1] == 'x';
     if (hex) {
         if (pp::contains_which_not(std::begin(value) + 2, std::end(value),
-                                  [](char c) {
-                                      return (c >= '0' && c <= '9') && !(c >= 'a' && c <= 'f');
-                                  })) {
+                                  [](char c) { return isxdigit(c); })) {
             return false;
         }
 	} else {
@@ -285,87 +515,239 @@ bool Parser::IsImmediateValue(std::string const &value) {
 	return true;
 }
 
-void Parser::CollectLabelsAndFunctions(std::ifstream &file) {
-    uint32_t instruction_number = 0;
-    uint32_t line_number = 1;
-    std::vector<std::pair<std::string, uint32_t>> labels_before_function;
+bool Parser::IsLabel(std::vector<std::string> const &tokens) {
+    // Only the first token, since v:n repeats a value in data directives.
+    return tokens[0].find(':') != std::string::npos;
+}
 
-    std::string line;
-    while(std::getline(file, line)) {
-        auto colon_it = std::find(std::begin(line), std::end(line), ':');
-        if (colon_it != std::end(line)) {
-            if (pp::contains_which_not(colon_it + 1, std::end(line), isspace)) {
-                throw UnexpectedSymbolException(line, line_number, "Unexpected symbol after label.");
-            }
-            auto label_start = std::find_if_not(std::begin(line), std::end(line), isspace);
+bool Parser::IsSection(std::vector<std::string> const &tokens) {
+    return tokens[0] == ".data" || tokens[0] == ".text";
+}
 
-            if (pp::contains_which(label_start, colon_it, [](char c) { return !(isalnum(c) || c == '_'); })) {
-                    throw UnexpectedSymbolException(line, line_number,
-                                                    "Label name can only contain alpha-numeric characters and underscores");
-            }
-            std::string label_name = line.substr(label_start - std::begin(line), colon_it - label_start);
+bool Parser::IsDataDirective(std::string const &value) {
+    static std::string const directives[] = {".word", ".half", ".byte", ".space", ".align", ".ascii", ".asciiz"};
+    return std::find(std::begin(directives), std::end(directives), value) != std::end(directives);
+}
 
-            labels_before_function.emplace_back(label_name, instruction_number);
-            labels_[label_name] = std::pair(instruction_number + 1, CODE_SEGMENT_OFFSET + instruction_number * 4);
-        } else {
-            static std::string const expr = ".end";
-            auto dot_end = std::search(std::begin(line), std::end(line), std::begin(expr), std::end(expr));
-            if (dot_end != std::end(line)) {
-                if (dot_end != std::begin(line)) {
-                    throw UnexpectedSymbolException(line, line_number);
-                }
+bool Parser::HasLabelOffset(std::string const &operand) {
+    std::string const offset = operand.substr(0, operand.find('('));
+    return !offset.empty() && !IsImmediateValue(offset);
+}
 
-                auto end = std::find_if (std::rbegin(line), std::rend(line), isspace);
-
-                std::string function_name = line.substr(5, line.length() - (end - std::rbegin(line) - 4));
-                auto pair = std::find_if (labels_before_function.begin(), labels_before_function.end(),
-                                         [&function_name](std::pair<std::string, uint32_t> const &value) {
-                                             return value.first == function_name;
-                                         });
-                if (pair != labels_before_function.end()) {
-                    functions_[function_name] = CODE_SEGMENT_OFFSET + pair->second * 4;
-                    labels_before_function.clear();
-                } else {
-                    throw UnexpectedSymbolException(line, line_number,
-                                                    "Expected name of previously defined label.");
+bool Parser::SymbolAddress(std::string const &name, uint32_t *address) const {
+    auto data_label = data_labels_.find(name);
+    if (data_label != data_labels_.end()) {
+        *address = data_label->second;
+        return true;
+    }
+    auto label = labels_.find(name);
+    if (label != labels_.end()) {
+        *address = label->second.second;
+        return true;
+    }
+    return false;
+}
+
+uint32_t Parser::DataValue(std::string const &token, uint32_t line_number, bool resolve) const {
+    if (IsImmediateValue(token)) {
+        int64_t const value = ConstantValue(token);
+        if (value < INT32_MIN || value > UINT32_MAX) {
+            throw UnexpectedSymbolException(token, line_number, "Constant does not fit in 32 bits.");
+        }
+        return static_cast<uint32_t>(value);
+    }
+    if (token.size() >= 3 && token.front() == '\'' && token.back() == '\'') {
+        std::string character;
+        if (!Unescape(token.substr(1, token.size() - 2), &character) || character.size() != 1) {
+            throw UnexpectedSymbolException(token, line_number, "Expected one character.");
+        }
+        return static_cast<uint8_t>(character[0]);
+    }
+    // Labels are only known once the first pass is done; the size does not depend on them.
+    uint32_t address = 0;
+    if (resolve && !SymbolAddress(token, &address)) {
+        throw UnexpectedSymbolException(token, line_number, "Expected value or label name.");
+    }
+    return address;
+}
+
+void Parser::PlaceDataLabels() {
+    for (auto const &label : pending_data_labels_) {
+        data_labels_[label] = data_.address();
+    }
+    pending_data_labels_.clear();
+}
+
+void Parser::ProcessDataDirective(std::vector<std::string> const &tokens, std::size_t first, uint32_t line_number,
+                                  bool resolve) {
+    std::string const &directive = tokens[first];
+    if (!IsDataDirective(directive)) {
+        throw UnexpectedSymbolException(directive, line_number, "Expected data directive.");
+    }
+    if (tokens.size() < first + 2) {
+        throw UnexpectedSymbolException(directive, line_number, "Expected value.");
+    }
+    if (directive == ".align" || directive == ".space") {
+        if (tokens.size() != first + 2 || !IsImmediateValue(tokens[first + 1]) || ConstantValue(tokens[first + 1]) < 0
+            || (directive == ".align" && ConstantValue(tokens[first + 1]) > 16)) {
+            throw UnexpectedSymbolException(tokens.back(), line_number, directive == ".align"
+                                            ? "Expected alignment from 0 to 16."
+                                            : "Expected size.");
+        }
+        if (directive == ".align") {
+            // Labels before .align name the aligned address.
+            data_.Align(1u << ConstantValue(tokens[first + 1]));
+            return;
+        }
+        PlaceDataLabels();
+        data_.Append(1, 0, static_cast<uint64_t>(ConstantValue(tokens[first + 1])));
+    } else if (directive == ".ascii" || directive == ".asciiz") {
+        PlaceDataLabels();
+        for (std::size_t i = first + 1; i < tokens.size(); ++i) {
+            std::string const &token = tokens[i];
+            std::string text;
+            if (token.size() < 2 || token.front() != '"' || token.back() != '"'
+                || !Unescape(token.substr(1, token.size() - 2), &text)) {
+                throw UnexpectedSymbolException(token, line_number, "Expected string.");
+            }
+            if (directive == ".asciiz") {
+                text.push_back('\0');
+            }
+            data_.AppendBytes(text);
+        }
+    } else {
+        uint32_t const unit = directive == ".word" ? 4 : directive == ".half" ? 2 : 1;
+        data_.Align(unit);
+        PlaceDataLabels();
+        for (std::size_t i = first + 1; i < tokens.size(); ++i) {
+            std::string const &token = tokens[i];
+            std::size_t const colon = token[0] == '\'' ? std::string::npos : token.find(':');
+            uint64_t count = 1;
+            if (colon != std::string::npos) {
+                std::string const repeat = token.substr(colon + 1);
+                if (repeat.empty() || !IsImmediateValue(repeat) || ConstantValue(repeat) < 0) {
+                    throw UnexpectedSymbolException(token, line_number, "Expected value:count.");
                 }
-            } else {
-                if (!(line.empty() || line[0] == '#')) {
-                    ++instruction_number;
+                count = static_cast<uint64_t>(ConstantValue(repeat));
+            }
+            std::string const value = token.substr(0, colon);
+            uint32_t const word = DataValue(value, line_number, resolve);
+            if (resolve && count != 0 && labels_.count(value) != 0 && data_labels_.count(value) == 0) {
+                if (unit != 4) {
+                    throw UnexpectedSymbolException(token, line_number, "Code addresses need a .word.");
                 }
+                references_.push_back({static_cast<uint32_t>(data_.size()), SymbolReference::DATA, value, count});
             }
+            data_.Append(unit, word, count);
         }
-        ++line_number;
+    }
+    if (DATA_SEGMENT_OFFSET + data_.size() > 0x100000000ull) {
+        throw UnexpectedSymbolException(directive, line_number, "Data segment does not fit in the address space.");
     }
 }
 
-void Parser::CollectInstructions(std::ifstream &file) {
-	std::string line;
+void Parser::CollectLabelsAndFunctions() {
     uint32_t instruction_number = 0;
-    uint32_t line_number = 0;
-    file.clear();
-	file.seekg(0, std::ios::beg);
-	while(std::getline(file, line)) {
-        ++line_number;
-        if (line.empty() || line[0] == '#'
-           || line.find_first_of(':') != std::string::npos
-           || line.find(".end") != std::string::npos) {
-			continue;
-		}
-
-        auto it = std::find_if_not(std::begin(line), std::end(line), isspace);
-        if (it != line.end() && *it == '#') continue;
+    uint32_t statement_number = 0;
+    std::vector<std::pair<std::string, uint32_t>> labels_before_function;
+    bool in_data = false;
+    data_.Clear();
+    pending_data_labels_.clear();
+
+    for (auto const &line : lines_) {
+        auto const &tokens = line.tokens;
+        uint32_t const line_number = line.line_number;
+        current_file_ = line.file;
+        if (IsSection(tokens)) {
+            if (tokens.size() != 1) {
+                throw UnexpectedSymbolException(tokens.back(), line_number, "Sections cannot be given an address.");
+            }
+            if (tokens[0] == ".data" && relocatable_) {
+                throw UnexpectedSymbolException(tokens[0], line_number, "Object files cannot hold a data segment.");
+            }
+            PlaceDataLabels();
+            in_data = tokens[0] == ".data";
+        } else if (IsLabel(tokens)) {
+            std::string const &label = tokens[0];
+            bool const labels_data = in_data && tokens.size() > 1 && IsDataDirective(tokens[1]);
+            if ((tokens.size() != 1 && !labels_data) || label.find(':') != label.size() - 1) {
+                throw UnexpectedSymbolException(tokens.back(), line_number, "Unexpected symbol after label.");
+            }
+            if (label.size() == 1 || pp::contains_which(std::begin(label), std::end(label) - 1,
+                                                        [](char c) { return !(isalnum(c) || c == '_'); })) {
+                    throw UnexpectedSymbolException(label, line_number,
+                                                    "Label name can only contain alpha-numeric characters and underscores");
+            }
+            std::string label_name = label.substr(0, label.size() - 1);
+            if (in_data) {
+                pending_data_labels_.push_back(std::move(label_name));
+                if (labels_data) {
+                    ProcessDataDirective(tokens, 1, line_number, false);
+                }
+                continue;
+            }
 
-        auto end = std::find(std::begin(line), std::end(line), '#');
+            labels_before_function.emplace_back(label_name, instruction_number);
+            labels_[label_name] = std::pair(instruction_number + 1, CODE_SEGMENT_OFFSET + instruction_number * 4);
+        } else if (tokens[0] == ".end") {
+            if (tokens.size() != 2) {
+                throw UnexpectedSymbolException(tokens.back(), line_number);
+            }
+            std::string const &function_name = tokens[1];
+            auto pair = std::find_if (labels_before_function.begin(), labels_before_function.end(),
+                                     [&function_name](std::pair<std::string, uint32_t> const &value) {
+                                         return value.first == function_name;
+                                     });
+            if (pair != labels_before_function.end()) {
+                functions_[function_name] = CODE_SEGMENT_OFFSET + pair->second * 4;
+                labels_before_function.clear();
+            } else {
+                throw UnexpectedSymbolException(function_name, line_number,
+                                                "Expected name of previously defined label.");
+            }
+        } else if (in_data) {
+            ProcessDataDirective(tokens, 0, line_number, false);
+        } else {
+            instruction_number += ExpansionSize(tokens, statement_number);
+            ++statement_number;
+        }
+    }
+    PlaceDataLabels();
+}
 
-        std::string const delimeters = "\t ,;";
-        std::vector<std::string> tokens;
-        pp::split(std::begin(line), end,
-                  std::begin(delimeters), std::end(delimeters) - 1,
-                  std::back_inserter(tokens));
-        ProcessTokens(std::move(tokens), line_number, instruction_number);
-        ++instruction_number;
-	}
+void Parser::CollectInstructions() {
+    uint32_t statement_number = 0;
+    bool in_data = false;
+    data_.Clear();
+    for (auto const &line : lines_) {
+        current_file_ = line.file;
+        if (IsSection(line.tokens)) {
+            in_data = line.tokens[0] == ".data";
+            continue;
+        }
+        if (in_data && IsLabel(line.tokens) && line.tokens.size() > 1) {
+            ProcessDataDirective(line.tokens, 1, line.line_number, true);
+            continue;
+        }
+        if (IsLabel(line.tokens) || line.tokens[0] == ".end") {
+            continue;
+        }
+        if (in_data) {
+            ProcessDataDirective(line.tokens, 0, line.line_number, true);
+            continue;
+        }
+        if (IsDataDirective(line.tokens[0])) {
+            throw UnexpectedSymbolException(line.tokens[0], line.line_number, "Data directives belong after .data.");
+        }
+        std::vector<std::string> tokens = line.tokens;
+        std::size_t const first = instructions_.size();
+        ProcessTokens(std::move(tokens), line.line_number, statement_number);
+        for (std::size_t i = first; i < instructions_.size(); ++i) {
+            instructions_[i].file_ = line.file;
+        }
+        ++statement_number;
+    }
+    current_file_ = 0;
 }
 
 UnexpectedSymbolException::UnexpectedSymbolException(const std::string &symbol, uint32_t line, const std::string &info) {
@@ -377,5 +759,9 @@ const char *UnexpectedSymbolException::what() const noexcept {
     return message_.c_str();
 }
 
+void UnexpectedSymbolException::AddFile(std::string const &file_path) {
+    message_ += " (in " + file_path + ")";
+}
+
 } // namespace mips
 
@@ -0,0 +1,336 @@
+#include "peephole.h"
+#include "instructions.h"
+#include "register_effects.h"
+#include <algorithm>
+#include <cstdlib>
+#include <iomanip>
+
+namespace mips {
+
+namespace {
+
+using Slot = PeepholeOptimizer::Slot;
+
+int64_t Number(std::string const &token) {
+    return std::strtoll(token.c_str(), nullptr, 0);
+}
+
+// Immediates are encoded as 16 bits, so "65535" and "-1" are the same addi.
+int64_t SignedImmediate(std::string const &token) {
+    return static_cast<int16_t>(static_cast<uint16_t>(std::strtoul(token.c_str(), nullptr, 0)));
+}
+
+bool IsBranch(Parser::InstructionData const &data) {
+    return data.opcode() == Instruction::BEQ || data.opcode() == Instruction::BNE;
+}
+
+bool IsJump(Parser::InstructionData const &data) {
+    return data.opcode() == Instruction::J || data.opcode() == Instruction::JAL;
+}
+
+// Index of the instruction at a code address; may lie outside the program.
+int64_t AddressToIndex(int64_t address) {
+    return (address - CODE_SEGMENT_OFFSET) / 4;
+}
+
+// Target of a branch or jump as an index into the original program.
+int64_t TargetOf(std::vector<Slot> const &slots, std::size_t index) {
+    auto const &tokens = slots[index].data.tokens();
+    if (IsBranch(slots[index].data)) {
+        return static_cast<int64_t>(index) + 1 + Number(tokens[3]);
+    }
+    return AddressToIndex(Number(tokens[1]));
+}
+
+std::size_t NextAlive(std::vector<Slot> const &slots, std::size_t index) {
+    while (index < slots.size() && slots[index].removed) {
+        ++index;
+    }
+    return index;
+}
+
+// Whether the instruction at index keeps the pipeline fed: it fills the
+// shadow of a branch or jump, alone or in a run of nops straight after it, or
+// removing it would bring a producer and a consumer of its result closer than
+// the model allows. Such padding stays even where a rule could drop it.
+bool Pads(std::vector<Slot> const &slots, std::vector<RegisterEffects> const &effects, PipelineModel const &model,
+          std::size_t index) {
+    for (std::size_t i = index; i-- > 0;) {
+        if (slots[i].removed) {
+            continue;
+        }
+        if (effects[i].has_delay_slot()) {
+            return true;
+        }
+        if (effects[i].kind != RegisterEffects::ALU || effects[i].write != RegisterEffects::NO_REGISTER) {
+            break;
+        }
+    }
+    // Up to reach alive instructions on either side, nearest first.
+    uint32_t const reach = std::max({model.load_use, model.alu, model.branch_alu, model.branch_load});
+    std::vector<std::size_t> before;
+    for (std::size_t i = index; i-- > 0 && before.size() < reach;) {
+        if (!slots[i].removed) {
+            before.push_back(i);
+        }
+    }
+    std::vector<std::size_t> after;
+    for (std::size_t i = NextAlive(slots, index + 1); i < slots.size() && after.size() < reach;
+         i = NextAlive(slots, i + 1)) {
+        after.push_back(i);
+    }
+    for (std::size_t b = 0; b < before.size(); ++b) {
+        RegisterEffects const &producer = effects[before[b]];
+        if (producer.write == RegisterEffects::NO_REGISTER) {
+            continue;
+        }
+        for (std::size_t a = 0; a < after.size(); ++a) {
+            RegisterEffects const &consumer = effects[after[a]];
+            bool const reads = std::find(consumer.reads, consumer.reads + consumer.read_count, producer.write)
+                    != consumer.reads + consumer.read_count;
+            if (reads && b + a < model.Latency(producer.kind, consumer.read_class())) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+bool IsAluInstruction(Parser::InstructionData const &data) {
+    switch (data.opcode()) {
+    case Instruction::RTYPE:
+        return data.tokens()[0] != "jr" && data.tokens()[0] != "syscall";
+    case Instruction::ADDI:
+    case Instruction::ORI:
+    case Instruction::ANDI:
+    case Instruction::SLTI:
+    case Instruction::LUI:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// add/sub/and/or/slt/addi/ori/andi/slti/lui with $zero as destination.
+bool RemoveWriteToZero(Slot *const *window, std::vector<Slot> const &) {
+    auto const &data = window[0]->data;
+    if (IsAluInstruction(data) && data.tokens()[1] == "$zero") {
+        window[0]->removed = true;
+        return true;
+    }
+    return false;
+}
+
+// Moves of a register to itself: add/sub/or x, x, $zero, add/or x, $zero, x,
+// and/or x, x, x and addi/ori x, x, 0.
+bool RemoveIdentity(Slot *const *window, std::vector<Slot> const &) {
+    auto const &data = window[0]->data;
+    if (!IsAluInstruction(data)) {
+        return false;
+    }
+    auto const &tokens = data.tokens();
+    std::string const &op = tokens[0];
+    bool identity = false;
+    if (data.opcode() == Instruction::RTYPE) {
+        identity = ((op == "add" || op == "sub" || op == "or") && tokens[2] == tokens[1] && tokens[3] == "$zero")
+                || ((op == "add" || op == "or") && tokens[2] == "$zero" && tokens[3] == tokens[1])
+                || ((op == "and" || op == "or") && tokens[2] == tokens[1] && tokens[3] == tokens[1]);
+    } else if (data.opcode() == Instruction::ADDI || data.opcode() == Instruction::ORI) {
+        identity = tokens[2] == tokens[1] && SignedImmediate(tokens[3]) == 0;
+    }
+    if (identity) {
+        window[0]->removed = true;
+    }
+    return identity;
+}
+
+// addi r, r, a followed by addi r, r, b becomes addi r, r, a + b.
+bool MergeAddi(Slot *const *window, std::vector<Slot> const &) {
+    auto const &first = window[0]->data.tokens();
+    auto const &second = window[1]->data.tokens();
+    if (window[0]->data.opcode() != Instruction::ADDI || window[1]->data.opcode() != Instruction::ADDI
+            || first[1] != first[2] || second[1] != second[2] || first[1] != second[1]) {
+        return false;
+    }
+    int64_t const sum = SignedImmediate(first[3]) + SignedImmediate(second[3]);
+    if (sum < INT16_MIN || sum > INT16_MAX) {
+        return false;
+    }
+    std::vector<std::string> tokens = first;
+    tokens[3] = std::to_string(sum);
+    window[0]->data = Parser::InstructionData(Instruction::ADDI, std::move(tokens), window[0]->data.line_number(),
+                                                window[0]->data.file());
+    window[1]->removed = true;
+    return true;
+}
+
+// beq, bne or j whose target is the instruction that follows anyway.
+bool RemoveBranchToNext(Slot *const *window, std::vector<Slot> const &slots) {
+    auto const &data = window[0]->data;
+    if (!IsBranch(data) && data.opcode() != Instruction::J) {
+        return false;
+    }
+    std::size_t const index = static_cast<std::size_t>(window[0] - slots.data());
+    int64_t const target = TargetOf(slots, index);
+    if (target <= static_cast<int64_t>(index) || target > static_cast<int64_t>(slots.size())
+            || NextAlive(slots, index + 1) != NextAlive(slots, static_cast<std::size_t>(target))) {
+        return false;
+    }
+    window[0]->removed = true;
+    return true;
+}
+
+PeepholeOptimizer::Rule const RULES[] = {
+    {"write-to-zero", 1, RemoveWriteToZero},
+    {"identity-move", 1, RemoveIdentity},
+    {"merge-addi", 2, MergeAddi},
+    {"branch-to-next", 1, RemoveBranchToNext},
+};
+
+} // namespace
+
+PeepholeOptimizer::PeepholeOptimizer(std::vector<Parser::InstructionData> const &instructions,
+                                     std::unordered_map<std::string, uint32_t> functions,
+                                     PipelineModel const &model, std::vector<Parser::SymbolReference> references)
+        : functions_(std::move(functions)), references_(std::move(references)), model_(model) {
+    std::vector<Slot> slots;
+    slots.reserve(instructions.size());
+    for (auto const &data : instructions) {
+        slots.push_back({data});
+    }
+    for (auto const &reference : references_) {
+        slots[reference.instruction].address = true;
+    }
+    Optimize(slots);
+    Compact(slots);
+}
+
+void PeepholeOptimizer::Optimize(std::vector<Slot> &slots) {
+    for (std::size_t i = 0; i < slots.size(); ++i) {
+        auto const &data = slots[i].data;
+        if (IsBranch(data) || IsJump(data)) {
+            int64_t const target = TargetOf(slots, i);
+            if (target >= 0 && target < static_cast<int64_t>(slots.size())) {
+                slots[static_cast<std::size_t>(target)].target = true;
+            }
+        }
+        // Return address of a call.
+        if (data.opcode() == Instruction::JAL && i + 1 < slots.size()) {
+            slots[i + 1].target = true;
+        }
+    }
+    for (auto const &function : functions_) {
+        int64_t const entry = AddressToIndex(function.second);
+        if (entry >= 0 && entry < static_cast<int64_t>(slots.size())) {
+            slots[static_cast<std::size_t>(entry)].target = true;
+        }
+    }
+
+    for (auto const &rule : RULES) {
+        removed_.emplace_back(rule.name, 0);
+    }
+
+    // Rules keep the registers an instruction they rewrite reads and writes.
+    std::vector<RegisterEffects> effects;
+    effects.reserve(slots.size());
+    for (auto const &slot : slots) {
+        effects.push_back(RegisterEffects::Of(slot.data));
+    }
+    auto const fixed = [&](std::size_t index) {
+        return slots[index].address || Pads(slots, effects, model_, index);
+    };
+
+    std::vector<Slot *> window;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (std::size_t i = NextAlive(slots, 0); i < slots.size(); i = NextAlive(slots, i + 1)) {
+            for (std::size_t r = 0; r < std::size(RULES) && !slots[i].removed && !fixed(i); ++r) {
+                window.assign(1, &slots[i]);
+                for (std::size_t j = i + 1; j < slots.size() && window.size() < RULES[r].window; ++j) {
+                    // Removed targets resolve to the next survivor, so they split windows too.
+                    if (slots[j].target || (!slots[j].removed && fixed(j))) {
+                        break;
+                    }
+                    if (!slots[j].removed) {
+                        window.push_back(&slots[j]);
+                    }
+                }
+                if (window.size() < RULES[r].window) {
+                    continue;
+                }
+                std::size_t alive_before = 0;
+                for (Slot const *slot : window) {
+                    alive_before += !slot->removed;
+                }
+                if (RULES[r].apply(window.data(), slots)) {
+                    std::size_t alive_after = 0;
+                    for (Slot const *slot : window) {
+                        alive_after += !slot->removed;
+                    }
+                    removed_[r].second += static_cast<uint32_t>(alive_before - alive_after);
+                    changed = true;
+                }
+            }
+        }
+    }
+}
+
+void PeepholeOptimizer::Compact(std::vector<Slot> &slots) {
+    int64_t const old_size = static_cast<int64_t>(slots.size());
+    // new_index[i] is where original instruction i (or, if removed, the next survivor) ends up.
+    std::vector<int64_t> new_index(slots.size() + 1);
+    int64_t alive = 0;
+    for (std::size_t i = 0; i < slots.size(); ++i) {
+        new_index[i] = alive;
+        alive += !slots[i].removed;
+    }
+    new_index[slots.size()] = alive;
+    auto const map_index = [&](int64_t index) {
+        if (index < 0) {
+            return index;
+        }
+        if (index > old_size) {
+            return index - old_size + alive;
+        }
+        return new_index[static_cast<std::size_t>(index)];
+    };
+    auto const map_address = [&](int64_t address) {
+        if (address < CODE_SEGMENT_OFFSET || (address - CODE_SEGMENT_OFFSET) % 4 != 0) {
+            return address;
+        }
+        return CODE_SEGMENT_OFFSET + map_index(AddressToIndex(address)) * 4;
+    };
+
+    instructions_.reserve(static_cast<std::size_t>(alive));
+    for (std::size_t i = 0; i < slots.size(); ++i) {
+        if (slots[i].removed) {
+            continue;
+        }
+        auto const &data = slots[i].data;
+        std::vector<std::string> tokens = data.tokens();
+        if (IsBranch(data)) {
+            int64_t const target = map_index(TargetOf(slots, i));
+            tokens[3] = std::to_string(target - new_index[i] - 1);
+        } else if (IsJump(data)) {
+            tokens[1] = std::to_string(map_address(Number(tokens[1])));
+        }
+        instructions_.emplace_back(data.opcode(), std::move(tokens), data.line_number(), data.file());
+    }
+    for (auto &function : functions_) {
+        function.second = static_cast<uint32_t>(map_address(function.second));
+    }    for (auto &reference : references_) {
+        reference.instruction = static_cast<uint32_t>(new_index[reference.instruction]);
+    }
+}
+
+void PeepholeOptimizer::WriteReport(std::ostream &out) const {
+    uint32_t total = 0;
+    for (auto const &rule : removed_) {
+        out << std::left << std::setw(16) << rule.first << std::right << rule.second << " removed\n";
+        total += rule.second;
+    }
+    out << std::left << std::setw(16) << "total" << std::right << total << " removed\n";
+}
+
+} // namespace mips
@@ -0,0 +1,385 @@
+#include "preprocessor.h"
+#include "algorithms.h"
+#include "assembler.h"
+#include "parser.h"
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <fstream>
+#include <sys/stat.h>
+
+namespace mips {
+
+namespace {
+
+std::string InFile(std::string const &file_path, std::string const &info) {
+    return info + " (in " + file_path + ")";
+}
+
+std::string DirectoryOf(std::string const &file_path) {
+    std::size_t const slash = file_path.find_last_of('/');
+    if (slash == std::string::npos) {
+        return ".";
+    }
+    return slash == 0 ? "/" : file_path.substr(0, slash);
+}
+
+std::string CanonicalPath(std::string const &file_path) {
+    char resolved[PATH_MAX];
+    if (realpath(file_path.c_str(), resolved) == nullptr) {
+        throw FileNotFoundException(file_path);
+    }
+    return resolved;
+}
+
+std::string Unquote(std::string const &value) {
+    if (value.size() >= 2 && value.front() == '"' && value.back() == '"') {
+        return value.substr(1, value.size() - 2);
+    }
+    return value;
+}
+
+bool IsName(std::string const &value) {
+    return !value.empty() && !pp::contains_which(std::begin(value), std::end(value),
+                                                 [](char c) { return !(isalnum(c) || c == '_'); });
+}
+
+bool IsLabelDefinition(std::vector<std::string> const &tokens) {
+    return tokens.size() == 1 && tokens[0].size() > 1 && tokens[0].back() == ':';
+}
+
+void ReplaceAll(std::string &token, std::string const &from, std::string const &to) {
+    for (std::size_t at = token.find(from); at != std::string::npos; at = token.find(from, at + to.size())) {
+        token.replace(at, from.size(), to);
+    }
+}
+
+} // namespace
+
+IncludeCache::Lines IncludeCache::Load(std::string const &file_path) {
+    struct stat info;
+    if (stat(file_path.c_str(), &info) != 0) {
+        throw FileNotFoundException(file_path);
+    }
+    int64_t const mtime_ns = int64_t{info.st_mtim.tv_sec} * 1000000000 + info.st_mtim.tv_nsec;
+    int64_t const size = info.st_size;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto found = entries_.find(file_path);
+        if (found != entries_.end() && found->second.mtime_ns == mtime_ns && found->second.size == size) {
+            ++hits_;
+            return found->second.lines;
+        }
+    }
+
+    std::ifstream file(file_path);
+    if (!file.is_open()) {
+        throw FileNotFoundException(file_path);
+    }
+    Lines lines = std::make_shared<SourceFile const>(Preprocessor::Tokenize(file));
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_[file_path] = {mtime_ns, size, lines};
+    ++misses_;
+    return lines;
+}
+
+IncludeCache &IncludeCache::Shared() {
+    static IncludeCache cache;
+    return cache;
+}
+
+uint64_t IncludeCache::hits() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return hits_;
+}
+
+uint64_t IncludeCache::misses() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return misses_;
+}
+
+Preprocessor::Preprocessor(IncludeCache &cache) : cache_(cache) {}
+
+std::vector<std::string> Preprocessor::Tokenize(std::string const &line, std::string *annotation) {
+    // Quoted strings and characters are kept whole, delimiters, '#' and all.
+    std::vector<std::string> tokens;
+    std::string token;
+    char quote = 0;
+    for (std::size_t i = 0; i < line.size(); ++i) {
+        char const c = line[i];
+        if (quote != 0) {
+            token += c;
+            if (c == '\\' && i + 1 < line.size()) {
+                token += line[++i];
+            } else if (c == quote) {
+                quote = 0;
+            }
+        } else if (c == '#') {
+            std::size_t const at = line.find('@', i);
+            if (annotation != nullptr && at != std::string::npos) {
+                std::size_t const last = line.find_last_not_of(" \t\r");
+                *annotation = line.substr(at, last - at + 1);
+            }
+            break;
+        } else if (c == '\t' || c == ' ' || c == ',') {
+            if (!token.empty()) {
+                tokens.push_back(std::move(token));
+                token.clear();
+            }
+        } else {
+            if (c == '"' || c == '\'') {
+                quote = c;
+            }
+            token += c;
+        }
+    }
+    if (!token.empty()) {
+        tokens.push_back(std::move(token));
+    }
+    return tokens;
+}
+
+SourceFile Preprocessor::Tokenize(std::istream &source) {
+    SourceFile file;
+    std::string line;
+    std::string annotation;
+    uint32_t line_number = 0;
+    while (std::getline(source, line)) {
+        ++line_number;
+        auto tokens = Tokenize(line, &annotation);
+        if (!tokens.empty()) {
+            file.lines.push_back({std::move(tokens), line_number});
+        }
+        if (!annotation.empty()) {
+            file.annotations.push_back({std::move(annotation), line_number});
+            annotation.clear();
+        }
+    }
+    return file;
+}
+
+void Preprocessor::Reset() {
+    macros_.clear();
+    constants_.clear();
+    include_stack_.clear();
+    files_.clear();
+    annotations_.clear();
+    output_.clear();
+    depth_ = 0;
+    expansions_ = 0;
+}
+
+std::vector<SourceLine> Preprocessor::Process(std::string const &file_path) {
+    Reset();
+    std::string const path = CanonicalPath(file_path);
+    include_stack_.push_back(path);
+    ProcessFile(*cache_.Load(path), path, DirectoryOf(path));
+    return std::move(output_);
+}
+
+std::vector<SourceLine> Preprocessor::Process(std::istream &source, std::string const &directory) {
+    Reset();
+    ProcessFile(Tokenize(source), "<input>", directory);
+    return std::move(output_);
+}
+
+uint32_t Preprocessor::FileIndex(std::string const &file_path) {
+    auto found = std::find(std::begin(files_), std::end(files_), file_path);
+    if (found != std::end(files_)) {
+        return static_cast<uint32_t>(found - std::begin(files_));
+    }
+    files_.push_back(file_path);
+    return static_cast<uint32_t>(files_.size() - 1);
+}
+
+void Preprocessor::ProcessFile(SourceFile const &source, std::string const &file_path,
+                               std::string const &directory) {
+    // A file included again has its annotations already.
+    std::size_t const known = files_.size();
+    uint32_t const file = FileIndex(file_path);
+    if (file == known) {
+        for (auto const &annotation : source.annotations) {
+            annotations_.push_back({annotation.text, annotation.line_number, file});
+        }
+    }
+    ProcessLines(source.lines, file, directory, 0);
+}
+
+void Preprocessor::ProcessLines(std::vector<SourceLine> const &lines, uint32_t file, std::string const &directory,
+                                uint32_t line_number) {
+    // Copied, as includes grow files_.
+    std::string const file_path = files_[file];
+    for (std::size_t i = 0; i < lines.size(); ++i) {
+        SourceLine const &line = lines[i];
+        auto const &tokens = line.tokens;
+        uint32_t const output_line = line_number != 0 ? line_number : line.line_number;
+        if (tokens[0] == ".include") {
+            if (tokens.size() != 2) {
+                throw UnexpectedSymbolException(tokens.back(), line.line_number,
+                                                InFile(file_path, "Expected one file name."));
+            }
+            Include(Unquote(tokens[1]), directory, output_line);
+        } else if (tokens[0] == ".macro") {
+            // The name may carry the opening parenthesis: .macro name(%a, %b).
+            std::vector<std::string> header(std::begin(tokens) + 1, std::end(tokens));
+            if (header.empty()) {
+                throw UnexpectedSymbolException(tokens[0], line.line_number,
+                                                InFile(file_path, "Expected macro name."));
+            }
+            std::size_t const paren = header[0].find('(');
+            if (paren != std::string::npos) {
+                header.insert(std::begin(header) + 1, header[0].substr(paren));
+                header[0].resize(paren);
+            }
+            std::string const name = header[0];
+            if (!IsName(name)) {
+                throw UnexpectedSymbolException(name, line.line_number, InFile(file_path, "Invalid macro name."));
+            }
+            Macro macro;
+            for (std::size_t p = 1; p < header.size(); ++p) {
+                std::string parameter = header[p];
+                parameter.erase(std::remove_if(std::begin(parameter), std::end(parameter),
+                                               [](char c) { return c == '(' || c == ')'; }),
+                                std::end(parameter));
+                if (parameter.empty()) {
+                    continue;
+                }
+                if (parameter.size() < 2 || parameter[0] != '%' || !IsName(parameter.substr(1))) {
+                    throw UnexpectedSymbolException(header[p], line.line_number,
+                                                    InFile(file_path, "Macro parameters are % followed by a name."));
+                }
+                macro.parameters.push_back(parameter);
+            }
+            for (++i; i < lines.size() && lines[i].tokens[0] != ".endm"; ++i) {
+                if (lines[i].tokens[0] == ".macro") {
+                    throw UnexpectedSymbolException(".macro", lines[i].line_number,
+                                                    InFile(file_path, "Macros cannot be defined inside macros."));
+                }
+                if (IsLabelDefinition(lines[i].tokens)) {
+                    std::string const &label = lines[i].tokens[0];
+                    macro.labels.push_back(label.substr(0, label.size() - 1));
+                }
+                macro.body.push_back(lines[i]);
+            }
+            if (i == lines.size()) {
+                throw UnexpectedSymbolException(name, line.line_number, InFile(file_path, "Missing .endm."));
+            }
+            macros_[name] = std::move(macro);
+        } else if (tokens[0] == ".endm") {
+            throw UnexpectedSymbolException(tokens[0], line.line_number, InFile(file_path, "No macro to end."));
+        } else if (tokens[0] == ".eqv") {
+            if (tokens.size() != 3 || !IsName(tokens[1])) {
+                throw UnexpectedSymbolException(tokens.back(), line.line_number,
+                                                InFile(file_path, "Expected .eqv name value."));
+            }
+            std::vector<std::string> value = {tokens[2]};
+            Substitute(value);
+            constants_[tokens[1]] = value[0];
+        } else {
+            std::vector<std::string> statement = tokens;
+            Substitute(statement);
+            if (!Expand(statement, file, directory, output_line)) {
+                output_.push_back({std::move(statement), output_line, file});
+            }
+        }
+    }
+}
+
+void Preprocessor::Include(std::string const &path, std::string const &directory, uint32_t line_number) {
+    std::string const file_path = CanonicalPath(path[0] == '/' ? path : directory + "/" + path);
+    if (std::find(std::begin(include_stack_), std::end(include_stack_), file_path) != std::end(include_stack_)) {
+        throw UnexpectedSymbolException(path, line_number, "File includes itself.");
+    }
+    include_stack_.push_back(file_path);
+    IncludeCache::Lines lines = cache_.Load(file_path);
+    ProcessFile(*lines, file_path, DirectoryOf(file_path));
+    include_stack_.pop_back();
+}
+
+bool Preprocessor::Expand(std::vector<std::string> const &tokens, uint32_t file, std::string const &directory,
+                          uint32_t line_number) {
+    // Arguments may be written name(a, b), name (a, b) or name a, b.
+    std::string name = tokens[0];
+    std::vector<std::string> arguments(std::begin(tokens) + 1, std::end(tokens));
+    std::size_t const paren = name.find('(');
+    if (paren != std::string::npos) {
+        arguments.insert(std::begin(arguments), name.substr(paren));
+        name.resize(paren);
+    }
+    auto found = macros_.find(name);
+    if (found == macros_.end()) {
+        return false;
+    }
+    if (!arguments.empty() && arguments.front()[0] == '(' && arguments.back().back() == ')') {
+        arguments.front().erase(0, 1);
+        arguments.back().pop_back();
+        arguments.erase(std::remove(std::begin(arguments), std::end(arguments), std::string()), std::end(arguments));
+    }
+    Macro const macro = found->second;
+    if (arguments.size() != macro.parameters.size()) {
+        throw UnexpectedSymbolException(tokens[0], line_number,
+                                        "Macro " + name + " takes " + std::to_string(macro.parameters.size())
+                                        + " arguments.");
+    }
+    if (depth_ == MAX_DEPTH) {
+        throw UnexpectedSymbolException(tokens[0], line_number, "Macros nested too deeply.");
+    }
+
+    // Longer parameters first, so %ab is not taken for %a followed by b.
+    std::vector<std::size_t> order(macro.parameters.size());
+    for (std::size_t p = 0; p < order.size(); ++p) {
+        order[p] = p;
+    }
+    std::sort(std::begin(order), std::end(order), [&macro](std::size_t a, std::size_t b) {
+        return macro.parameters[a].size() > macro.parameters[b].size();
+    });
+    std::string const suffix = "_M" + std::to_string(expansions_++);
+    std::vector<SourceLine> body = macro.body;
+    for (auto &line : body) {
+        for (auto &token : line.tokens) {
+            for (auto const &label : macro.labels) {
+                if (token == label || token == label + ":") {
+                    token.insert(label.size(), suffix);
+                }
+            }
+            for (std::size_t p : order) {
+                ReplaceAll(token, macro.parameters[p], arguments[p]);
+            }
+        }
+    }
+    ++depth_;
+    ProcessLines(body, file, directory, line_number);
+    --depth_;
+    return true;
+}
+
+void Preprocessor::Substitute(std::vector<std::string> &tokens) const {
+    if (constants_.empty()) {
+        return;
+    }
+    for (auto &token : tokens) {
+        auto found = constants_.find(token);
+        if (found != constants_.end()) {
+            token = found->second;
+            continue;
+        }
+        if (token.size() > 1 && token[0] == '-') {
+            found = constants_.find(token.substr(1));
+            if (found != constants_.end()) {
+                std::string const &value = found->second;
+                token = value[0] == '-' ? value.substr(1) : "-" + value;
+                continue;
+            }
+        }
+        // The offset of a memory operand, NAME($sp).
+        std::size_t const paren = token.find('(');
+        if (paren != std::string::npos && paren != 0) {
+            found = constants_.find(token.substr(0, paren));
+            if (found != constants_.end()) {
+                token.replace(0, paren, found->second);
+            }
+        }
+    }
+}
+
+} // namespace mips
@@ -0,0 +1,164 @@
+#include "profiler.h"
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+
+namespace mips {
+
+static constexpr uint32_t NO_PARENT = 0xffffffffu;
+
+Profiler::Profiler(std::vector<uint32_t> code, std::unordered_map<std::string, uint32_t> const &functions)
+        : simulator_(code), code_(std::move(code)), counts_(code_.size()), current_(0) {
+    for (auto const &function : functions) {
+        functions_.emplace_back(function.second, function.first);
+    }
+    std::sort(std::begin(functions_), std::end(functions_));
+    if (functions_.empty() || functions_.front().first > CODE_SEGMENT_OFFSET) {
+        functions_.emplace(std::begin(functions_), CODE_SEGMENT_OFFSET, "[entry]");
+    }
+    nodes_.push_back({NO_PARENT, FunctionAt(CODE_SEGMENT_OFFSET), 0});
+}
+
+uint32_t Profiler::FunctionAt(uint32_t address) const {
+    auto next = std::upper_bound(std::begin(functions_), std::end(functions_), address,
+                                 [](uint32_t value, auto const &function) { return value < function.first; });
+    return next == std::begin(functions_) ? 0 : static_cast<uint32_t>(next - std::begin(functions_) - 1);
+}
+
+void Profiler::EnterFunction(uint32_t address) {
+    uint32_t callee = FunctionAt(address);
+    uint64_t edge = (static_cast<uint64_t>(nodes_[current_].function) << 32u) | callee;
+    ++calls_[edge];
+
+    uint64_t key = (static_cast<uint64_t>(current_) << 32u) | callee;
+    auto found = children_.find(key);
+    if (found != children_.end()) {
+        current_ = found->second;
+    } else {
+        nodes_.push_back({current_, callee, 0});
+        current_ = static_cast<uint32_t>(nodes_.size() - 1);
+        children_.emplace(key, current_);
+    }
+}
+
+void Profiler::ReturnFromFunction() {
+    if (nodes_[current_].parent != NO_PARENT) {
+        current_ = nodes_[current_].parent;
+    }
+}
+
+uint64_t Profiler::Run(uint64_t max_steps) {
+    uint64_t steps = 0;
+    while (steps < max_steps && !simulator_.halted()) {
+        uint32_t index = (simulator_.pc() - CODE_SEGMENT_OFFSET) / 4;
+        uint32_t word = code_[index];
+        simulator_.Step();
+        ++counts_[index];
+        ++nodes_[current_].samples;
+        if (Instruction::OpcodeOf(word) == Instruction::JAL) {
+            EnterFunction(simulator_.pc());
+        } else if (Instruction::OpcodeOf(word) == Instruction::RTYPE
+                   && Instruction::FunctOf(word) == Instruction::FUNCT_JR
+                   && Instruction::RsOf(word) == Instruction::RA) {
+            ReturnFromFunction();
+        }
+        ++steps;
+    }
+    return steps;
+}
+
+void Profiler::WriteFoldedStacks(std::ostream &out) const {
+    std::vector<uint32_t> stack;
+    for (std::size_t node = 0; node < nodes_.size(); ++node) {
+        if (nodes_[node].samples == 0) {
+            continue;
+        }
+        stack.clear();
+        for (uint32_t i = static_cast<uint32_t>(node); i != NO_PARENT; i = nodes_[i].parent) {
+            stack.push_back(nodes_[i].function);
+        }
+        for (auto it = stack.rbegin(); it != stack.rend(); ++it) {
+            out << (it == stack.rbegin() ? "" : ";") << functions_[*it].second;
+        }
+        out << ' ' << nodes_[node].samples << '\n';
+    }
+}
+
+void Profiler::WriteCounts(std::ostream &out) const {
+    out << std::hex << std::setfill('0');
+    for (std::size_t i = 0; i < counts_.size(); ++i) {
+        if (counts_[i] != 0) {
+            out << "0x" << std::setw(8) << CODE_SEGMENT_OFFSET + i * 4 << ' ' << std::dec << counts_[i] << std::hex
+                << '\n';
+        }
+    }
+    out << std::dec << std::setfill(' ');
+}
+
+void Profiler::WriteCallGraph(std::ostream &out) const {
+    std::vector<uint64_t> self(functions_.size());
+    std::vector<uint64_t> inclusive(functions_.size());
+    std::vector<bool> on_stack(functions_.size());
+    std::vector<uint32_t> stack;
+    for (std::size_t node = 0; node < nodes_.size(); ++node) {
+        self[nodes_[node].function] += nodes_[node].samples;
+        stack.clear();
+        for (uint32_t i = static_cast<uint32_t>(node); i != NO_PARENT; i = nodes_[i].parent) {
+            // Recursive frames of the same function count once.
+            if (!on_stack[nodes_[i].function]) {
+                on_stack[nodes_[i].function] = true;
+                stack.push_back(nodes_[i].function);
+                inclusive[nodes_[i].function] += nodes_[node].samples;
+            }
+        }
+        for (uint32_t function : stack) {
+            on_stack[function] = false;
+        }
+    }
+
+    out << std::setw(14) << "self" << std::setw(14) << "inclusive" << "  function\n";
+    for (std::size_t function = 0; function < functions_.size(); ++function) {
+        if (inclusive[function] != 0) {
+            out << std::setw(14) << self[function] << std::setw(14) << inclusive[function]
+                << "  " << functions_[function].second << '\n';
+        }
+    }
+
+    std::vector<std::pair<uint64_t, uint64_t>> edges(std::begin(calls_), std::end(calls_));
+    std::sort(std::begin(edges), std::end(edges));
+    out << '\n' << std::setw(14) << "calls" << "  caller -> callee\n";
+    for (auto const &edge : edges) {
+        out << std::setw(14) << edge.second << "  " << functions_[edge.first >> 32u].second
+            << " -> " << functions_[edge.first & 0xffffffffu].second << '\n';
+    }
+}
+
+void Profiler::WriteAnnotatedSource(std::vector<std::string> const &files,
+                                    std::vector<Parser::InstructionData> const &instructions,
+                                    std::ostream &out) const {
+    // Keyed by file in the upper half and line in the lower.
+    std::unordered_map<uint64_t, uint64_t> line_counts;
+    for (std::size_t i = 0; i < instructions.size() && i < counts_.size(); ++i) {
+        line_counts[uint64_t{instructions[i].file()} << 32u | instructions[i].line_number()] += counts_[i];
+    }
+
+    for (std::size_t file = 0; file < files.size(); ++file) {
+        if (file != 0) {
+            out << '\n' << std::setw(12) << "" << " | " << files[file] << ":\n";
+        }
+        std::ifstream source(files[file]);
+        std::string line;
+        uint32_t line_number = 0;
+        while (std::getline(source, line)) {
+            ++line_number;
+            auto found = line_counts.find(uint64_t{file} << 32u | line_number);
+            if (found != line_counts.end()) {
+                out << std::setw(12) << found->second << " | " << line << '\n';
+            } else {
+                out << std::setw(12) << "" << " | " << line << '\n';
+            }
+        }
+    }
+}
+
+} // namespace mips
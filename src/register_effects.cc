@@ -0,0 +1,74 @@
+#include "register_effects.h"
+
+namespace mips {
+
+RegisterEffects RegisterEffects::Of(Parser::InstructionData const &data) {
+    auto const &tokens = data.tokens();
+    RegisterEffects effects;
+    switch (data.opcode()) {
+    case Instruction::RTYPE:
+        if (tokens[0] == "jr") {
+            effects.kind = JUMP_REGISTER;
+            effects.Read(tokens[1]);
+        } else if (tokens[0] == "syscall") {
+            effects.kind = SYSCALL;
+            effects.Read(Instruction::V0);
+            effects.Read(Instruction::A0);
+            effects.Read(Instruction::A1);
+            effects.write = Instruction::V0;
+        } else {
+            effects.kind = ALU;
+            effects.Write(tokens[1]);
+            effects.Read(tokens[2]);
+            effects.Read(tokens[3]);
+        }
+        break;
+    case Instruction::BEQ:
+    case Instruction::BNE:
+        effects.kind = BRANCH;
+        effects.Read(tokens[1]);
+        effects.Read(tokens[2]);
+        break;
+    case Instruction::LW:
+        effects.kind = LOAD;
+        effects.Write(tokens[1]);
+        effects.Read(tokens[3]);
+        break;
+    case Instruction::SW:
+        effects.kind = STORE;
+        effects.Read(tokens[1]);
+        effects.Read(tokens[3]);
+        break;
+    case Instruction::J:
+        effects.kind = JUMP;
+        break;
+    case Instruction::JAL:
+        effects.kind = CALL;
+        effects.write = Instruction::RA;
+        break;
+    case Instruction::LUI:
+        effects.kind = ALU;
+        effects.Write(tokens[1]);
+        break;
+    default:
+        effects.kind = ALU;
+        effects.Write(tokens[1]);
+        effects.Read(tokens[2]);
+        break;
+    }
+    return effects;
+}
+
+void RegisterEffects::Read(std::string const &name) {
+    Instruction::Register reg = Instruction::RegisterNameToNumber(name);
+    if (reg != Instruction::ZERO) {
+        reads[read_count++] = static_cast<uint8_t>(reg);
+    }
+}
+
+void RegisterEffects::Write(std::string const &name) {
+    Instruction::Register reg = Instruction::RegisterNameToNumber(name);
+    write = reg == Instruction::ZERO ? NO_REGISTER : static_cast<uint8_t>(reg);
+}
+
+} // namespace mips
@@ -0,0 +1,438 @@
+#include "scheduler.h"
+#include "cfg.h"
+#include "instructions.h"
+#include "register_effects.h"
+#include <algorithm>
+#include <array>
+#include <cstdlib>
+#include <sstream>
+
+namespace mips {
+
+namespace {
+
+using Effects = RegisterEffects;
+using Kind = RegisterEffects::Kind;
+using Residue = RegisterResidue;
+
+constexpr int64_t NOP = -1;
+
+bool MaxInto(Residue &into, Residue const &from) {
+    bool changed = false;
+    for (std::size_t r = 0; r < into.size(); ++r) {
+        for (std::size_t c = 0; c < 2; ++c) {
+            if (from[r][c] > into[r][c]) {
+                into[r][c] = from[r][c];
+                changed = true;
+            }
+        }
+    }
+    return changed;
+}
+
+int64_t Number(std::string const &token) {
+    return std::strtoll(token.c_str(), nullptr, 0);
+}
+
+struct Block {
+    std::size_t begin;
+    std::size_t end;
+    std::vector<std::size_t> successors;
+};
+
+struct BlockSchedule {
+    std::vector<int64_t> order; // Original indices, NOP for inserted nops.
+    Residue exit;
+    uint32_t nops = 0;
+    bool filled = false;
+};
+
+class BlockScheduler {
+public:
+    BlockScheduler(std::vector<Effects> const &effects, PipelineModel const &model)
+            : effects_(effects), model_(model) {}
+
+    // Returns false if filler was given but cannot issue in the delay slot without a stall.
+    bool Schedule(Block const &block, Residue const &entry, int64_t filler, BlockSchedule *result) const;
+
+    // The last instruction of the block that no other instruction of it depends on, or NOP.
+    int64_t FindFiller(Block const &block) const;
+
+private:
+    struct Node {
+        std::size_t index;
+        std::vector<std::pair<std::size_t, uint32_t>> successors; // (node, latency)
+        uint32_t predecessors = 0;
+        int64_t height = 0;
+        int64_t earliest = 0;
+    };
+
+    std::vector<Node> BuildGraph(std::vector<std::size_t> const &indices) const;
+
+    std::vector<Effects> const &effects_;
+    PipelineModel const &model_;
+};
+
+std::vector<BlockScheduler::Node> BlockScheduler::BuildGraph(std::vector<std::size_t> const &indices) const {
+    std::vector<Node> nodes(indices.size());
+    std::array<int64_t, 32> last_writer;
+    last_writer.fill(-1);
+    std::array<std::vector<std::size_t>, 32> readers;
+    int64_t last_store = -1;
+    std::vector<std::size_t> loads;
+
+    auto const add_edge = [&](std::size_t from, std::size_t to, uint32_t latency) {
+        for (auto &edge : nodes[from].successors) {
+            if (edge.first == to) {
+                edge.second = std::max(edge.second, latency);
+                return;
+            }
+        }
+        nodes[from].successors.emplace_back(to, latency);
+        ++nodes[to].predecessors;
+    };
+
+    for (std::size_t n = 0; n < indices.size(); ++n) {
+        nodes[n].index = indices[n];
+        Effects const &effects = effects_[indices[n]];
+        for (uint8_t i = 0; i < effects.read_count; ++i) {
+            uint8_t const reg = effects.reads[i];
+            if (last_writer[reg] >= 0) {
+                auto const producer = static_cast<std::size_t>(last_writer[reg]);
+                add_edge(producer, n, model_.Latency(effects_[indices[producer]].kind, effects.read_class()));
+            }
+        }
+        if (effects.kind == Effects::LOAD || effects.kind == Effects::STORE) {
+            if (last_store >= 0) {
+                add_edge(static_cast<std::size_t>(last_store), n, 0);
+            }
+            if (effects.kind == Effects::STORE) {
+                for (std::size_t load : loads) {
+                    add_edge(load, n, 0);
+                }
+                loads.clear();
+                last_store = static_cast<int64_t>(n);
+            } else {
+                loads.push_back(n);
+            }
+        }
+        if (effects.write != Effects::NO_REGISTER) {
+            if (last_writer[effects.write] >= 0) {
+                add_edge(static_cast<std::size_t>(last_writer[effects.write]), n, 0);
+            }
+            for (std::size_t reader : readers[effects.write]) {
+                if (reader != n) {
+                    add_edge(reader, n, 0);
+                }
+            }
+            readers[effects.write].clear();
+            last_writer[effects.write] = static_cast<int64_t>(n);
+        }
+        for (uint8_t i = 0; i < effects.read_count; ++i) {
+            readers[effects.reads[i]].push_back(n);
+        }
+    }
+
+    for (std::size_t n = nodes.size(); n-- > 0;) {
+        for (auto const &edge : nodes[n].successors) {
+            nodes[n].height = std::max(nodes[n].height, nodes[edge.first].height + 1 + edge.second);
+        }
+    }
+    return nodes;
+}
+
+int64_t BlockScheduler::FindFiller(Block const &block) const {
+    std::vector<std::size_t> indices;
+    for (std::size_t i = block.begin; i < block.end; ++i) {
+        indices.push_back(i);
+    }
+    std::vector<Node> const nodes = BuildGraph(indices);
+    for (std::size_t n = nodes.size() - 1; n-- > 0;) {
+        if (nodes[n].successors.empty()) {
+            return static_cast<int64_t>(nodes[n].index);
+        }
+    }
+    return NOP;
+}
+
+bool BlockScheduler::Schedule(Block const &block, Residue const &entry, int64_t filler,
+                              BlockSchedule *result) const {
+    bool const terminated = effects_[block.end - 1].terminator();
+    std::size_t const body_end = terminated ? block.end - 1 : block.end;
+    std::vector<std::size_t> indices;
+    for (std::size_t i = block.begin; i < body_end; ++i) {
+        if (static_cast<int64_t>(i) != filler) {
+            indices.push_back(i);
+        }
+    }
+    std::vector<Node> nodes = BuildGraph(indices);
+    for (auto &node : nodes) {
+        Effects const &effects = effects_[node.index];
+        for (uint8_t i = 0; i < effects.read_count; ++i) {
+            node.earliest = std::max(node.earliest, entry[effects.reads[i]][effects.read_class()]);
+        }
+    }
+
+    Residue ready = entry;
+    result->order.clear();
+    result->nops = 0;
+    result->filled = false;
+    auto const issue = [&](std::size_t index) {
+        Effects const &effects = effects_[index];
+        int64_t const position = static_cast<int64_t>(result->order.size());
+        if (effects.write != Effects::NO_REGISTER) {
+            ready[effects.write][Effects::EXECUTE] = position + 1 + model_.Latency(effects.kind, Effects::EXECUTE);
+            ready[effects.write][Effects::DECODE] = position + 1 + model_.Latency(effects.kind, Effects::DECODE);
+        }
+        result->order.push_back(static_cast<int64_t>(index));
+    };
+    auto const earliest = [&](std::size_t index) {
+        Effects const &effects = effects_[index];
+        int64_t time = 0;
+        for (uint8_t i = 0; i < effects.read_count; ++i) {
+            time = std::max(time, ready[effects.reads[i]][effects.read_class()]);
+        }
+        return time;
+    };
+    auto const pad_until = [&](int64_t time) {
+        while (static_cast<int64_t>(result->order.size()) < time) {
+            result->order.push_back(NOP);
+            ++result->nops;
+        }
+    };
+
+    std::vector<std::size_t> candidates;
+    for (std::size_t n = 0; n < nodes.size(); ++n) {
+        if (nodes[n].predecessors == 0) {
+            candidates.push_back(n);
+        }
+    }
+    for (std::size_t scheduled = 0; scheduled < nodes.size();) {
+        int64_t const position = static_cast<int64_t>(result->order.size());
+        auto best = std::end(candidates);
+        for (auto it = std::begin(candidates); it != std::end(candidates); ++it) {
+            if (nodes[*it].earliest <= position
+                    && (best == std::end(candidates) || nodes[*it].height > nodes[*best].height
+                        || (nodes[*it].height == nodes[*best].height && *it < *best))) {
+                best = it;
+            }
+        }
+        if (best == std::end(candidates)) {
+            result->order.push_back(NOP);
+            ++result->nops;
+            continue;
+        }
+        std::size_t const n = *best;
+        candidates.erase(best);
+        issue(nodes[n].index);
+        ++scheduled;
+        for (auto const &edge : nodes[n].successors) {
+            Node &successor = nodes[edge.first];
+            successor.earliest = std::max(successor.earliest, position + 1 + edge.second);
+            if (--successor.predecessors == 0) {
+                candidates.push_back(edge.first);
+            }
+        }
+    }
+
+    if (terminated) {
+        std::size_t const terminator = block.end - 1;
+        pad_until(earliest(terminator));
+        issue(terminator);
+        if (model_.delay_slots && effects_[terminator].has_delay_slot()) {
+            if (filler != NOP) {
+                if (earliest(static_cast<std::size_t>(filler)) > static_cast<int64_t>(result->order.size())) {
+                    return false;
+                }
+                issue(static_cast<std::size_t>(filler));
+                result->filled = true;
+            } else {
+                pad_until(static_cast<int64_t>(result->order.size()) + 1);
+            }
+        }
+    }
+
+    int64_t const length = static_cast<int64_t>(result->order.size());
+    for (std::size_t r = 0; r < ready.size(); ++r) {
+        for (std::size_t c = 0; c < 2; ++c) {
+            result->exit[r][c] = std::max<int64_t>(0, ready[r][c] - length);
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+InvalidPipelineModelException::InvalidPipelineModelException(std::string const &spec) {
+    message_ = "Invalid pipeline model \"" + spec
+            + "\": expected key=value pairs of load, alu, branch-alu, branch-load and delay-slots.";
+}
+
+PipelineModel PipelineModel::Parse(std::string const &spec) {
+    PipelineModel model;
+    std::istringstream stream(spec);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        std::size_t const equals = item.find('=');
+        if (equals == std::string::npos || equals + 1 == item.size()
+                || item.find_first_not_of("0123456789", equals + 1) != std::string::npos) {
+            throw InvalidPipelineModelException(spec);
+        }
+        std::string const key = item.substr(0, equals);
+        uint32_t const value = static_cast<uint32_t>(std::stoul(item.substr(equals + 1)));
+        if (key == "load") {
+            model.load_use = value;
+        } else if (key == "alu") {
+            model.alu = value;
+        } else if (key == "branch-alu") {
+            model.branch_alu = value;
+        } else if (key == "branch-load") {
+            model.branch_load = value;
+        } else if (key == "delay-slots" && value <= 1) {
+            model.delay_slots = value == 1;
+        } else {
+            throw InvalidPipelineModelException(spec);
+        }
+    }
+    return model;
+}
+
+Scheduler::Scheduler(std::vector<Parser::InstructionData> const &instructions,
+                     std::unordered_map<std::string, uint32_t> functions, PipelineModel const &model,
+                     std::vector<Parser::SymbolReference> references)
+        : functions_(std::move(functions)), references_(std::move(references)) {
+    std::size_t const size = instructions.size();
+    if (size == 0) {
+        return;
+    }
+    std::vector<Effects> effects;
+    effects.reserve(size);
+    for (auto const &data : instructions) {
+        effects.push_back(Effects::Of(data));
+    }
+
+    // Scheduling stays within blocks; successors here are where pending
+    // latencies flow, so calls continue in the callee and returns at the
+    // return points of the function's callers.
+    ControlFlowGraph const cfg(instructions, functions_);
+    std::vector<Block> blocks;
+    std::vector<std::size_t> all_return_points;
+    for (auto const &block : cfg.blocks()) {
+        blocks.push_back({block.begin, block.end, block.successors});
+        if (block.callee != ControlFlowGraph::NONE && block.end < size) {
+            all_return_points.push_back(cfg.block_of(block.end));
+        }
+    }
+    for (std::size_t b = 0; b < blocks.size(); ++b) {
+        auto const &block = cfg.blocks()[b];
+        auto &successors = blocks[b].successors;
+        if (block.callee != ControlFlowGraph::NONE) {
+            successors.push_back(cfg.functions()[block.callee].entry);
+        }
+        if (effects[block.end - 1].kind != Effects::JUMP_REGISTER) {
+            continue;
+        }
+        if (block.function == ControlFlowGraph::NONE) {
+            successors.insert(std::end(successors), std::begin(all_return_points), std::end(all_return_points));
+            continue;
+        }
+        for (std::size_t caller : cfg.functions()[block.function].callers) {
+            if (cfg.blocks()[caller].end < size) {
+                successors.push_back(cfg.block_of(cfg.blocks()[caller].end));
+            }
+        }
+    }
+
+    BlockScheduler scheduler(effects, model);
+    std::vector<int64_t> fillers(blocks.size(), NOP);
+    if (model.delay_slots) {
+        for (std::size_t b = 0; b < blocks.size(); ++b) {
+            if (effects[blocks[b].end - 1].has_delay_slot()) {
+                fillers[b] = scheduler.FindFiller(blocks[b]);
+            }
+        }
+    }
+
+    Residue zero;
+    for (auto &reg : zero) {
+        reg.fill(0);
+    }
+    std::vector<Residue> entries(blocks.size(), zero);
+    std::vector<BlockSchedule> schedules(blocks.size());
+    for (bool changed = true; changed;) {
+        for (std::size_t b = 0; b < blocks.size(); ++b) {
+            if (!scheduler.Schedule(blocks[b], entries[b], fillers[b], &schedules[b])) {
+                fillers[b] = NOP;
+                scheduler.Schedule(blocks[b], entries[b], NOP, &schedules[b]);
+            }
+        }
+        changed = false;
+        for (std::size_t b = 0; b < blocks.size(); ++b) {
+            for (std::size_t successor : blocks[b].successors) {
+                changed |= MaxInto(entries[successor], schedules[b].exit);
+            }
+        }
+    }
+
+    std::vector<int64_t> block_start(blocks.size() + 1);
+    int64_t new_size = 0;
+    for (std::size_t b = 0; b < blocks.size(); ++b) {
+        block_start[b] = new_size;
+        new_size += static_cast<int64_t>(schedules[b].order.size());
+        nops_inserted_ += schedules[b].nops;
+        delay_slots_filled_ += schedules[b].filled;
+    }
+    blocks_ = static_cast<uint32_t>(blocks.size());
+
+    // Targets are block leaders, so they move with the start of their block.
+    auto const map_index = [&](int64_t index) {
+        if (index < 0) {
+            return index;
+        }
+        if (index >= static_cast<int64_t>(size)) {
+            return index - static_cast<int64_t>(size) + new_size;
+        }
+        return block_start[cfg.block_of(static_cast<std::size_t>(index))];
+    };
+    auto const map_address = [&](int64_t address) {
+        if (address < CODE_SEGMENT_OFFSET || (address - CODE_SEGMENT_OFFSET) % 4 != 0) {
+            return address;
+        }
+        return CODE_SEGMENT_OFFSET + map_index((address - CODE_SEGMENT_OFFSET) / 4) * 4;
+    };
+
+    instructions_.reserve(static_cast<std::size_t>(new_size));
+    std::vector<uint32_t> position(size);
+    for (auto const &schedule : schedules) {
+        for (int64_t index : schedule.order) {
+            if (index == NOP) {
+                instructions_.emplace_back(Instruction::RTYPE,
+                                           std::vector<std::string>{"add", "$zero", "$zero", "$zero"});
+                continue;
+            }
+            position[static_cast<std::size_t>(index)] = static_cast<uint32_t>(instructions_.size());
+            auto const &data = instructions[static_cast<std::size_t>(index)];
+            std::vector<std::string> tokens = data.tokens();
+            Kind const kind = effects[static_cast<std::size_t>(index)].kind;
+            if (kind == Effects::BRANCH) {
+                int64_t const position = static_cast<int64_t>(instructions_.size());
+                tokens[3] = std::to_string(map_index(cfg.TargetOf(static_cast<std::size_t>(index))) - position - 1);
+            } else if (kind == Effects::JUMP || kind == Effects::CALL) {
+                tokens[1] = std::to_string(map_address(Number(tokens[1])));
+            }
+            instructions_.emplace_back(data.opcode(), std::move(tokens), data.line_number(), data.file());
+        }
+    }
+    for (auto &function : functions_) {
+        function.second = static_cast<uint32_t>(map_address(function.second));
+    }    for (auto &reference : references_) {
+        reference.instruction = position[reference.instruction];
+    }
+}
+
+void Scheduler::WriteReport(std::ostream &out) const {
+    out << "Scheduled " << blocks_ << " basic blocks: " << nops_inserted_ << " nops inserted, "
+        << delay_slots_filled_ << " delay slots filled.\n";
+}
+
+} // namespace mips
@@ -0,0 +1,296 @@
+#include "simulator.h"
+#include "assembler.h"
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace mips {
+
+namespace {
+
+std::string ToHex(uint32_t value) {
+    std::ostringstream stream;
+    stream << "0x";
+    stream.width(8);
+    stream.fill('0');
+    stream << std::hex << value;
+    return stream.str();
+}
+
+constexpr char SNAPSHOT_MAGIC[8] = {'M', 'I', 'P', 'S', 'S', 'N', 'P', '2'};
+constexpr uint32_t SNAPSHOT_VERSION = 2;
+
+// Stored in host byte order, like the pages that follow it. The header is
+// followed by page_count uint32 page numbers, then, from the next page
+// boundary, the pages themselves in the same order.
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t pc;
+    uint32_t page_count;
+    uint32_t code_words;
+    uint64_t code_hash;
+    uint32_t registers[32];
+};
+
+uint64_t PagesOffset(uint32_t page_count) {
+    uint64_t const directory_end = sizeof(SnapshotHeader) + uint64_t{page_count} * 4;
+    return (directory_end + GuestMemory::PAGE_SIZE - 1) / GuestMemory::PAGE_SIZE * GuestMemory::PAGE_SIZE;
+}
+
+// FNV-1a, so a snapshot is not restored under a different program.
+uint64_t HashCode(std::vector<uint32_t> const &code) {
+    uint64_t hash = 14695981039346656037ull;
+    for (uint32_t word : code) {
+        for (int i = 0; i < 4; ++i) {
+            hash ^= (word >> (8 * i)) & 0xffu;
+            hash *= 1099511628211ull;
+        }
+    }
+    return hash;
+}
+
+// Closes a POSIX file descriptor on scope exit.
+class FileDescriptor {
+public:
+    explicit FileDescriptor(int fd) : fd_(fd) {}
+    ~FileDescriptor() {
+        if (fd_ >= 0) {
+            close(fd_);
+        }
+    }
+    FileDescriptor(FileDescriptor const &) = delete;
+    FileDescriptor &operator=(FileDescriptor const &) = delete;
+
+    int get() const { return fd_; }
+
+private:
+    int fd_;
+};
+
+} // namespace
+
+MemoryAccessException::MemoryAccessException(uint32_t address, uint32_t pc) {
+    message_ = "Invalid memory access at address " + ToHex(address)
+            + " by instruction at " + ToHex(pc) + ".";
+}
+
+InvalidInstructionException::InvalidInstructionException(uint32_t word, uint32_t pc) {
+    message_ = "Invalid instruction " + ToHex(word) + " at " + ToHex(pc) + ".";
+}
+
+InvalidSnapshotException::InvalidSnapshotException(std::string const &file_path, std::string const &info) {
+    message_ = "Invalid snapshot " + file_path + ": " + info;
+}
+
+Simulator::Simulator(std::vector<uint32_t> code)
+        : code_(std::move(code)), pc_(CODE_SEGMENT_OFFSET), code_end_(static_cast<uint32_t>(code_.size() * 4)) {
+    registers_[Instruction::SP] = STACK_TOP;
+}
+
+Simulator Simulator::FromSnapshot(std::vector<uint32_t> code, std::string const &file_path) {
+    FileDescriptor file(open(file_path.c_str(), O_RDONLY));
+    if (file.get() < 0) {
+        throw FileNotFoundException(file_path);
+    }
+    SnapshotHeader header;
+    if (pread(file.get(), &header, sizeof(header), 0) != static_cast<ssize_t>(sizeof(header))
+            || std::memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0
+            || header.version != SNAPSHOT_VERSION) {
+        throw InvalidSnapshotException(file_path, "not a snapshot file.");
+    }
+    if (header.code_words != code.size() || header.code_hash != HashCode(code)) {
+        throw InvalidSnapshotException(file_path, "taken from a different program.");
+    }
+
+    std::vector<uint32_t> page_numbers(header.page_count);
+    ssize_t const directory_size = static_cast<ssize_t>(page_numbers.size() * 4);
+    uint64_t const pages_offset = PagesOffset(header.page_count);
+    uint64_t const pages_size = uint64_t{header.page_count} * GuestMemory::PAGE_SIZE;
+    struct stat info;
+    if (pread(file.get(), page_numbers.data(), static_cast<std::size_t>(directory_size), sizeof(header))
+                != directory_size
+            || fstat(file.get(), &info) != 0
+            || static_cast<uint64_t>(info.st_size) < pages_offset + pages_size) {
+        throw InvalidSnapshotException(file_path, "truncated page data.");
+    }
+
+    Simulator simulator(std::move(code));
+    if (header.page_count != 0) {
+        void *pages = mmap(nullptr, pages_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                           file.get(), static_cast<off_t>(pages_offset));
+        if (pages == MAP_FAILED) {
+            throw InvalidSnapshotException(file_path, "pages cannot be mapped.");
+        }
+        simulator.memory_.AdoptMapping(pages, header.page_count, page_numbers.data());
+    }
+    simulator.pc_ = header.pc;
+    std::memcpy(simulator.registers_, header.registers, sizeof(simulator.registers_));
+    return simulator;
+}
+
+void Simulator::SaveSnapshot(std::string const &file_path) const {
+    FileDescriptor file(open(file_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644));
+    if (file.get() < 0) {
+        throw FileNotFoundException(file_path);
+    }
+
+    auto pages = memory_.Pages();
+    pages.erase(std::remove_if(std::begin(pages), std::end(pages), [](auto const &page) {
+        return std::all_of(page.second, page.second + GuestMemory::PAGE_WORDS,
+                           [](uint32_t word) { return word == 0; });
+    }), std::end(pages));
+
+    SnapshotHeader header = {};
+    std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    header.version = SNAPSHOT_VERSION;
+    header.pc = pc_;
+    header.page_count = static_cast<uint32_t>(pages.size());
+    header.code_words = static_cast<uint32_t>(code_.size());
+    header.code_hash = HashCode(code_);
+    std::memcpy(header.registers, registers_, sizeof(registers_));
+
+    uint64_t const pages_offset = PagesOffset(header.page_count);
+    std::vector<char> head(pages_offset, 0);
+    std::memcpy(head.data(), &header, sizeof(header));
+    for (std::size_t i = 0; i < pages.size(); ++i) {
+        std::memcpy(head.data() + sizeof(header) + i * 4, &pages[i].first, 4);
+    }
+
+    bool written = pwrite(file.get(), head.data(), head.size(), 0) == static_cast<ssize_t>(head.size());
+    for (std::size_t i = 0; written && i < pages.size(); ++i) {
+        written = pwrite(file.get(), pages[i].second, GuestMemory::PAGE_SIZE,
+                         static_cast<off_t>(pages_offset + i * GuestMemory::PAGE_SIZE))
+                == static_cast<ssize_t>(GuestMemory::PAGE_SIZE);
+    }
+    if (!written) {
+        throw InvalidSnapshotException(file_path, "write failed.");
+    }
+}
+
+void Simulator::set_reg(Instruction::Register reg, uint32_t value) {
+    if (reg != Instruction::ZERO) {
+        registers_[reg] = value;
+    }
+}
+
+void Simulator::Exit(uint32_t code) {
+    exited_ = true;
+    exit_code_ = code;
+}
+
+uint32_t Simulator::Load(uint32_t address) const {
+    if ((address & 3u) != 0) {
+        throw MemoryAccessException(address, pc_);
+    }
+    return memory_.Load(address);
+}
+
+void Simulator::Store(uint32_t address, uint32_t value) {
+    if ((address & 3u) != 0) {
+        throw MemoryAccessException(address, pc_);
+    }
+    memory_.Store(address, value);
+}
+
+bool Simulator::Step() {
+    if (halted()) {
+        return false;
+    }
+
+    uint32_t word = code_[(pc_ - CODE_SEGMENT_OFFSET) / 4];
+    uint32_t rs = Instruction::RsOf(word);
+    uint32_t rt = Instruction::RtOf(word);
+    uint32_t next_pc = pc_ + 4;
+
+    switch (Instruction::OpcodeOf(word)) {
+    case Instruction::RTYPE: {
+        uint32_t a = registers_[rs];
+        uint32_t b = registers_[rt];
+        uint32_t result;
+        switch (Instruction::FunctOf(word)) {
+        case Instruction::FUNCT_ADD: result = a + b; break;
+        case Instruction::FUNCT_SUB: result = a - b; break;
+        case Instruction::FUNCT_AND: result = a & b; break;
+        case Instruction::FUNCT_OR:  result = a | b; break;
+        case Instruction::FUNCT_SLT:
+            result = static_cast<int32_t>(a) < static_cast<int32_t>(b);
+            break;
+        case Instruction::FUNCT_JR:
+            pc_ = a;
+            return true;
+        case Instruction::FUNCT_SYSCALL:
+            if (syscall_handler_ == nullptr) {
+                throw InvalidInstructionException(word, pc_);
+            }
+            syscall_handler_->Handle(*this);
+            registers_[Instruction::ZERO] = 0;
+            pc_ = next_pc;
+            return true;
+        default:
+            throw InvalidInstructionException(word, pc_);
+        }
+        registers_[Instruction::RdOf(word)] = result;
+        break;
+    }
+    case Instruction::ADDI:
+        registers_[rt] = registers_[rs] + Instruction::SignedImm16Of(word);
+        break;
+    case Instruction::ANDI:
+        registers_[rt] = registers_[rs] & Instruction::Imm16Of(word);
+        break;
+    case Instruction::ORI:
+        registers_[rt] = registers_[rs] | Instruction::Imm16Of(word);
+        break;
+    case Instruction::SLTI:
+        registers_[rt] = static_cast<int32_t>(registers_[rs])
+                < static_cast<int32_t>(Instruction::SignedImm16Of(word));
+        break;
+    case Instruction::LUI:
+        registers_[rt] = Instruction::Imm16Of(word) << 16u;
+        break;
+    case Instruction::LW:
+        registers_[rt] = Load(registers_[rs] + Instruction::SignedImm16Of(word));
+        break;
+    case Instruction::SW:
+        Store(registers_[rs] + Instruction::SignedImm16Of(word), registers_[rt]);
+        break;
+    case Instruction::BEQ:
+        if (registers_[rs] == registers_[rt]) {
+            next_pc += Instruction::SignedImm16Of(word) << 2u;
+        }
+        break;
+    case Instruction::BNE:
+        if (registers_[rs] != registers_[rt]) {
+            next_pc += Instruction::SignedImm16Of(word) << 2u;
+        }
+        break;
+    case Instruction::JAL:
+        registers_[Instruction::RA] = next_pc;
+        next_pc = (pc_ & 0xfc000000u) | Instruction::TargetOf(word);
+        break;
+    case Instruction::J:
+        next_pc = (pc_ & 0xfc000000u) | Instruction::TargetOf(word);
+        break;
+    default:
+        throw InvalidInstructionException(word, pc_);
+    }
+
+    registers_[Instruction::ZERO] = 0;
+    pc_ = next_pc;
+    return true;
+}
+
+uint64_t Simulator::Run(uint64_t max_steps) {
+    uint64_t steps = 0;
+    while (steps < max_steps && Step()) {
+        ++steps;
+    }
+    return steps;
+}
+
+} // namespace mips
@@ -0,0 +1,234 @@
+#include "source_map.h"
+#include "assembler.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+
+namespace mips {
+
+namespace {
+
+constexpr char SOURCE_MAP_MAGIC[8] = {'M', 'I', 'P', 'S', 'M', 'A', 'P', '1'};
+constexpr uint32_t SOURCE_MAP_VERSION = 2;
+
+struct SourceMapHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t end;
+    uint32_t line_count;
+    uint32_t symbol_count;
+    uint32_t string_size;
+    uint32_t file_count;
+};
+
+uint64_t SourceMapSize(SourceMapHeader const &header) {
+    return sizeof(SourceMapHeader) + uint64_t{header.line_count} * sizeof(SourceMapLine)
+            + uint64_t{header.symbol_count} * sizeof(SourceMapSymbol)
+            + uint64_t{header.file_count} * sizeof(SourceMapFile) + header.string_size;
+}
+
+// "addi $a0, $zero, 6", "lw $t0, 4($sp)"
+std::string InstructionText(std::vector<std::string> const &tokens) {
+    if (tokens.size() == 4 && (tokens[0] == "lw" || tokens[0] == "sw")) {
+        return tokens[0] + " " + tokens[1] + ", " + tokens[2] + "(" + tokens[3] + ")";
+    }
+    std::string text = tokens.empty() ? std::string() : tokens[0];
+    for (std::size_t i = 1; i < tokens.size(); ++i) {
+        text += (i == 1 ? " " : ", ") + tokens[i];
+    }
+    return text;
+}
+
+} // namespace
+
+InvalidSourceMapException::InvalidSourceMapException(std::string const &file_path, std::string const &info) {
+    message_ = "Invalid source map " + file_path + ": " + info;
+}
+
+SourceMap::SourceMap(std::string const &file_path) : file_path_(file_path), file_(file_path) {
+    if (file_.size() < sizeof(SourceMapHeader)) {
+        throw InvalidSourceMapException(file_path, "not a source map.");
+    }
+    if (file_.data() == nullptr) {
+        throw InvalidSourceMapException(file_path, "cannot be mapped.");
+    }
+
+    auto const *header = static_cast<SourceMapHeader const *>(file_.data());
+    if (std::memcmp(header->magic, SOURCE_MAP_MAGIC, sizeof(SOURCE_MAP_MAGIC)) != 0
+            || header->version != SOURCE_MAP_VERSION) {
+        throw InvalidSourceMapException(file_path, "not a source map.");
+    }
+    if (SourceMapSize(*header) != file_.size()) {
+        throw InvalidSourceMapException(file_path, "truncated or oversized.");
+    }
+    end_ = header->end;
+    line_count_ = header->line_count;
+    symbol_count_ = header->symbol_count;
+    file_count_ = header->file_count;
+    lines_ = reinterpret_cast<SourceMapLine const *>(header + 1);
+    symbols_ = reinterpret_cast<SourceMapSymbol const *>(lines_ + line_count_);
+    files_ = reinterpret_cast<SourceMapFile const *>(symbols_ + symbol_count_);
+    strings_ = reinterpret_cast<char const *>(files_ + file_count_);
+
+    // Lookup relies on both tables being sorted and the lines covering the code from its start.
+    if (line_count_ != 0 && lines_[0].address != CODE_SEGMENT_OFFSET) {
+        throw InvalidSourceMapException(file_path, "lines do not start at the code.");
+    }
+    for (uint32_t i = 0; i < line_count_; ++i) {
+        if (lines_[i].address >= end_ || lines_[i].file >= file_count_
+                || (i != 0 && lines_[i].address <= lines_[i - 1].address)) {
+            throw InvalidSourceMapException(file_path, "line " + std::to_string(i) + " is out of order.");
+        }
+    }
+    for (uint32_t i = 0; i < symbol_count_; ++i) {
+        SourceMapSymbol const &symbol = symbols_[i];
+        if (uint64_t{symbol.name} + symbol.name_length > header->string_size
+                || (i != 0 && symbol.address <= symbols_[i - 1].address)) {
+            throw InvalidSourceMapException(file_path, "symbol " + std::to_string(i) + " is out of range.");
+        }
+    }
+    for (uint32_t i = 0; i < file_count_; ++i) {
+        if (uint64_t{files_[i].name} + files_[i].name_length > header->string_size) {
+            throw InvalidSourceMapException(file_path, "file " + std::to_string(i) + " is out of range.");
+        }
+    }
+}
+
+bool SourceMap::Lookup(uint32_t address, SourceLocation *location) const {
+    if (address < CODE_SEGMENT_OFFSET || address >= end_ || line_count_ == 0) {
+        return false;
+    }
+    SourceMapLine const *line = std::upper_bound(lines_, lines_ + line_count_, address,
+                                                 [](uint32_t value, SourceMapLine const &entry) {
+        return value < entry.address;
+    });
+    location->file = name(files_[line[-1].file]);
+    location->line = line[-1].line;
+    SourceMapSymbol const *symbol = std::upper_bound(symbols_, symbols_ + symbol_count_, address,
+                                                     [](uint32_t value, SourceMapSymbol const &entry) {
+        return value < entry.address;
+    });
+    if (symbol == symbols_) {
+        location->symbol = std::string_view();
+        location->offset = address - CODE_SEGMENT_OFFSET;
+    } else {
+        location->symbol = name(symbol[-1]);
+        location->offset = address - symbol[-1].address;
+    }
+    return true;
+}
+
+void SourceMap::Write(std::string const &file_path, std::vector<Parser::InstructionData> const &instructions,
+                      std::vector<Label> const &labels, std::unordered_map<std::string, uint32_t> const &functions,
+                      std::vector<std::string> const &files) {
+    std::vector<SourceMapLine> lines;
+    for (std::size_t i = 0; i < instructions.size(); ++i) {
+        uint32_t const line = instructions[i].line_number();
+        uint32_t const file = instructions[i].file();
+        if (lines.empty() || lines.back().line != line || lines.back().file != file) {
+            lines.push_back({static_cast<uint32_t>(CODE_SEGMENT_OFFSET + i * 4), line, file});
+        }
+    }
+
+    std::string strings;
+    std::vector<SourceMapFile> file_table;
+    for (auto const &name : files) {
+        file_table.push_back({static_cast<uint32_t>(strings.size()), static_cast<uint32_t>(name.size())});
+        strings += name;
+    }
+
+    std::vector<SourceMapSymbol> symbols;
+    for (std::size_t i = 0; i < labels.size();) {
+        std::size_t chosen = i;
+        std::size_t j = i;
+        for (; j < labels.size() && labels[j].first == labels[i].first; ++j) {
+            if (functions.count(labels[j].second) != 0 && functions.count(labels[chosen].second) == 0) {
+                chosen = j;
+            }
+        }
+        if (labels[i].first < instructions.size()) {
+            std::string const &name = labels[chosen].second;
+            symbols.push_back({static_cast<uint32_t>(CODE_SEGMENT_OFFSET + labels[i].first * 4),
+                               static_cast<uint32_t>(strings.size()), static_cast<uint32_t>(name.size()), 0});
+            strings += name;
+        }
+        i = j;
+    }
+
+    SourceMapHeader header = {};
+    std::memcpy(header.magic, SOURCE_MAP_MAGIC, sizeof(SOURCE_MAP_MAGIC));
+    header.version = SOURCE_MAP_VERSION;
+    header.end = static_cast<uint32_t>(CODE_SEGMENT_OFFSET + instructions.size() * 4);
+    header.line_count = static_cast<uint32_t>(lines.size());
+    header.symbol_count = static_cast<uint32_t>(symbols.size());
+    header.file_count = static_cast<uint32_t>(file_table.size());
+    header.string_size = static_cast<uint32_t>(strings.size());
+
+    std::ofstream file(file_path, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+        throw FileNotFoundException(file_path);
+    }
+    file.write(reinterpret_cast<char const *>(&header), sizeof(header));
+    file.write(reinterpret_cast<char const *>(lines.data()),
+               static_cast<std::streamsize>(lines.size() * sizeof(SourceMapLine)));
+    file.write(reinterpret_cast<char const *>(symbols.data()),
+               static_cast<std::streamsize>(symbols.size() * sizeof(SourceMapSymbol)));
+    file.write(reinterpret_cast<char const *>(file_table.data()),
+               static_cast<std::streamsize>(file_table.size() * sizeof(SourceMapFile)));
+    file.write(strings.data(), static_cast<std::streamsize>(strings.size()));
+    if (!file) {
+        throw InvalidSourceMapException(file_path, "write failed.");
+    }
+}
+
+void SourceMap::WriteListing(std::ostream &out, std::vector<Parser::InstructionData> const &instructions,
+                             std::vector<uint32_t> const &code, std::vector<Label> const &labels,
+                             std::vector<std::string> const &files) {
+    std::vector<std::vector<std::string>> texts;
+    for (auto const &file_path : files) {
+        std::ifstream source(file_path);
+        if (!source.is_open()) {
+            throw FileNotFoundException(file_path);
+        }
+        std::vector<std::string> &text = texts.emplace_back();
+        for (std::string line; std::getline(source, line);) {
+            std::size_t const first = line.find_first_not_of(" \t");
+            std::size_t const last = line.find_last_not_of(" \t\r");
+            text.push_back(first == std::string::npos ? std::string() : line.substr(first, last - first + 1));
+        }
+    }
+
+    auto label = std::begin(labels);
+    uint32_t previous_line = 0;
+    uint32_t previous_file = UINT32_MAX;
+    out << std::setfill('0');
+    for (std::size_t i = 0; i < instructions.size(); ++i) {
+        uint32_t const file = instructions[i].file();
+        if (file != previous_file && file < files.size()) {
+            out << "# " << files[file] << '\n';
+        }
+        for (; label != std::end(labels) && label->first <= i; ++label) {
+            out << label->second << ":\n";
+        }
+        uint32_t const line = instructions[i].line_number();
+        std::string instruction = InstructionText(instructions[i].tokens());
+        std::vector<std::string> const *text = file < texts.size() ? &texts[file] : nullptr;
+        if ((line != previous_line || file != previous_file) && text != nullptr && line >= 1
+                && line <= text->size() && !(*text)[line - 1].empty()) {
+            instruction.resize(std::max<std::size_t>(instruction.size(), 28), ' ');
+            instruction += "  " + (*text)[line - 1];
+        }
+        out << "0x" << std::hex << std::setw(8) << CODE_SEGMENT_OFFSET + i * 4 << "  0x" << std::setw(8) << code[i]
+            << std::dec << std::setfill(' ') << std::setw(7) << line << "  " << instruction << std::setfill('0')
+            << '\n';
+        previous_line = line;
+        previous_file = file;
+    }
+    for (; label != std::end(labels); ++label) {
+        out << label->second << ":\n";
+    }
+    out << std::setfill(' ');
+}
+
+} // namespace mips
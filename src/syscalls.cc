@@ -0,0 +1,176 @@
+#include "syscalls.h"
+#include <algorithm>
+#include <charconv>
+#include <cctype>
+#include <cerrno>
+#include <sstream>
+#include <unistd.h>
+
+namespace mips {
+
+namespace {
+
+enum Service : uint32_t {
+    PRINT_INT    = 1,
+    PRINT_STRING = 4,
+    READ_INT     = 5,
+    SBRK         = 9,
+    EXIT         = 10,
+    PRINT_CHAR   = 11,
+    READ_CHAR    = 12,
+    EXIT2        = 17
+};
+
+} // namespace
+
+UnsupportedSyscallException::UnsupportedSyscallException(uint32_t service, uint32_t pc) {
+    std::ostringstream stream;
+    stream << "Unsupported syscall " << service << " at 0x" << std::hex << pc << ".";
+    message_ = stream.str();
+}
+
+SpimSyscalls::SpimSyscalls(std::FILE *out, std::FILE *in, std::mutex *host_lock)
+        : out_(out), in_(in), host_lock_(host_lock), output_(new char[OUTPUT_BUFFER_SIZE]),
+          input_(new char[INPUT_BUFFER_SIZE]) {}
+
+SpimSyscalls::~SpimSyscalls() {
+    Flush();
+}
+
+std::unique_lock<std::mutex> SpimSyscalls::LockHost() {
+    return host_lock_ != nullptr ? std::unique_lock<std::mutex>(*host_lock_) : std::unique_lock<std::mutex>();
+}
+
+void SpimSyscalls::Flush() {
+    auto const lock = LockHost();
+    if (output_size_ != 0) {
+        std::fwrite(output_.get(), 1, output_size_, out_);
+        output_size_ = 0;
+    }
+    std::fflush(out_);
+}
+
+void SpimSyscalls::Write(char const *data, std::size_t size) {
+    if (size > OUTPUT_BUFFER_SIZE - output_size_) {
+        Flush();
+        if (size >= OUTPUT_BUFFER_SIZE) {
+            auto const lock = LockHost();
+            std::fwrite(data, 1, size, out_);
+            return;
+        }
+    }
+    std::copy(data, data + size, output_.get() + output_size_);
+    output_size_ += size;
+}
+
+void SpimSyscalls::WriteString(Simulator const &simulator, uint32_t address) {
+    // Strings are read a word at a time; bytes are little endian within a word.
+    char chunk[256];
+    std::size_t length = 0;
+    uint32_t const end = address - 1;
+    while (address != end) {
+        uint32_t const word = simulator.memory().Load(address & ~3u);
+        uint32_t byte = address & 3u;
+        for (; byte < 4; ++byte) {
+            char const c = static_cast<char>(word >> (8 * byte));
+            if (c == '\0') {
+                Write(chunk, length);
+                return;
+            }
+            chunk[length++] = c;
+        }
+        if (length > sizeof(chunk) - 4) {
+            Write(chunk, length);
+            length = 0;
+        }
+        address = (address & ~3u) + 4;
+    }
+    Write(chunk, length);
+}
+
+int SpimSyscalls::PeekChar() {
+    if (input_position_ == input_size_) {
+        Flush();
+        // read returns what is ready instead of waiting for a full buffer.
+        auto const lock = LockHost();
+        ssize_t count;
+        do {
+            count = read(fileno(in_), input_.get(), INPUT_BUFFER_SIZE);
+        } while (count < 0 && errno == EINTR);
+        input_size_ = count > 0 ? static_cast<std::size_t>(count) : 0;
+        input_position_ = 0;
+        if (input_size_ == 0) {
+            return EOF;
+        }
+    }
+    return static_cast<unsigned char>(input_[input_position_]);
+}
+
+int SpimSyscalls::ReadChar() {
+    int const c = PeekChar();
+    if (c != EOF) {
+        ++input_position_;
+    }
+    return c;
+}
+
+// Like SPIM, consumes the rest of the line after the number.
+uint32_t SpimSyscalls::ReadInt() {
+    int c = ReadChar();
+    while (c != EOF && std::isspace(c)) {
+        c = ReadChar();
+    }
+    bool const negative = c == '-';
+    if (c == '-' || c == '+') {
+        c = ReadChar();
+    }
+    uint32_t value = 0;
+    while (c != EOF && std::isdigit(c)) {
+        value = value * 10 + static_cast<uint32_t>(c - '0');
+        c = ReadChar();
+    }
+    while (c != EOF && c != '\n') {
+        c = ReadChar();
+    }
+    return negative ? 0u - value : value;
+}
+
+void SpimSyscalls::Handle(Simulator &simulator) {
+    uint32_t const a0 = simulator.reg(Instruction::A0);
+    switch (uint32_t const service = simulator.reg(Instruction::V0)) {
+    case PRINT_INT: {
+        char digits[16];
+        auto const result = std::to_chars(digits, digits + sizeof(digits), static_cast<int32_t>(a0));
+        Write(digits, static_cast<std::size_t>(result.ptr - digits));
+        break;
+    }
+    case PRINT_STRING:
+        WriteString(simulator, a0);
+        break;
+    case READ_INT:
+        simulator.set_reg(Instruction::V0, ReadInt());
+        break;
+    case SBRK:
+        simulator.set_reg(Instruction::V0, heap_break_);
+        heap_break_ += (a0 + 3u) & ~3u;
+        break;
+    case EXIT:
+        simulator.Exit(0);
+        break;
+    case PRINT_CHAR: {
+        char const c = static_cast<char>(a0);
+        Write(&c, 1);
+        break;
+    }
+    case READ_CHAR:
+        simulator.set_reg(Instruction::V0, static_cast<uint32_t>(ReadChar()));
+        break;
+    case EXIT2:
+        simulator.Exit(a0);
+        break;
+    default:
+        throw UnsupportedSyscallException(service, simulator.pc());
+    }
+}
+
+} // namespace mips
@@ -0,0 +1,579 @@
+#include "timing.h"
+#include "instructions.h"
+#include "register_effects.h"
+#include <algorithm>
+#include <array>
+#include <cstdlib>
+#include <iomanip>
+#include <limits>
+#include <map>
+#include <sstream>
+
+namespace mips {
+
+namespace {
+
+constexpr std::size_t MAX_CALL_PATHS = 1000;
+
+using Effects = RegisterEffects;
+using Residue = RegisterResidue;
+
+struct Cost {
+    uint64_t worst;
+    uint64_t best;
+
+    void Combine(Cost const &other) {
+        worst = std::max(worst, other.worst);
+        best = std::min(best, other.best);
+    }
+};
+
+std::string Hex(uint32_t value) {
+    std::ostringstream text;
+    text << "0x" << std::hex << std::setw(8) << std::setfill('0') << value;
+    return text.str();
+}
+
+bool ParseCount(char const *&text, uint64_t *value) {
+    char *end;
+    *value = std::strtoull(text, &end, 10);
+    if (end == text) {
+        return false;
+    }
+    text = end;
+    return true;
+}
+
+} // namespace
+
+InvalidCostModelException::InvalidCostModelException(std::string const &spec) {
+    message_ = "Invalid cost model \"" + spec
+            + "\": expected key=value pairs of alu, load, store, branch, jump, syscall and taken.";
+}
+
+CostModel CostModel::Parse(std::string const &spec) {
+    CostModel model;
+    std::istringstream stream(spec);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        std::size_t const equals = item.find('=');
+        if (equals == std::string::npos || equals + 1 == item.size()
+                || item.find_first_not_of("0123456789", equals + 1) != std::string::npos) {
+            throw InvalidCostModelException(spec);
+        }
+        std::string const key = item.substr(0, equals);
+        uint32_t const value = static_cast<uint32_t>(std::stoul(item.substr(equals + 1)));
+        if (key == "alu") {
+            model.alu = value;
+        } else if (key == "load") {
+            model.load = value;
+        } else if (key == "store") {
+            model.store = value;
+        } else if (key == "branch") {
+            model.branch = value;
+        } else if (key == "jump") {
+            model.jump = value;
+        } else if (key == "syscall") {
+            model.syscall = value;
+        } else if (key == "taken") {
+            model.taken = value;
+        } else {
+            throw InvalidCostModelException(spec);
+        }
+    }
+    return model;
+}
+
+TimingAnalyzer::TimingAnalyzer(std::vector<Parser::InstructionData> const &instructions,
+                               std::unordered_map<std::string, uint32_t> const &functions,
+                               std::vector<SourceAnnotation> const &annotations, CostModel const &cost,
+                               PipelineModel const &pipeline)
+        : instructions_(instructions), cfg_(instructions, functions), cost_(cost), pipeline_(pipeline) {
+    for (auto const &annotation : annotations) {
+        if (annotation.text.compare(0, 5, "@loop") != 0) {
+            continue;
+        }
+        char const *text = annotation.text.c_str() + 5;
+        uint64_t first;
+        uint64_t last;
+        bool valid = ParseCount(text, &first);
+        if (valid && text[0] == '.' && text[1] == '.') {
+            text += 2;
+            valid = ParseCount(text, &last) && first <= last;
+        } else {
+            last = first;
+            first = 1;
+        }
+        if (!valid || last == 0) {
+            throw UnexpectedSymbolException(annotation.text, annotation.line_number,
+                                            "Expected @loop <max> or @loop <min>..<max>.");
+        }
+        bounds_[uint64_t{annotation.file} << 32u | annotation.line_number] = {std::max<uint64_t>(first, 1), last};
+    }
+
+    std::vector<Effects> effects;
+    effects.reserve(instructions.size());
+    for (auto const &data : instructions) {
+        effects.push_back(Effects::Of(data));
+    }
+    // Indexed by Effects::Kind.
+    uint32_t const costs[] = {cost_.alu, cost_.load, cost_.store, cost_.branch, cost_.jump, cost_.jump, cost_.jump,
+                              cost_.syscall};
+    // Issues a block in order from the given readiness, returning its cycles and leaving what is still pending in out.
+    auto const issue = [&](ControlFlowGraph::BasicBlock const &block, Residue ready, Residue *out) {
+        int64_t cycle = 0;
+        for (std::size_t i = block.begin; i < block.end; ++i) {
+            Effects const &effect = effects[i];
+            int64_t start = cycle;
+            for (uint8_t r = 0; r < effect.read_count; ++r) {
+                start = std::max(start, ready[effect.reads[r]][effect.read_class()]);
+            }
+            cycle = start + costs[effect.kind];
+            if (effect.write != Effects::NO_REGISTER) {
+                ready[effect.write][0] = start + 1 + pipeline_.Latency(effect.kind, Effects::EXECUTE);
+                ready[effect.write][1] = start + 1 + pipeline_.Latency(effect.kind, Effects::DECODE);
+            }
+        }
+        if (out != nullptr) {
+            for (std::size_t r = 0; r < ready.size(); ++r) {
+                for (int c = 0; c < 2; ++c) {
+                    (*out)[r][c] = std::max<int64_t>(0, ready[r][c] - cycle);
+                }
+            }
+        }
+        return static_cast<uint64_t>(cycle);
+    };
+
+    auto const &blocks = cfg_.blocks();
+    std::vector<Residue> residues(blocks.size());
+    std::vector<uint64_t> issued(blocks.size());
+    for (std::size_t b = 0; b < blocks.size(); ++b) {
+        issued[b] = issue(blocks[b], Residue(), &residues[b]);
+    }
+    block_cycles_ = issued;
+    edge_cycles_.resize(blocks.size());
+    for (std::size_t b = 0; b < blocks.size(); ++b) {
+        std::size_t const last = blocks[b].end - 1;
+        Effects const &effect = effects[last];
+        for (std::size_t s : blocks[b].successors) {
+            uint64_t cycles = issue(blocks[s], residues[b], nullptr) - issued[s];
+            if (effect.kind == Effects::BRANCH && blocks[s].begin != blocks[b].end) {
+                cycles += cost_.taken;
+            }
+            edge_cycles_[b].push_back(cycles);
+        }
+        if (effect.kind == Effects::JUMP || effect.kind == Effects::CALL || effect.kind == Effects::JUMP_REGISTER) {
+            block_cycles_[b] += cost_.taken;
+        }
+    }
+
+    timings_.resize(cfg_.functions().size());
+    calls_.resize(cfg_.functions().size());
+    state_.resize(cfg_.functions().size());
+    for (std::size_t f = 0; f < cfg_.functions().size(); ++f) {
+        AnalyzeFunction(f);
+    }
+}
+
+void TimingAnalyzer::AnalyzeFunction(std::size_t function) {
+    if (state_[function] != 0) {
+        return;
+    }
+    state_[function] = 1;
+    auto const &blocks = cfg_.blocks();
+    auto const &info = cfg_.functions()[function];
+    timings_[function].name = info.name;
+    std::string reason;        // Why the paths cannot be bounded.
+    std::string call_reason;   // Why a callee cannot be.
+
+    struct Node {
+        Cost cost;
+        std::map<std::size_t, Cost> successors;
+        bool alive = true;
+    };
+    // Everything reachable from the entry, including code shared with other
+    // functions, which the ControlFlowGraph gives to only one of them.
+    std::vector<std::size_t> members;
+    std::unordered_map<std::size_t, std::size_t> local;
+    for (std::vector<std::size_t> work{info.entry}; !work.empty();) {
+        std::size_t const b = work.back();
+        work.pop_back();
+        if (local.emplace(b, members.size()).second) {
+            members.push_back(b);
+            work.insert(std::end(work), std::begin(blocks[b].successors), std::end(blocks[b].successors));
+        }
+    }
+    std::size_t const size = members.size();
+    std::vector<Node> nodes(size);
+    std::vector<std::vector<std::size_t>> predecessors(size);
+    std::vector<std::pair<std::size_t, std::size_t>> call_blocks;   // (local block, callee)
+    for (std::size_t i = 0; i < size; ++i) {
+        std::size_t const b = members[i];
+        Cost cost{block_cycles_[b], block_cycles_[b]};
+        std::size_t const callee = blocks[b].callee;
+        if (callee != ControlFlowGraph::NONE) {
+            call_blocks.emplace_back(i, callee);
+            AnalyzeFunction(callee);
+            if (state_[callee] == 1) {
+                call_reason = call_reason.empty() ? "recursive call to " + cfg_.functions()[callee].name
+                        : call_reason;
+            } else if (!timings_[callee].bounded) {
+                call_reason = call_reason.empty() ? "calls " + cfg_.functions()[callee].name + ", which is unbounded"
+                        : call_reason;
+            } else {
+                cost.worst += timings_[callee].worst;
+                cost.best += timings_[callee].best;
+            }
+        }
+        nodes[i].cost = cost;
+        for (std::size_t s = 0; s < blocks[b].successors.size(); ++s) {
+            auto found = local.find(blocks[b].successors[s]);
+            if (found != local.end()) {
+                uint64_t const cycles = edge_cycles_[b][s];
+                nodes[i].successors[found->second] = {cycles, cycles};
+                predecessors[found->second].push_back(i);
+            }
+        }
+    }
+
+    // Dominators (Cooper, Harvey and Kennedy) over the blocks in reverse postorder.
+    std::size_t const entry = local[info.entry];
+    std::vector<std::size_t> order;
+    std::vector<std::size_t> rank(size, ControlFlowGraph::NONE);
+    {
+        std::vector<std::pair<std::size_t, std::map<std::size_t, Cost>::const_iterator>> stack;
+        std::vector<bool> seen(size, false);
+        seen[entry] = true;
+        stack.emplace_back(entry, nodes[entry].successors.cbegin());
+        while (!stack.empty()) {
+            auto &top = stack.back();
+            if (top.second == nodes[top.first].successors.cend()) {
+                order.push_back(top.first);
+                stack.pop_back();
+                continue;
+            }
+            std::size_t const next = (top.second++)->first;
+            if (!seen[next]) {
+                seen[next] = true;
+                stack.emplace_back(next, nodes[next].successors.cbegin());
+            }
+        }
+        std::reverse(std::begin(order), std::end(order));
+        for (std::size_t i = 0; i < order.size(); ++i) {
+            rank[order[i]] = i;
+        }
+    }
+    std::vector<std::size_t> dominator(size, ControlFlowGraph::NONE);
+    dominator[entry] = entry;
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (std::size_t b : order) {
+            if (b == entry) {
+                continue;
+            }
+            std::size_t next = ControlFlowGraph::NONE;
+            for (std::size_t p : predecessors[b]) {
+                if (dominator[p] == ControlFlowGraph::NONE) {
+                    continue;
+                }
+                if (next == ControlFlowGraph::NONE) {
+                    next = p;
+                    continue;
+                }
+                std::size_t a = p;
+                while (a != next) {
+                    while (rank[a] > rank[next]) {
+                        a = dominator[a];
+                    }
+                    while (rank[next] > rank[a]) {
+                        next = dominator[next];
+                    }
+                }
+            }
+            if (dominator[b] != next) {
+                dominator[b] = next;
+                changed = true;
+            }
+        }
+    }
+    auto const dominates = [&](std::size_t a, std::size_t b) {
+        for (; b != entry; b = dominator[b]) {
+            if (b == a) {
+                return true;
+            }
+        }
+        return a == entry;
+    };
+
+    // Natural loops by header, innermost (smallest) first.
+    std::map<std::size_t, std::vector<std::size_t>> back_edges;
+    for (std::size_t u : order) {
+        for (auto const &successor : nodes[u].successors) {
+            if (dominates(successor.first, u)) {
+                back_edges[successor.first].push_back(u);
+            }
+        }
+    }
+    struct Loop {
+        std::size_t header;
+        std::vector<std::size_t> body;
+        std::pair<uint64_t, uint64_t> bound;
+    };
+    std::vector<Loop> loops;
+    for (auto const &back_edge : back_edges) {
+        std::size_t const header = back_edge.first;
+        std::vector<bool> in_body(size, false);
+        in_body[header] = true;
+        std::vector<std::size_t> body{header};
+        std::vector<std::size_t> work(std::begin(back_edge.second), std::end(back_edge.second));
+        while (!work.empty()) {
+            std::size_t const b = work.back();
+            work.pop_back();
+            if (!in_body[b]) {
+                in_body[b] = true;
+                body.push_back(b);
+                work.insert(std::end(work), std::begin(predecessors[b]), std::end(predecessors[b]));
+            }
+        }
+
+        // The bound sits on a branch back to the header or just before the
+        // header's first instruction, in the same file. Lines are keyed as in bounds_.
+        auto const line_of = [this](std::size_t index) {
+            return uint64_t{instructions_[index].file()} << 32u | instructions_[index].line_number();
+        };
+        std::vector<uint64_t> lines;
+        for (std::size_t source : back_edge.second) {
+            lines.push_back(line_of(blocks[members[source]].end - 1));
+        }
+        std::size_t const begin = blocks[members[header]].begin;
+        uint64_t const header_line = line_of(begin);
+        uint64_t line = (header_line & ~uint64_t{0xffffffffu}) | 1u;
+        if (begin != 0 && line_of(begin - 1) >> 32u == header_line >> 32u) {
+            line = line_of(begin - 1) + 1;
+        }
+        for (; line <= header_line; ++line) {
+            lines.push_back(line);
+        }
+        auto const bound = std::find_if(std::begin(lines), std::end(lines),
+                                        [this](uint64_t line) { return bounds_.count(line) != 0; });
+        if (bound == std::end(lines)) {
+            reason = reason.empty() ? "loop at " + Hex(CODE_SEGMENT_OFFSET + static_cast<uint32_t>(begin) * 4)
+                    + " (line " + std::to_string(instructions_[begin].line_number()) + ") has no @loop bound"
+                    : reason;
+            continue;
+        }
+        loops.push_back({header, std::move(body), bounds_[*bound]});
+    }
+    std::stable_sort(std::begin(loops), std::end(loops),
+                     [](Loop const &a, Loop const &b) { return a.body.size() < b.body.size(); });
+
+    // Longest and shortest paths over the live nodes marked in set, from
+    // start; edges into start are left out. False if a cycle remains.
+    std::vector<Cost> distance;
+    auto const paths = [&](std::vector<bool> const &set, std::size_t start) {
+        std::vector<uint32_t> incoming(nodes.size(), 0);
+        for (std::size_t u = 0; u < nodes.size(); ++u) {
+            if (set[u]) {
+                for (auto const &successor : nodes[u].successors) {
+                    incoming[successor.first] += set[successor.first] && successor.first != start;
+                }
+            }
+        }
+        distance.assign(nodes.size(), {0, std::numeric_limits<uint64_t>::max()});
+        distance[start] = nodes[start].cost;
+        std::vector<std::size_t> ready{start};
+        std::size_t visited = 0;
+        while (!ready.empty()) {
+            std::size_t const u = ready.back();
+            ready.pop_back();
+            ++visited;
+            for (auto const &successor : nodes[u].successors) {
+                std::size_t const v = successor.first;
+                if (!set[v] || v == start) {
+                    continue;
+                }
+                distance[v].Combine({distance[u].worst + successor.second.worst + nodes[v].cost.worst,
+                                     distance[u].best + successor.second.best + nodes[v].cost.best});
+                if (--incoming[v] == 0) {
+                    ready.push_back(v);
+                }
+            }
+        }
+        return visited == static_cast<std::size_t>(std::count(std::begin(set), std::end(set), true));
+    };
+
+    std::vector<std::size_t> owner(size);
+    for (std::size_t i = 0; i < size; ++i) {
+        owner[i] = i;
+    }
+    std::vector<uint64_t> multiplicity(size, 1);
+    for (auto const &loop : loops) {
+        if (!reason.empty()) {
+            break;
+        }
+        std::vector<bool> in_loop(nodes.size() + 1, false);
+        for (std::size_t b : loop.body) {
+            in_loop[owner[b]] = true;
+        }
+        std::size_t const header = owner[loop.header];
+        if (!paths(in_loop, header)) {
+            reason = "control flow that is not a natural loop";
+            break;
+        }
+        Cost trip{0, std::numeric_limits<uint64_t>::max()};
+        Node collapsed;
+        for (std::size_t u = 0; u < nodes.size(); ++u) {
+            if (!in_loop[u]) {
+                continue;
+            }
+            for (auto const &successor : nodes[u].successors) {
+                Cost const through{distance[u].worst + successor.second.worst,
+                                   distance[u].best + successor.second.best};
+                if (successor.first == header) {
+                    trip.Combine(through);
+                } else if (!in_loop[successor.first]) {
+                    auto inserted = collapsed.successors.emplace(successor.first, through);
+                    if (!inserted.second) {
+                        inserted.first->second.Combine(through);
+                    }
+                }
+            }
+            nodes[u].alive = false;
+        }
+        collapsed.cost = {(loop.bound.second - 1) * trip.worst, (loop.bound.first - 1) * trip.best};
+        std::size_t const index = nodes.size();
+        for (auto &node : nodes) {
+            if (!node.alive) {
+                continue;
+            }
+            Cost into{0, std::numeric_limits<uint64_t>::max()};
+            bool found = false;
+            for (auto it = node.successors.begin(); it != node.successors.end();) {
+                if (in_loop[it->first]) {
+                    into.Combine(it->second);
+                    found = true;
+                    it = node.successors.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+            if (found) {
+                node.successors[index] = into;
+            }
+        }
+        nodes.push_back(std::move(collapsed));
+        for (std::size_t i = 0; i < size; ++i) {
+            if (in_loop[owner[i]]) {
+                owner[i] = index;
+            }
+        }
+        for (std::size_t b : loop.body) {
+            multiplicity[b] *= loop.bound.second;
+        }
+    }
+
+    for (auto const &call : call_blocks) {
+        calls_[function].push_back({call.second, reason.empty() ? multiplicity[call.first] : 0});
+    }
+    if (reason.empty() && call_reason.empty()) {
+        std::vector<bool> live(nodes.size(), false);
+        std::vector<std::size_t> work{owner[entry]};
+        while (!work.empty()) {
+            std::size_t const u = work.back();
+            work.pop_back();
+            if (!live[u]) {
+                live[u] = true;
+                for (auto const &successor : nodes[u].successors) {
+                    work.push_back(successor.first);
+                }
+            }
+        }
+        if (!paths(live, owner[entry])) {
+            reason = "control flow that is not a natural loop";
+        } else {
+            Cost total{0, std::numeric_limits<uint64_t>::max()};
+            for (std::size_t u = 0; u < nodes.size(); ++u) {
+                if (live[u] && nodes[u].successors.empty()) {
+                    total.Combine(distance[u]);
+                }
+            }
+            if (total.best == std::numeric_limits<uint64_t>::max()) {
+                reason = "never returns";
+            } else {
+                timings_[function].worst = total.worst;
+                timings_[function].best = total.best;
+            }
+        }
+    }
+    if (reason.empty()) {
+        reason = call_reason;
+    }
+    timings_[function].bounded = reason.empty();
+    timings_[function].reason = reason;
+    state_[function] = 2;
+}
+
+void TimingAnalyzer::WriteReport(std::ostream &out) const {
+    auto const write_bounds = [&out](FunctionTiming const &timing) {
+        if (timing.bounded) {
+            out << std::setw(14) << timing.best << std::setw(14) << timing.worst;
+        } else {
+            out << std::setw(28) << "unbounded";
+        }
+    };
+
+    out << std::setw(14) << "best" << std::setw(14) << "worst" << "  function (cycles per call)\n";
+    for (auto const &timing : timings_) {
+        write_bounds(timing);
+        out << "  " << timing.name << (timing.bounded ? "" : ": " + timing.reason) << '\n';
+    }
+
+    out << '\n' << std::setw(14) << "calls" << std::setw(14) << "best" << std::setw(14) << "worst"
+        << "  call path\n";
+    std::size_t written = 0;
+    std::vector<std::size_t> path;
+    // count 0 is unknown: some loop on the way has no bound.
+    auto const walk = [&](auto const &self, std::size_t function, uint64_t count) -> void {
+        if (written++ == MAX_CALL_PATHS) {
+            out << "  ... more paths left out\n";
+            return;
+        }
+        if (written > MAX_CALL_PATHS) {
+            return;
+        }
+        bool const recursive = std::find(std::begin(path), std::end(path), function) != std::end(path);
+        path.push_back(function);
+        if (count == 0) {
+            out << std::setw(14) << "?";
+        } else {
+            out << std::setw(14) << count;
+        }
+        write_bounds(timings_[function]);
+        out << "  ";
+        for (std::size_t i = 0; i < path.size(); ++i) {
+            out << (i == 0 ? "" : " > ") << timings_[path[i]].name;
+        }
+        out << (recursive ? " (recursive)" : "") << '\n';
+        if (!recursive) {
+            std::map<std::size_t, uint64_t> callees;
+            for (auto const &call : calls_[function]) {
+                auto inserted = callees.emplace(call.callee, call.count);
+                if (!inserted.second) {
+                    inserted.first->second = inserted.first->second == 0 || call.count == 0
+                            ? 0 : inserted.first->second + call.count;
+                }
+            }
+            for (auto const &callee : callees) {
+                self(self, callee.first, count == 0 || callee.second == 0 ? 0 : count * callee.second);
+            }
+        }
+        path.pop_back();
+    };
+    for (std::size_t f = 0; f < cfg_.functions().size(); ++f) {
+        if (cfg_.functions()[f].callers.empty()) {
+            walk(walk, f, 1);
+        }
+    }
+}
+
+} // namespace mips
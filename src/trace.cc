@@ -0,0 +1,479 @@
+#include "trace.h"
+#include "assembler.h"
+#include "compression.h"
+#include <algorithm>
+#include <cstring>
+
+namespace mips {
+
+namespace {
+
+constexpr char TRACE_MAGIC[8] = {'M', 'I', 'P', 'S', 'T', 'R', 'C', '1'};
+constexpr char INDEX_MAGIC[8] = {'M', 'I', 'P', 'S', 'I', 'D', 'X', '1'};
+constexpr uint32_t TRACE_VERSION = 1;
+constexpr std::size_t HEADER_SIZE = 16;
+constexpr std::size_t BLOCK_HEADER_SIZE = 20;
+constexpr std::size_t FOOTER_SIZE = 24;
+constexpr std::size_t BLOCK_SIZE = 1u << 18u;
+// Flags, word, register, and four varints of at most five bytes.
+constexpr std::size_t MAX_RECORD_SIZE = 1 + 4 + 1 + 4 * 5;
+
+enum RecordFlags : uint8_t {
+    PC_JUMP = 0x01,
+    REGISTER_WRITE = 0x02,
+    MEMORY_LOAD = 0x04,
+    MEMORY_STORE = 0x08,
+    WORD_REPEAT = 0x10,
+};
+
+// Direct-mapped cache of the last word seen at each PC so loops do not repeat their encodings.
+constexpr std::size_t WORD_CACHE_SIZE = 256;
+
+inline std::size_t WordCacheSlot(uint32_t pc) {
+    return (pc >> 2u) & (WORD_CACHE_SIZE - 1);
+}
+
+void Put32(uint8_t *out, uint32_t value) {
+    for (int i = 0; i < 4; ++i) {
+        out[i] = static_cast<uint8_t>(value >> (8 * i));
+    }
+}
+
+void Put64(uint8_t *out, uint64_t value) {
+    for (int i = 0; i < 8; ++i) {
+        out[i] = static_cast<uint8_t>(value >> (8 * i));
+    }
+}
+
+uint32_t Get32(uint8_t const *in) {
+    uint32_t value = 0;
+    for (int i = 0; i < 4; ++i) {
+        value |= static_cast<uint32_t>(in[i]) << (8 * i);
+    }
+    return value;
+}
+
+uint64_t Get64(uint8_t const *in) {
+    uint64_t value = 0;
+    for (int i = 0; i < 8; ++i) {
+        value |= static_cast<uint64_t>(in[i]) << (8 * i);
+    }
+    return value;
+}
+
+uint8_t *PutVarint(uint8_t *out, uint32_t value) {
+    while (value >= 0x80) {
+        *out++ = static_cast<uint8_t>(value | 0x80);
+        value >>= 7u;
+    }
+    *out++ = static_cast<uint8_t>(value);
+    return out;
+}
+
+uint8_t *PutZigzag(uint8_t *out, uint32_t delta) {
+    int32_t const value = static_cast<int32_t>(delta);
+    return PutVarint(out, (static_cast<uint32_t>(value) << 1u) ^ static_cast<uint32_t>(value >> 31));
+}
+
+uint32_t GetVarint(std::vector<uint8_t> const &in, std::size_t &position) {
+    uint32_t value = 0;
+    for (unsigned shift = 0; shift < 35; shift += 7) {
+        if (position >= in.size()) {
+            throw CorruptDataException("Truncated trace record.");
+        }
+        uint8_t const byte = in[position++];
+        value |= static_cast<uint32_t>(byte & 0x7fu) << shift;
+        if (!(byte & 0x80u)) {
+            return value;
+        }
+    }
+    throw CorruptDataException("Varint too long.");
+}
+
+uint32_t GetZigzag(std::vector<uint8_t> const &in, std::size_t &position) {
+    uint32_t const value = GetVarint(in, position);
+    return (value >> 1u) ^ (0u - (value & 1u));
+}
+
+} // namespace
+
+TraceWriter::TraceWriter(std::string const &file_path)
+        : file_(file_path, std::ios::out | std::ios::binary) {
+    if (!file_.is_open()) {
+        throw FileNotFoundException(file_path);
+    }
+    uint8_t header[HEADER_SIZE] = {};
+    std::memcpy(header, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+    Put32(header + 8, TRACE_VERSION);
+    file_.write(reinterpret_cast<char const *>(header), sizeof(header));
+    offset_ = sizeof(header);
+
+    blocks_[0].data.resize(BLOCK_SIZE + MAX_RECORD_SIZE);
+    blocks_[1].data.resize(BLOCK_SIZE + MAX_RECORD_SIZE);
+    ResetDeltaState();
+    thread_ = std::thread(&TraceWriter::WriteBlocks, this);
+}
+
+TraceWriter::~TraceWriter() {
+    try {
+        Close();
+    } catch (...) {
+    }
+}
+
+void TraceWriter::ResetDeltaState() {
+    previous_pc_ = CODE_SEGMENT_OFFSET - 4;
+    previous_address_ = 0;
+    std::fill(std::begin(registers_), std::end(registers_), 0);
+    // PCs are word aligned, so 1 never matches.
+    std::fill(std::begin(word_cache_), std::end(word_cache_), std::make_pair(1u, 0u));
+}
+
+void TraceWriter::Append(TraceRecord const &record) {
+    Block &block = blocks_[active_];
+    if (block.records == 0) {
+        block.first_instruction = instructions_;
+    }
+
+    uint8_t flags = 0;
+    if (record.pc != previous_pc_ + 4) flags |= PC_JUMP;
+    if (record.register_write) flags |= REGISTER_WRITE;
+    if (record.load) flags |= MEMORY_LOAD;
+    if (record.store) flags |= MEMORY_STORE;
+    std::size_t const slot = WordCacheSlot(record.pc);
+    if (word_cache_[slot].first == record.pc && word_cache_[slot].second == record.word) {
+        flags |= WORD_REPEAT;
+    }
+
+    uint8_t *out = block.data.data() + block.size;
+    *out++ = flags;
+    if (!(flags & WORD_REPEAT)) {
+        Put32(out, record.word);
+        out += 4;
+        word_cache_[slot] = std::make_pair(record.pc, record.word);
+    }
+    if (flags & PC_JUMP) {
+        out = PutZigzag(out, record.pc - (previous_pc_ + 4));
+    }
+    previous_pc_ = record.pc;
+    if (flags & REGISTER_WRITE) {
+        *out++ = record.reg;
+        out = PutZigzag(out, record.reg_value - registers_[record.reg & 0x1fu]);
+        registers_[record.reg & 0x1fu] = record.reg_value;
+    }
+    if (flags & (MEMORY_LOAD | MEMORY_STORE)) {
+        out = PutZigzag(out, record.address - previous_address_);
+        out = PutVarint(out, record.memory_value);
+        previous_address_ = record.address;
+    }
+
+    block.size = static_cast<std::size_t>(out - block.data.data());
+    ++block.records;
+    ++instructions_;
+    if (block.size >= BLOCK_SIZE) {
+        SubmitBlock();
+    }
+}
+
+void TraceWriter::SubmitBlock() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    condition_.wait(lock, [this] { return !pending_; });
+    pending_ = true;
+    active_ ^= 1;
+    lock.unlock();
+    condition_.notify_all();
+
+    blocks_[active_].size = 0;
+    blocks_[active_].records = 0;
+    ResetDeltaState();
+}
+
+void TraceWriter::WriteBlocks() {
+    std::vector<uint8_t> compressed;
+    for (;;) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        condition_.wait(lock, [this] { return pending_ || closing_; });
+        if (!pending_) {
+            return;
+        }
+        Block const &block = blocks_[active_ ^ 1];
+        lock.unlock();
+
+        compressed.clear();
+        LZCompress(block.data.data(), block.size, compressed);
+        bool const stored = compressed.size() >= block.size;
+        uint8_t const *payload = stored ? block.data.data() : compressed.data();
+        std::size_t const payload_size = stored ? block.size : compressed.size();
+
+        uint8_t header[BLOCK_HEADER_SIZE];
+        Put32(header, static_cast<uint32_t>(block.size));
+        Put32(header + 4, static_cast<uint32_t>(payload_size));
+        Put64(header + 8, block.first_instruction);
+        Put32(header + 16, block.records);
+        file_.write(reinterpret_cast<char const *>(header), sizeof(header));
+        file_.write(reinterpret_cast<char const *>(payload), static_cast<std::streamsize>(payload_size));
+        index_.emplace_back(block.first_instruction, offset_);
+        offset_ += sizeof(header) + payload_size;
+
+        lock.lock();
+        pending_ = false;
+        lock.unlock();
+        condition_.notify_all();
+    }
+}
+
+void TraceWriter::Close() {
+    if (closed_) {
+        return;
+    }
+    closed_ = true;
+    if (blocks_[active_].records != 0) {
+        SubmitBlock();
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closing_ = true;
+    }
+    condition_.notify_all();
+    thread_.join();
+
+    std::vector<uint8_t> index(index_.size() * 16 + FOOTER_SIZE);
+    for (std::size_t i = 0; i < index_.size(); ++i) {
+        Put64(index.data() + i * 16, index_[i].first);
+        Put64(index.data() + i * 16 + 8, index_[i].second);
+    }
+    uint8_t *footer = index.data() + index_.size() * 16;
+    Put64(footer, offset_);
+    Put64(footer + 8, instructions_);
+    std::memcpy(footer + 16, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    file_.write(reinterpret_cast<char const *>(index.data()), static_cast<std::streamsize>(index.size()));
+    file_.close();
+}
+
+TraceReader::TraceReader(std::string const &file_path)
+        : file_(file_path, std::ios::in | std::ios::binary) {
+    if (!file_.is_open()) {
+        throw FileNotFoundException(file_path);
+    }
+    uint8_t header[HEADER_SIZE];
+    if (!file_.read(reinterpret_cast<char *>(header), sizeof(header))
+            || std::memcmp(header, TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0
+            || Get32(header + 8) != TRACE_VERSION) {
+        throw CorruptDataException("Not a trace file.");
+    }
+
+    file_.seekg(0, std::ios::end);
+    uint64_t const file_size = static_cast<uint64_t>(file_.tellg());
+    uint8_t footer[FOOTER_SIZE];
+    bool indexed = false;
+    if (file_size >= HEADER_SIZE + FOOTER_SIZE) {
+        file_.seekg(static_cast<std::streamoff>(file_size - FOOTER_SIZE));
+        indexed = file_.read(reinterpret_cast<char *>(footer), sizeof(footer))
+                && std::memcmp(footer + 16, INDEX_MAGIC, sizeof(INDEX_MAGIC)) == 0;
+    }
+    if (indexed) {
+        uint64_t const index_offset = Get64(footer);
+        instructions_ = Get64(footer + 8);
+        std::vector<uint8_t> index(file_size - FOOTER_SIZE - index_offset);
+        file_.seekg(static_cast<std::streamoff>(index_offset));
+        file_.read(reinterpret_cast<char *>(index.data()), static_cast<std::streamsize>(index.size()));
+        for (std::size_t i = 0; i + 16 <= index.size(); i += 16) {
+            index_.emplace_back(Get64(index.data() + i), Get64(index.data() + i + 8));
+        }
+    } else {
+        // The writer did not finish; recover the index from the block headers.
+        ScanBlocks();
+    }
+    Seek(0);
+}
+
+void TraceReader::ScanBlocks() {
+    uint64_t offset = HEADER_SIZE;
+    uint8_t header[BLOCK_HEADER_SIZE];
+    file_.clear();
+    file_.seekg(static_cast<std::streamoff>(offset));
+    while (file_.read(reinterpret_cast<char *>(header), sizeof(header))) {
+        uint32_t const stored_size = Get32(header + 4);
+        index_.emplace_back(Get64(header + 8), offset);
+        instructions_ = Get64(header + 8) + Get32(header + 16);
+        offset += sizeof(header) + stored_size;
+        file_.seekg(static_cast<std::streamoff>(offset));
+    }
+    // The last block may have been cut short.
+    if (!index_.empty() && !LoadBlock(index_.size() - 1)) {
+        instructions_ = index_.back().first;
+        index_.pop_back();
+    }
+    file_.clear();
+}
+
+bool TraceReader::LoadBlock(std::size_t block) {
+    uint8_t header[BLOCK_HEADER_SIZE];
+    file_.clear();
+    file_.seekg(static_cast<std::streamoff>(index_[block].second));
+    if (!file_.read(reinterpret_cast<char *>(header), sizeof(header))) {
+        return false;
+    }
+    uint32_t const raw_size = Get32(header);
+    uint32_t const stored_size = Get32(header + 4);
+    std::vector<uint8_t> stored(stored_size);
+    if (!file_.read(reinterpret_cast<char *>(stored.data()), stored_size)) {
+        return false;
+    }
+    if (stored_size == raw_size) {
+        data_ = std::move(stored);
+    } else {
+        data_.resize(raw_size);
+        LZDecompress(stored.data(), stored.size(), data_.data(), raw_size);
+    }
+    block_ = block;
+    position_ = 0;
+    next_index_ = index_[block].first;
+    previous_pc_ = CODE_SEGMENT_OFFSET - 4;
+    previous_address_ = 0;
+    std::fill(std::begin(registers_), std::end(registers_), 0);
+    std::fill(std::begin(word_cache_), std::end(word_cache_), std::make_pair(1u, 0u));
+    return true;
+}
+
+void TraceReader::Seek(uint64_t instruction) {
+    data_.clear();
+    position_ = 0;
+    next_index_ = instructions_;
+    if (index_.empty() || instruction >= instructions_) {
+        return;
+    }
+    auto next = std::upper_bound(std::begin(index_), std::end(index_), instruction,
+                                 [](uint64_t value, auto const &entry) { return value < entry.first; });
+    std::size_t const block = static_cast<std::size_t>(next - std::begin(index_)) - 1;
+    if (!LoadBlock(block)) {
+        throw CorruptDataException("Truncated trace block.");
+    }
+    TraceRecord record;
+    while (next_index_ < instruction && Next(&record)) {
+    }
+}
+
+bool TraceReader::Next(TraceRecord *record) {
+    while (position_ >= data_.size()) {
+        if (data_.empty() || block_ + 1 >= index_.size()) {
+            return false;
+        }
+        if (!LoadBlock(block_ + 1)) {
+            return false;
+        }
+    }
+
+    uint8_t const flags = data_[position_++];
+    *record = TraceRecord();
+    record->index = next_index_++;
+    if (!(flags & WORD_REPEAT)) {
+        if (data_.size() - position_ < 4) {
+            throw CorruptDataException("Truncated trace record.");
+        }
+        record->word = Get32(data_.data() + position_);
+        position_ += 4;
+    }
+    record->pc = previous_pc_ + 4;
+    if (flags & PC_JUMP) {
+        record->pc += GetZigzag(data_, position_);
+    }
+    previous_pc_ = record->pc;
+    std::size_t const slot = WordCacheSlot(record->pc);
+    if (flags & WORD_REPEAT) {
+        if (word_cache_[slot].first != record->pc) {
+            throw CorruptDataException("Repeated word for an unseen PC.");
+        }
+        record->word = word_cache_[slot].second;
+    } else {
+        word_cache_[slot] = std::make_pair(record->pc, record->word);
+    }
+    if (flags & REGISTER_WRITE) {
+        if (position_ >= data_.size()) {
+            throw CorruptDataException("Truncated trace record.");
+        }
+        record->register_write = true;
+        record->reg = data_[position_++] & 0x1fu;
+        record->reg_value = registers_[record->reg] + GetZigzag(data_, position_);
+        registers_[record->reg] = record->reg_value;
+    }
+    if (flags & (MEMORY_LOAD | MEMORY_STORE)) {
+        record->load = flags & MEMORY_LOAD;
+        record->store = flags & MEMORY_STORE;
+        record->address = previous_address_ + GetZigzag(data_, position_);
+        record->memory_value = GetVarint(data_, position_);
+        previous_address_ = record->address;
+    }
+    return true;
+}
+
+Tracer::Tracer(std::vector<uint32_t> code, std::string const &file_path)
+        : simulator_(code), code_(std::move(code)), writer_(file_path) {}
+
+uint64_t Tracer::Run(uint64_t max_steps) {
+    uint64_t steps = 0;
+    TraceRecord record;
+    while (steps < max_steps && !simulator_.halted()) {
+        uint32_t const pc = simulator_.pc();
+        uint32_t const word = code_[(pc - CODE_SEGMENT_OFFSET) / 4];
+        uint32_t const rs = simulator_.reg(static_cast<Instruction::Register>(Instruction::RsOf(word)));
+        uint32_t const rt = Instruction::RtOf(word);
+
+        record = TraceRecord();
+        record.index = executed_;
+        record.pc = pc;
+        record.word = word;
+        uint32_t written = Instruction::ZERO;
+        switch (Instruction::OpcodeOf(word)) {
+        case Instruction::RTYPE:
+            if (Instruction::FunctOf(word) == Instruction::FUNCT_SYSCALL) {
+                written = Instruction::V0;
+            } else if (Instruction::FunctOf(word) != Instruction::FUNCT_JR) {
+                written = Instruction::RdOf(word);
+            }
+            break;
+        case Instruction::ADDI:
+        case Instruction::ANDI:
+        case Instruction::ORI:
+        case Instruction::SLTI:
+        case Instruction::LUI:
+            written = rt;
+            break;
+        case Instruction::LW:
+            written = rt;
+            record.load = true;
+            record.address = rs + Instruction::SignedImm16Of(word);
+            break;
+        case Instruction::SW:
+            record.store = true;
+            record.address = rs + Instruction::SignedImm16Of(word);
+            break;
+        case Instruction::JAL:
+            written = Instruction::RA;
+            break;
+        default:
+            break;
+        }
+
+        simulator_.Step();
+
+        if (written != Instruction::ZERO) {
+            record.register_write = true;
+            record.reg = static_cast<uint8_t>(written);
+            record.reg_value = simulator_.reg(static_cast<Instruction::Register>(written));
+        }
+        if (record.load || record.store) {
+            record.memory_value = simulator_.Load(record.address);
+        }
+        writer_.Append(record);
+        ++executed_;
+        ++steps;
+    }
+    return steps;
+}
+
+void Tracer::Close() {
+    writer_.Close();
+}
+
+} // namespace mips
@@ -0,0 +1,48 @@
+#include "disassembler.h"
+#include <fstream>
+#include <iostream>
+#include <cstring>
+
+namespace {
+
+void PrintUsage() {
+	std::cerr << "Usage: disassemble <image_file> [-o <output_file>]\n";
+}
+
+} // namespace
+
+int main(int argc, char const *argv[]) {
+	if (argc < 2) {
+		PrintUsage();
+		std::exit(EXIT_FAILURE);
+	}
+
+	std::string dest_file;
+	for (int i = 2; i < argc; ++i) {
+		if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+			dest_file = argv[++i];
+		} else {
+			std::cerr << "Invalid parameter " << argv[i] << ".\n";
+			PrintUsage();
+			std::exit(EXIT_FAILURE);
+		}
+	}
+
+	try {
+		mips::Disassembler disassembler(mips::Disassembler::ReadImage(argv[1]));
+		if (dest_file.empty()) {
+			disassembler.Write(std::cout);
+		} else {
+			std::ofstream file(dest_file, std::ios::out | std::ios::binary);
+			if (!file.is_open()) {
+				std::cerr << "Error: cannot write " << dest_file << ".\n";
+				exit(EXIT_FAILURE);
+			}
+			disassembler.Write(file);
+		}
+	} catch(std::exception const &e) {
+		std::cerr << "Error: ";
+		std::cerr << e.what() << std::endl;
+		exit(EXIT_FAILURE);
+	}
+}
@@ -0,0 +1,53 @@
+#include "linker.h"
+#include <iostream>
+#include <cstring>
+
+namespace {
+
+void PrintUsage() {
+	std::cerr << "Usage: link <object_file>... -o <output_file> [--base <address>] [--binary] [--threads <n>]\n";
+	std::cerr << "       Objects come from assembler -c and are placed in the order given;\n";
+	std::cerr << "       --base sets the address of the first (default 0x00400000).\n";
+}
+
+} // namespace
+
+int main(int argc, char const *argv[]) {
+	std::vector<std::string> object_files;
+	std::string dest_file;
+	uint32_t base = CODE_SEGMENT_OFFSET;
+	bool binary = false;
+	unsigned threads = 0;
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+			dest_file = argv[++i];
+		} else if (strcmp(argv[i], "--base") == 0 && i + 1 < argc) {
+			base = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 0));
+		} else if (strcmp(argv[i], "--binary") == 0) {
+			binary = true;
+		} else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+			threads = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 0));
+		} else if (argv[i][0] == '-') {
+			std::cerr << "Invalid parameter " << argv[i] << ".\n";
+			PrintUsage();
+			std::exit(EXIT_FAILURE);
+		} else {
+			object_files.push_back(argv[i]);
+		}
+	}
+	if (object_files.empty() || dest_file.empty()) {
+		PrintUsage();
+		std::exit(EXIT_FAILURE);
+	}
+
+	try {
+		mips::Linker linker(object_files, base, threads);
+		linker.WriteImage(dest_file, binary);
+		std::cout << "Linked " << object_files.size() << " objects: " << linker.code().size() << " words, "
+		          << linker.global_count() << " functions, " << linker.relocation_count() << " relocations.\n";
+	} catch(std::exception const &e) {
+		std::cerr << "Error: ";
+		std::cerr << e.what() << std::endl;
+		exit(EXIT_FAILURE);
+	}
+}
@@ -0,0 +1,90 @@
+#include "source_map.h"
+#include "trace.h"
+#include <iostream>
+#include <cstring>
+#include <memory>
+
+namespace {
+
+void PrintUsage() {
+	std::cerr << "Usage: tracedump <trace_file> [--from <instruction>] [--count <n>] [--map <index_file>]\n";
+	std::cerr << "--map adds the label, source file and line of every pc from an assembler --index file.\n";
+}
+
+void PrintHex(std::ostream &out, uint32_t value) {
+	out << "0x";
+	out.width(8);
+	out.fill('0');
+	out << std::hex << value << std::dec;
+}
+
+} // namespace
+
+int main(int argc, char const *argv[]) {
+	if (argc < 2) {
+		PrintUsage();
+		std::exit(EXIT_FAILURE);
+	}
+
+	uint64_t from = 0;
+	uint64_t count = UINT64_MAX;
+	std::string map_file;
+	for (int i = 2; i < argc; ++i) {
+		if (strcmp(argv[i], "--from") == 0 && i + 1 < argc) {
+			from = std::strtoull(argv[++i], nullptr, 0);
+		} else if (strcmp(argv[i], "--count") == 0 && i + 1 < argc) {
+			count = std::strtoull(argv[++i], nullptr, 0);
+		} else if (strcmp(argv[i], "--map") == 0 && i + 1 < argc) {
+			map_file = argv[++i];
+		} else {
+			std::cerr << "Invalid parameter " << argv[i] << ".\n";
+			PrintUsage();
+			std::exit(EXIT_FAILURE);
+		}
+	}
+
+	try {
+		std::unique_ptr<mips::SourceMap> map;
+		if (!map_file.empty()) {
+			map = std::make_unique<mips::SourceMap>(map_file);
+		}
+		mips::TraceReader reader(argv[1]);
+		mips::SourceLocation location;
+		reader.Seek(from);
+		mips::TraceRecord record;
+		for (uint64_t n = 0; n < count && reader.Next(&record); ++n) {
+			std::cout << record.index << ' ';
+			PrintHex(std::cout, record.pc);
+			std::cout << ' ';
+			PrintHex(std::cout, record.word);
+			if (map != nullptr && map->Lookup(record.pc, &location)) {
+				std::cout << "  " << (location.symbol.empty() ? "?" : location.symbol);
+				if (location.offset != 0) {
+					std::cout << "+0x" << std::hex << location.offset << std::dec;
+				}
+				// The file by its last component, to keep rows short.
+				std::string_view file = location.file;
+				std::size_t const slash = file.find_last_of('/');
+				if (slash != std::string_view::npos) {
+					file.remove_prefix(slash + 1);
+				}
+				std::cout << ' ' << file << ':' << location.line;
+			}
+			if (record.register_write) {
+				std::cout << "  " << mips::Instruction::RegisterNumberToName(
+				                         static_cast<mips::Instruction::Register>(record.reg))
+				          << " = " << static_cast<int32_t>(record.reg_value);
+			}
+			if (record.load || record.store) {
+				std::cout << (record.load ? "  load [" : "  store [");
+				PrintHex(std::cout, record.address);
+				std::cout << "] = " << static_cast<int32_t>(record.memory_value);
+			}
+			std::cout << '\n';
+		}
+	} catch(std::exception const &e) {
+		std::cerr << "Error: ";
+		std::cerr << e.what() << std::endl;
+		exit(EXIT_FAILURE);
+	}
+}